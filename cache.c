@@ -1,24 +1,47 @@
 #include "cache.h"
 #include <stdio.h>
-#include <math.h>
-
-
-// The cache is an array of CacheIndex
-CacheIndex cache[NUM_INDEXES];
-
-// Function to decompose a 32-bit address
-CacheAddress decompose_address(unsigned int address) {
+#include <string.h>
+#if !defined(LLC_SCALAR_LOOKUP) && defined(__AVX2__)
+#include <immintrin.h>
+#elif !defined(LLC_SCALAR_LOOKUP) && defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Force the per-kernel copies of the lookup and victim code to be generated
+#define KERNEL_INLINE static inline __attribute__((always_inline))
+
+// The modeled last-level cache
+Cache cache;
+
+// Caches on the snooping bus; `cache` is always the first. caches=N adds peers
+// of the same geometry, and trace records pick one with cpu=.
+Cache *bus_caches[MAX_CACHES] = {&cache};
+int num_caches = 1;
+static Cache *peer_caches;
+static int recalling;   // The snoop being handled is a snoop filter back-invalidation
+
+// Function to decompose a 32-bit address using a cache's precomputed shifts and masks
+CacheAddress decompose_cache_address(const Cache *c, unsigned int address) {
     CacheAddress parsed;
-    parsed.byte_offset = address & 0x3F;           // 6 LSB bits (0b111111 or 0x3F)
-    parsed.index = (address >> 6) & 0x3FFF;        // Next 14 bits (0x3FFF)
-    parsed.tag = (address >> 20) & 0xFFF;          // Remaining 12 bits
+    parsed.byte_offset = address & c->offset_mask;                  // 6 LSB bits by default
+    parsed.index = (address >> c->offset_bits) & c->index_mask;     // Next 14 bits by default
+    parsed.tag = (address >> c->tag_shift) & c->tag_mask;           // Remaining 12 bits by default
     return parsed;
 }
 
+// Decompose an address for the modeled cache
+CacheAddress decompose_address(unsigned int address) {
+    return decompose_cache_address(&cache, address);
+}
+
+// Rebuild the address of the first byte of a line from its tag and set
+static inline unsigned int line_address(const Cache *c, unsigned int tag, unsigned int index) {
+    return (tag << c->tag_shift) | (index << c->offset_bits);
+}
+
 // Function to initialize the metadata for a cache line
 CacheMetadata initialize_cache_metadata() {
     CacheMetadata metadata;
-    metadata.valid = 0;        // Invalid by default
     metadata.dirty = 0;        // Clean by default
     metadata.state = INVALID;  // Start in Invalid state (MESI)
     return metadata;
@@ -33,91 +56,861 @@ const char *get_mesi_state_name(MESIState state) {
         default: return "UNKNOWN";
     }
 }
-// Function to initialize the PLRU tree for an index
-void initialize_plru_tree(CacheIndex *index) {
-     int i;
-     for (i = 0; i < NUM_LINES_PER_INDEX - 1; i++) {
-        index->pseudo_LRU[i] = 0;  // Set each bit to 0 (empty tree)
+
+static const char *replacement_policy_names[] = {"plru", "lru", "srrip", "drrip", "random"};
+
+const char *replacement_policy_name(ReplacementPolicy policy) {
+    return replacement_policy_names[policy];
+}
+
+// Policy named `name`, or -1
+int parse_replacement_policy(const char *name) {
+    int policy;
+    for (policy = POLICY_PLRU; policy <= POLICY_RANDOM; policy++) {
+        if (strcmp(name, replacement_policy_names[policy]) == 0) {
+            return policy;
+        }
     }
+    return -1;
 }
 
-// Function to initialize cache (all lines are invalid by default)
-void initialize_cache() {
-    int i,j;
-    for (i = 0; i < NUM_INDEXES; i++) {
-        for (j = 0; j < NUM_LINES_PER_INDEX; j++) {
-            cache[i].lines[j].tag = 0; // Initialize the tag to 0
-            cache[i].lines[j].metadata = initialize_cache_metadata(); // Initialize metadata
+static const char *insertion_policy_names[] = {"default", "mru", "lru", "bip"};
+
+// Insertion position named `name`, or -1
+int parse_insertion_policy(const char *name) {
+    int insertion;
+    for (insertion = INSERT_DEFAULT; insertion <= INSERT_BIP; insertion++) {
+        if (strcmp(name, insertion_policy_names[insertion]) == 0) {
+            return insertion;
         }
-        initialize_plru_tree(&cache[i]); // Initialize the PLRU tree
     }
+    return -1;
 }
 
-void invalidate_cache_line(CacheLine *line) {
-    line->tag = 0;                      // Clear the tag
-    line->metadata.valid = 0;           // Mark as invalid
-    line->metadata.dirty = 0;           // Clear the dirty bit
-    line->metadata.state = INVALID;     // Set the state to INVALID
+static int is_power_of_two(unsigned int n) {
+    return n != 0 && (n & (n - 1)) == 0;
 }
 
-// Function to update the PLRU tree after accessing a specific way (hit or insertion)
-void update_plru_tree(unsigned char pseudo_LRU[], int w) {
-    int depth = log2(NUM_LINES_PER_INDEX); // Depth of the PLRU tree
-    int index = 0;
-    int level,i;
+static unsigned int log2_exact(unsigned int n) {
+    return (unsigned int)__builtin_ctz(n);
+}
 
-    // Traverse the tree from the root to the leaf level
-    for (level = 0; level < depth; level++) {
-        // Determine the direction based on the way (w) and level
-        int direction = (w >> (depth - level - 1)) & 1;
-        
-        // Set the PLRU bit for this level
-        pseudo_LRU[index] = direction;
-        
-        // Move to the next level (left or right child)
-        index = 2 * index + 1 + direction;
-    }
-
-    // Print the updated PLRU bits to both console and output file
-    if (Mode == 1){        
-	    printf("Updated PLRu Bits:");
-	}
-    fprintf(output_file, "Updated PLRU bits: ");
-    
-    for (i = 0; i < NUM_LINES_PER_INDEX - 1; i++) {
-	if (Mode == 1){        
-	    printf("%d", pseudo_LRU[i]);
-	}
-        fprintf(output_file, "%d", pseudo_LRU[i]);
+// State of an empty way for the policies kept in repl_state: LRU ranks it
+// oldest and RRIP predicts a distant re-reference
+static inline uint8_t initial_repl_state(const Cache *c) {
+    return c->policy == POLICY_LRU ? (uint8_t)(c->num_ways - 1) : RRPV_MAX;
+}
+
+// Walk each way's path through the tree once so updates are a single mask-and-set
+static void initialize_plru_masks(Cache *c) {
+    unsigned int w, level;
+    for (w = 0; w < c->num_ways; w++) {
+        unsigned int node = 0;
+        c->plru_path_mask[w] = 0;
+        c->plru_path_bits[w] = 0;
+        for (level = 0; level < c->way_bits; level++) {
+            // Direction taken at this level is the way number's bit, MSB first
+            unsigned int direction = (w >> (c->way_bits - level - 1)) & 1;
+            c->plru_path_mask[w] |= (PlruTree)1 << node;
+            c->plru_path_bits[w] |= (PlruTree)direction << node;
+            node = 2 * node + 1 + direction;
+        }
+    }
+}
+
+// Function to initialize cache (all lines are invalid by default). Checks the
+// geometry, derives the address split and picks the lookup kernel.
+// Returns 0 on success, -1 after reporting an unusable geometry.
+int initialize_cache(Cache *c, unsigned int sets, unsigned int ways, unsigned int line_size,
+                     ReplacementPolicy policy) {
+    memset(c, 0, sizeof(*c));
+    c->bus_id = -1; // Not on a bus until initialize_bus() says so
+    c->policy = policy;
+    c->rng = 0x9E3779B9u; // Any nonzero seed; runs are repeatable
+    c->psel = DRRIP_PSEL_MAX / 2;
+
+    if (!is_power_of_two(sets) || !is_power_of_two(ways) || !is_power_of_two(line_size)) {
+        fprintf(stderr, "Error: sets, ways and linesize must be powers of two.\n");
+        return -1;
+    }
+    if (ways > MAX_LINES_PER_INDEX) {
+        fprintf(stderr, "Error: At most %d ways are supported.\n", MAX_LINES_PER_INDEX);
+        return -1;
+    }
+
+    c->num_sets = sets;
+    c->num_ways = ways;
+    c->line_size = line_size;
+    c->way_bits = log2_exact(ways);
+    c->offset_bits = log2_exact(line_size);
+    c->tag_shift = c->offset_bits + log2_exact(sets);
+    if (c->tag_shift >= 32) {
+        fprintf(stderr, "Error: sets * linesize must be below 4 GB (32-bit addresses).\n");
+        return -1;
+    }
+    if (32 - c->tag_shift > LINE_TAG_BITS) {
+        fprintf(stderr, "Error: This geometry needs %u-bit tags but cache lines hold %d; "
+                        "use more sets or larger lines.\n", 32 - c->tag_shift, LINE_TAG_BITS);
+        return -1;
     }
-    if (Mode==1){
-       printf("\n");
+    // 16-bit lines when the tags fit, which halves what a lookup reads
+    c->wide_lines = (32 - c->tag_shift > NARROW_TAG_BITS);
+    c->offset_mask = line_size - 1;
+    c->index_mask = sets - 1;
+    c->tag_mask = 0xFFFFFFFFu >> c->tag_shift;
+
+    switch (ways) {
+        case 4: c->kernel = KERNEL_4WAY; break;
+        case 8: c->kernel = KERNEL_8WAY; break;
+        case 16: c->kernel = KERNEL_16WAY; break;
+        case 32: c->kernel = KERNEL_32WAY; break;
+        default: c->kernel = KERNEL_GENERIC; break;
+    }
+
+    // Tag 0, clean, invalid lines and empty PLRU trees
+    c->lines = calloc((size_t)sets * ways, c->wide_lines ? sizeof(CacheLine) : sizeof(NarrowLine));
+    c->pseudo_LRU = calloc(sets, sizeof(PlruTree));
+    c->set_epoch = calloc(sets, sizeof(uint32_t));              // Every set current in epoch 0
+    c->occupied_sets = calloc((sets + 63) / 64, sizeof(uint64_t));
+    c->dirty_sets = calloc((sets + 63) / 64, sizeof(uint64_t));
+    c->dirty_ways = calloc(sets, sizeof(WayMask));
+    if (policy != POLICY_PLRU) {
+        c->repl_state = malloc((size_t)sets * ways);
     }
-    fprintf(output_file,"\n");
+    if (!c->lines || !c->pseudo_LRU || !c->set_epoch || !c->occupied_sets || !c->dirty_sets || !c->dirty_ways ||
+        (policy != POLICY_PLRU && !c->repl_state)) {
+        fprintf(stderr, "Error: Out of memory allocating a %u x %u cache.\n", sets, ways);
+        free_cache(c);
+        return -1;
+    }
+    if (c->repl_state) {
+        memset(c->repl_state, initial_repl_state(c), (size_t)sets * ways);
+    }
+    initialize_plru_masks(c);
+    return 0;
 }
 
+// Turn on the reuse predictor: read misses it predicts dead are not allocated,
+// and write misses predicted dead are inserted next in line for eviction.
+// Returns 0 on success.
+int initialize_reuse_predictor(Cache *c, ReuseSignature signature) {
+    c->reuse_signature = signature;
+    c->reuse_counters = calloc((size_t)1 << REUSE_SIGNATURE_BITS, sizeof(uint8_t));
+    c->line_reuse = calloc((size_t)c->num_sets * c->num_ways, sizeof(uint16_t));
+    c->bypass_history = calloc(BYPASS_HISTORY_ENTRIES, sizeof(uint32_t));
+    if (!c->reuse_counters || !c->line_reuse || !c->bypass_history) {
+        fprintf(stderr, "Error: Out of memory allocating the reuse predictor.\n");
+        return -1;
+    }
+    return 0;
+}
 
+void free_cache(Cache *c) {
+    free(c->lines);
+    free(c->pseudo_LRU);
+    free(c->repl_state);
+    free(c->reuse_counters);
+    free(c->line_reuse);
+    free(c->bypass_history);
+    free(c->prefetcher);
+    free(c->prefetched_ways);
+    free(c->prefetch_issued);
+    free(c->prefetch_victims);
+    free_miss_classifier(c);
+    free(c->set_epoch);
+    free(c->occupied_sets);
+    free(c->dirty_sets);
+    free(c->dirty_ways);
+    c->lines = NULL;
+    c->pseudo_LRU = NULL;
+    c->repl_state = NULL;
+    c->reuse_counters = NULL;
+    c->line_reuse = NULL;
+    c->bypass_history = NULL;
+    c->prefetcher = NULL;
+    c->prefetched_ways = NULL;
+    c->prefetch_issued = NULL;
+    c->prefetch_victims = NULL;
+    c->set_epoch = NULL;
+    c->occupied_sets = NULL;
+    c->dirty_sets = NULL;
+    c->dirty_ways = NULL;
+}
 
+// Put `count` caches on the snooping bus: `cache`, which must already be
+// initialized, and count - 1 peers with its geometry. With a single cache there
+// is nobody to answer snoops and snoop results stay simulated from the address.
+// Returns 0 on success.
+int initialize_bus(int count) {
+    int i;
 
-// Function to find the way to evict using the PLRU tree
-int find_eviction_way(unsigned char PLRU[]) {
-    int depth = log2(NUM_LINES_PER_INDEX);  // Depth of the PLRU tree
-    int index = 0;
-    int level;
+    num_caches = 1;
+    if (count == 1) {
+        return 0;
+    }
+    peer_caches = calloc((size_t)count - 1, sizeof(Cache));
+    if (!peer_caches) {
+        fprintf(stderr, "Error: Out of memory allocating %d caches.\n", count);
+        return -1;
+    }
+    for (i = 1; i < count; i++) {
+        Cache *peer = &peer_caches[i - 1];
+        if (initialize_cache(peer, cache.num_sets, cache.num_ways, cache.line_size, cache.policy) != 0) {
+            free_bus();
+            return -1;
+        }
+        peer->insertion = cache.insertion;
+        if ((cache.reuse_counters && initialize_reuse_predictor(peer, cache.reuse_signature) != 0) ||
+            (cache.prefetcher && initialize_prefetcher(peer, cache.prefetch_kind, cache.prefetch_degree) != 0) ||
+            (cache.miss_classifier && initialize_miss_classifier(peer) != 0)) {
+            free_cache(peer);
+            free_bus();
+            return -1;
+        }
+        bus_caches[i] = peer;
+        num_caches++;
+    }
+    for (i = 0; i < count; i++) {
+        bus_caches[i]->bus_id = i;
+    }
+    return 0;
+}
+
+// Free the peers; `cache` itself is left to free_cache()
+void free_bus() {
+    int i;
+    for (i = 1; i < num_caches; i++) {
+        free_cache(bus_caches[i]);
+        bus_caches[i] = NULL;
+    }
+    free(peer_caches);
+    peer_caches = NULL;
+    num_caches = 1;
+    cache.bus_id = -1;
+}
+
+void add_cache_stats(CacheStats *total, const CacheStats *stats) {
+    int i;
+
+    total->num_cache_reads += stats->num_cache_reads;
+    total->num_cache_writes += stats->num_cache_writes;
+    total->num_cache_hits += stats->num_cache_hits;
+    total->num_cache_misses += stats->num_cache_misses;
+    total->num_bus_reads += stats->num_bus_reads;
+    total->num_bus_writes += stats->num_bus_writes;
+    total->num_bus_invalidates += stats->num_bus_invalidates;
+    total->num_bus_rwims += stats->num_bus_rwims;
+    total->num_snoop_hits += stats->num_snoop_hits;
+    total->num_snoop_hitms += stats->num_snoop_hitms;
+    total->num_bypasses += stats->num_bypasses;
+    total->num_bypass_rereferences += stats->num_bypass_rereferences;
+    total->num_reuse_correct += stats->num_reuse_correct;
+    total->num_reuse_wrong += stats->num_reuse_wrong;
+    total->num_reuse_no_pc += stats->num_reuse_no_pc;
+    total->num_prefetches += stats->num_prefetches;
+    total->num_prefetch_hits += stats->num_prefetch_hits;
+    total->num_prefetch_useful += stats->num_prefetch_useful;
+    total->num_prefetch_late += stats->num_prefetch_late;
+    total->num_prefetch_unused += stats->num_prefetch_unused;
+    total->num_prefetch_polluting += stats->num_prefetch_polluting;
+    for (i = 0; i < MISS_CLASSES; i++) {
+        total->num_class_misses[i] += stats->num_class_misses[i];
+    }
+}
+
+#if !defined(LLC_SCALAR_LOOKUP) && defined(__SSE2__)
+// Compare 16 ways starting at `lines` (CacheLines if `wide`, else NarrowLines).
+// Each result byte is 0xFF or 0: *hits for a valid line holding `tag`,
+// *invalid for a way with no line.
+KERNEL_INLINE void compare_16_ways(const void *lines, int wide, unsigned int tag, __m128i *hits, __m128i *invalid) {
+    __m128i match;
+    if (wide) {
+        const __m128i key = _mm_set1_epi32((int)tag);
+        const __m128i tag_mask = _mm_set1_epi32((int)LINE_TAG_MASK);
+        const __m128i state_mask = _mm_set1_epi32((int)LINE_STATE_MASK);
+        __m128i eq[4], none[4];
+        int q;
+        for (q = 0; q < 4; q++) {
+            __m128i v = _mm_loadu_si128((const __m128i *)lines + q);
+            eq[q] = _mm_cmpeq_epi32(_mm_and_si128(v, tag_mask), key);
+            none[q] = _mm_cmpeq_epi32(_mm_and_si128(v, state_mask), _mm_setzero_si128());
+        }
+        match = _mm_packs_epi16(_mm_packs_epi32(eq[0], eq[1]), _mm_packs_epi32(eq[2], eq[3]));
+        *invalid = _mm_packs_epi16(_mm_packs_epi32(none[0], none[1]), _mm_packs_epi32(none[2], none[3]));
+    } else {
+#if defined(__AVX2__)
+        __m256i v = _mm256_loadu_si256((const __m256i *)lines);
+        __m256i eq = _mm256_cmpeq_epi16(_mm256_and_si256(v, _mm256_set1_epi16((short)NARROW_TAG_MASK)),
+                                        _mm256_set1_epi16((short)tag));
+        __m256i none = _mm256_cmpeq_epi16(_mm256_and_si256(v, _mm256_set1_epi16((short)NARROW_STATE_MASK)),
+                                          _mm256_setzero_si256());
+        // Narrow 16 lanes of 16 bits to 16 bytes
+        match = _mm_packs_epi16(_mm256_castsi256_si128(eq), _mm256_extracti128_si256(eq, 1));
+        *invalid = _mm_packs_epi16(_mm256_castsi256_si128(none), _mm256_extracti128_si256(none, 1));
+#else
+        const __m128i key = _mm_set1_epi16((short)tag);
+        const __m128i tag_mask = _mm_set1_epi16((short)NARROW_TAG_MASK);
+        const __m128i state_mask = _mm_set1_epi16((short)NARROW_STATE_MASK);
+        __m128i lo = _mm_loadu_si128((const __m128i *)lines);
+        __m128i hi = _mm_loadu_si128((const __m128i *)lines + 1);
+        match = _mm_packs_epi16(_mm_cmpeq_epi16(_mm_and_si128(lo, tag_mask), key),
+                                _mm_cmpeq_epi16(_mm_and_si128(hi, tag_mask), key));
+        *invalid = _mm_packs_epi16(_mm_cmpeq_epi16(_mm_and_si128(lo, state_mask), _mm_setzero_si128()),
+                                   _mm_cmpeq_epi16(_mm_and_si128(hi, state_mask), _mm_setzero_si128()));
+#endif
+    }
+    *hits = _mm_andnot_si128(*invalid, match);
+}
+
+// Same for a 4- or 8-way set; only the low `ways` result bytes are meaningful
+KERNEL_INLINE void compare_8_ways(const void *lines, int wide, int ways, unsigned int tag,
+                                  __m128i *hits, __m128i *invalid) {
+    __m128i match, none;
+    if (wide) {
+        const __m128i key = _mm_set1_epi32((int)tag);
+        const __m128i tag_mask = _mm_set1_epi32((int)LINE_TAG_MASK);
+        const __m128i state_mask = _mm_set1_epi32((int)LINE_STATE_MASK);
+        __m128i lo = _mm_loadu_si128((const __m128i *)lines);
+        __m128i hi = (ways == 8) ? _mm_loadu_si128((const __m128i *)lines + 1) : _mm_setzero_si128();
+        match = _mm_packs_epi32(_mm_cmpeq_epi32(_mm_and_si128(lo, tag_mask), key),
+                                _mm_cmpeq_epi32(_mm_and_si128(hi, tag_mask), key));
+        none = _mm_packs_epi32(_mm_cmpeq_epi32(_mm_and_si128(lo, state_mask), _mm_setzero_si128()),
+                               _mm_cmpeq_epi32(_mm_and_si128(hi, state_mask), _mm_setzero_si128()));
+    } else {
+        const __m128i key = _mm_set1_epi16((short)tag);
+        __m128i v = (ways == 8) ? _mm_loadu_si128((const __m128i *)lines)
+                                : _mm_loadl_epi64((const __m128i *)lines);
+        match = _mm_cmpeq_epi16(_mm_and_si128(v, _mm_set1_epi16((short)NARROW_TAG_MASK)), key);
+        none = _mm_cmpeq_epi16(_mm_and_si128(v, _mm_set1_epi16((short)NARROW_STATE_MASK)),
+                               _mm_setzero_si128());
+    }
+    *invalid = _mm_packs_epi16(none, _mm_setzero_si128());
+    *hits = _mm_andnot_si128(*invalid, _mm_packs_epi16(match, _mm_setzero_si128()));
+}
+#endif
+
+// Look `tag` up in a set of `ways` lines. Returns the hit way or -1 on a miss,
+// and stores the first invalid way (-1 if the set is full) in *empty_way.
+// The SIMD versions compare up to 16 ways per step and movemask the result
+// down to one bit per way; define LLC_SCALAR_LOOKUP to build the portable loop.
+KERNEL_INLINE int find_way_in(const void *lines, int wide, int ways, unsigned int tag, int *empty_way) {
+    WayMask hits = 0;
+    WayMask empty = 0;
+    int w;
+
+#if !defined(LLC_SCALAR_LOOKUP) && defined(__SSE2__)
+    if (ways % 16 == 0) {
+        for (w = 0; w < ways; w += 16) {
+            __m128i hit_bytes, invalid_bytes;
+            compare_16_ways(wide ? (const void *)((const CacheLine *)lines + w) : (const void *)((const NarrowLine *)lines + w),
+                            wide, tag, &hit_bytes, &invalid_bytes);
+            hits |= (WayMask)(unsigned int)_mm_movemask_epi8(hit_bytes) << w;
+            empty |= (WayMask)(unsigned int)_mm_movemask_epi8(invalid_bytes) << w;
+        }
+    } else if (ways == 8 || ways == 4) {
+        __m128i hit_bytes, invalid_bytes;
+        WayMask valid_lanes = WAY_BIT(ways) - 1;
+        compare_8_ways(lines, wide, ways, tag, &hit_bytes, &invalid_bytes);
+        hits = (WayMask)(unsigned int)_mm_movemask_epi8(hit_bytes) & valid_lanes;
+        empty = (WayMask)(unsigned int)_mm_movemask_epi8(invalid_bytes) & valid_lanes;
+    } else
+#endif
+    {
+        for (w = 0; w < ways; w++) {
+            CacheLine line = wide ? ((const CacheLine *)lines)[w] : WIDE_LINE(((const NarrowLine *)lines)[w]);
+            hits |= (WayMask)(LINE_IS_VALID(line) && LINE_TAG(line) == tag) << w;
+            empty |= (WayMask)!LINE_IS_VALID(line) << w;
+        }
+    }
+
+    *empty_way = empty ? __builtin_ctz(empty) : -1;
+    return hits ? __builtin_ctz(hits) : -1;
+}
+
+// Bytes per stored line
+static inline size_t line_bytes(const Cache *c) {
+    return c->wide_lines ? sizeof(CacheLine) : sizeof(NarrowLine);
+}
+
+// Lines of set `index`, CacheLines or NarrowLines
+static inline void *set_lines(const Cache *c, unsigned int index) {
+    return (char *)c->lines + (((size_t)index << c->way_bits) * line_bytes(c));
+}
+
+static inline CacheLine load_line(const Cache *c, unsigned int index, int way) {
+    size_t i = ((size_t)index << c->way_bits) + (unsigned int)way;
+    return c->wide_lines ? ((const CacheLine *)c->lines)[i] : WIDE_LINE(((const NarrowLine *)c->lines)[i]);
+}
+
+// Overwrite a line without touching the occupancy and dirty summaries
+static inline void put_line(Cache *c, unsigned int index, int way, CacheLine line) {
+    size_t i = ((size_t)index << c->way_bits) + (unsigned int)way;
+    if (c->wide_lines) {
+        ((CacheLine *)c->lines)[i] = line;
+    } else {
+        ((NarrowLine *)c->lines)[i] = NARROW_LINE(line);
+    }
+}
+
+// Shared lookup used by every handler, on set `index`. The switches select the
+// kernel and line width chosen at startup, where the way count and width are
+// constants and the loops above unroll.
+static inline int find_way(const Cache *c, unsigned int index, unsigned int tag, int *empty_way) {
+    const void *lines = set_lines(c, index);
+    if (c->wide_lines) {
+        switch (c->kernel) {
+            case KERNEL_4WAY: return find_way_in(lines, 1, 4, tag, empty_way);
+            case KERNEL_8WAY: return find_way_in(lines, 1, 8, tag, empty_way);
+            case KERNEL_16WAY: return find_way_in(lines, 1, 16, tag, empty_way);
+            case KERNEL_32WAY: return find_way_in(lines, 1, 32, tag, empty_way);
+            default: return find_way_in(lines, 1, (int)c->num_ways, tag, empty_way);
+        }
+    }
+    switch (c->kernel) {
+        case KERNEL_4WAY: return find_way_in(lines, 0, 4, tag, empty_way);
+        case KERNEL_8WAY: return find_way_in(lines, 0, 8, tag, empty_way);
+        case KERNEL_16WAY: return find_way_in(lines, 0, 16, tag, empty_way);
+        case KERNEL_32WAY: return find_way_in(lines, 0, 32, tag, empty_way);
+        default: return find_way_in(lines, 0, (int)c->num_ways, tag, empty_way);
+    }
+}
+
+// Empty a set left over from before the last clear. Every handler calls this
+// before it looks at a set; an invalid, clean line with tag 0 is all zeroes.
+static inline void refresh_set(Cache *c, unsigned int index) {
+    if (c->set_epoch[index] != c->epoch) {
+        memset(set_lines(c, index), 0, c->num_ways * line_bytes(c));
+        c->pseudo_LRU[index] = 0;
+        if (c->repl_state) {
+            memset(&c->repl_state[(size_t)index << c->way_bits], initial_repl_state(c), c->num_ways);
+        }
+        if (c->prefetched_ways) {
+            c->prefetched_ways[index] = 0; // Cleared away, neither used nor evicted
+        }
+        c->set_epoch[index] = c->epoch;
+    }
+}
+
+static inline void set_bitmap_bit(uint64_t *bitmap, unsigned int i) {
+    bitmap[i >> 6] |= (uint64_t)1 << (i & 63);
+}
+
+static inline void clear_bitmap_bit(uint64_t *bitmap, unsigned int i) {
+    bitmap[i >> 6] &= ~((uint64_t)1 << (i & 63));
+}
+
+// Store a valid line in `way` and keep the occupancy and dirty summaries in step.
+// Overwriting a victim this way also drops its dirty bit.
+static inline void store_line(Cache *c, unsigned int index, int way, CacheLine line) {
+    put_line(c, index, way, line);
+    set_bitmap_bit(c->occupied_sets, index);
+    if (LINE_IS_DIRTY(line)) {
+        c->dirty_ways[index] |= WAY_BIT(way);
+        set_bitmap_bit(c->dirty_sets, index);
+    } else if (c->dirty_ways[index] & WAY_BIT(way)) {
+        c->dirty_ways[index] &= ~WAY_BIT(way);
+        if (!c->dirty_ways[index]) {
+            clear_bitmap_bit(c->dirty_sets, index);
+        }
+    }
+}
+
+// Start an event of cache `c`. With several caches on the bus every event
+// says which one logged it.
+static LogEvent cache_event(const Cache *c, int type) {
+    LogEvent ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.type = type;
+    ev.way = -1;
+    if (c->bus_id >= 0) {
+        ev.flags = LOG_CACHE_ID;
+        ev.cache_id = (uint16_t)c->bus_id;
+    }
+    return ev;
+}
+
+// Build an event describing `entry`; callers fill in the event-specific fields
+static LogEvent entry_event(const Cache *c, int type, const TraceEntry *entry) {
+    LogEvent ev = cache_event(c, type);
+    ev.operation = (uint8_t)entry->operation_code;
+    ev.address = entry->address;
+    ev.set = entry->parsed_addr.index;
+    ev.tag = entry->parsed_addr.tag;
+    ev.aux = entry->parsed_addr.byte_offset;
+    return ev;
+}
+
+static void log_access_event(const Cache *c, int type, const TraceEntry *entry, MESIState old_state, MESIState new_state) {
+    if (!LOG_ENABLED(LOG_TRANSACTIONS)) {
+        return;
+    }
+    LogEvent ev = entry_event(c, type, entry);
+    ev.old_state = old_state;
+    ev.new_state = new_state;
+    log_event(&ev);
+}
+
+// Log what a snooped request did to the line in `way` (-1 if the line was not present).
+// `shown_state` is the state the log reports in the line's metadata.
+static void log_snoop_outcome(const Cache *c, const TraceEntry *entry, int way,
+                              MESIState old_state, MESIState shown_state) {
+    if (!LOG_ENABLED(LOG_TRANSACTIONS)) {
+        return;
+    }
+    LogEvent ev = entry_event(c, EV_SNOOP_OUTCOME, entry);
+    ev.way = (int8_t)way;
+    ev.old_state = old_state;
+    ev.new_state = shown_state;
+    if (way >= 0 && LOG_ENABLED(LOG_FULL)) {
+        unsigned int index = entry->parsed_addr.index;
+        CacheLine line = load_line(c, index, way);
+        ev.flags |= LOG_METADATA | (LINE_IS_VALID(line) ? LOG_VALID : 0) | (LINE_IS_DIRTY(line) ? LOG_DIRTY : 0);
+        ev.plru = c->pseudo_LRU[index];
+    }
+    log_event(&ev);
+}
+
+// Log the PLRU bits after an update for way `w`
+static void log_plru_update(const Cache *c, PlruTree PLRU, int w) {
+    if (LOG_ENABLED(LOG_FULL)) {
+        LogEvent ev = cache_event(c, EV_PLRU_UPDATE);
+        ev.way = (int8_t)w;
+        ev.plru = PLRU;
+        ev.aux = c->num_ways; // Number of tree bits to print is num_ways - 1
+        log_event(&ev);
+    }
+}
+
+// Function to update the PLRU tree after accessing a specific way (hit or insertion).
+// Every node on the way's path points towards it; the rest of the tree is untouched.
+void update_plru_tree(const Cache *c, PlruTree *pseudo_LRU, int w) {
+    *pseudo_LRU = (*pseudo_LRU & ~c->plru_path_mask[w]) | c->plru_path_bits[w];
+    log_plru_update(c, *pseudo_LRU, w);
+}
+
+// LRU insertion into the tree: every node on the way's path points away from
+// it, so the way is the next victim unless it is hit first
+static void demote_plru_way(const Cache *c, PlruTree *pseudo_LRU, int w) {
+    *pseudo_LRU = (*pseudo_LRU & ~c->plru_path_mask[w]) | (~c->plru_path_bits[w] & c->plru_path_mask[w]);
+    log_plru_update(c, *pseudo_LRU, w);
+}
 
-    // Traverse the tree from the root to the leaf level
-    for (level = 0; level < depth; level++) {
-        // Determine the direction based on the PLRU bit
-        int direction = !(PLRU[index]);
 
-        // Move to the next level (left or right child)
-        index = 2 * index + 1 + direction;
+
+
+// Victim for a tree of `depth` levels: each level follows the inverted node bit
+KERNEL_INLINE int plru_victim(PlruTree PLRU, unsigned int depth) {
+    unsigned int index = 0;
+    unsigned int level;
+
+    for (level = 0; level < depth; level++) {
+        index = 2 * index + 1 + ((~PLRU >> index) & 1);
     }
 
     // Return the victim index
-    return index - (NUM_LINES_PER_INDEX -1);
+    return (int)(index - ((1u << depth) - 1));
+}
+
+// Function to find the way to evict using the PLRU tree. In the fixed-way
+// kernels the depth is a constant, so the walk unrolls into a few
+// shift/and/add steps with no branches.
+int find_eviction_way(const Cache *c, PlruTree PLRU) {
+    switch (c->kernel) {
+        case KERNEL_4WAY: return plru_victim(PLRU, 2);
+        case KERNEL_8WAY: return plru_victim(PLRU, 3);
+        case KERNEL_16WAY: return plru_victim(PLRU, 4);
+        case KERNEL_32WAY: return plru_victim(PLRU, 5);
+        default: return plru_victim(PLRU, c->way_bits);
+    }
+}
+
+// Ages or RRPVs of the ways of set `index`
+static inline uint8_t *set_repl_state(const Cache *c, unsigned int index) {
+    return &c->repl_state[(size_t)index << c->way_bits];
+}
+
+// xorshift32: cheap and repeatable from run to run
+static inline uint32_t next_random(Cache *c) {
+    uint32_t x = c->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    c->rng = x;
+    return x;
+}
+
+// True LRU: every way has an age, 0 for the most recently used. Touching a way
+// makes it the youngest and ages the ways that were younger than it.
+static inline void lru_touch(Cache *c, unsigned int index, int way) {
+    uint8_t *age = set_repl_state(c, index);
+    uint8_t old = age[way];
+    unsigned int w;
+
+    for (w = 0; w < c->num_ways; w++) {
+        age[w] += age[w] < old;
+    }
+    age[way] = 0;
+}
+
+// An invalidated way becomes the oldest; the older ways move up one
+static inline void lru_demote(Cache *c, unsigned int index, int way) {
+    uint8_t *age = set_repl_state(c, index);
+    uint8_t old = age[way];
+    unsigned int w;
+
+    for (w = 0; w < c->num_ways; w++) {
+        age[w] -= age[w] > old;
+    }
+    age[way] = (uint8_t)(c->num_ways - 1);
+}
+
+static inline int lru_victim(const Cache *c, unsigned int index) {
+    const uint8_t *age = set_repl_state(c, index);
+    int victim = 0;
+    unsigned int w;
+
+    for (w = 1; w < c->num_ways; w++) {
+        if (age[w] > age[victim]) {
+            victim = (int)w;
+        }
+    }
+    return victim;
+}
+
+// RRIP victim: the first way predicted for a distant re-reference. If there is
+// none, the whole set ages until one is, in a single step.
+static inline int rrip_victim(Cache *c, unsigned int index) {
+    uint8_t *rrpv = set_repl_state(c, index);
+    int victim = 0;
+    unsigned int w;
+
+    for (w = 1; w < c->num_ways; w++) {
+        if (rrpv[w] > rrpv[victim]) {
+            victim = (int)w;
+        }
+    }
+    if (rrpv[victim] < RRPV_MAX) {
+        uint8_t step = (uint8_t)(RRPV_MAX - rrpv[victim]);
+        for (w = 0; w < c->num_ways; w++) {
+            rrpv[w] += step;
+        }
+    }
+    return victim;
+}
+
+// DRRIP set dueling: where the low five bits of the set index equal the next
+// five, the set always inserts like SRRIP; where they are their complement,
+// like bimodal RRIP. Every miss in a leader set moves the selector away from
+// that leader's policy, and the other sets follow the one missing less.
+static inline uint8_t drrip_insertion(Cache *c, unsigned int index) {
+    unsigned int low = index & 31, high = (index >> 5) & 31;
+    int bimodal;
+
+    if (low == high) {
+        bimodal = 0;
+        c->psel += c->psel < DRRIP_PSEL_MAX;
+    } else if (low == (~high & 31)) {
+        bimodal = 1;
+        c->psel -= c->psel > 0;
+    } else {
+        bimodal = c->psel > DRRIP_PSEL_MAX / 2;
+    }
+    if (bimodal && next_random(c) % BRRIP_LONG_ODDS != 0) {
+        return RRPV_MAX;
+    }
+    return RRPV_MAX - 1;
+}
+
+// Replacement hooks. Like find_way() with the lookup kernel, each switches on
+// the policy picked at startup, so the handlers make no indirect calls and the
+// branch always goes the same way.
+
+// Reuse predictor signature of an access: its pc, or the region it touches
+static inline unsigned int reuse_signature(const Cache *c, const TraceEntry *entry) {
+    unsigned int key = (c->reuse_signature == REUSE_PC && entry->pc) ? entry->pc
+                                                                    : entry->address >> REUSE_REGION_BITS;
+    return (key * 0x9E3779B1u) >> (32 - REUSE_SIGNATURE_BITS);
+}
+
+static inline uint16_t *line_reuse(const Cache *c, unsigned int index, int way) {
+    return &c->line_reuse[((size_t)index << c->way_bits) + (unsigned int)way];
+}
+
+// A miss with the reuse predictor on. Missing again on a line bypassed not long
+// ago shows the bypass was wrong, and trains its signature towards reuse.
+// Returns 1 if the line is predicted dead on arrival.
+static int reuse_miss(Cache *c, const TraceEntry *entry) {
+    unsigned int line = entry->address >> c->offset_bits;
+    uint32_t *history = &c->bypass_history[line & (BYPASS_HISTORY_ENTRIES - 1)];
+    uint8_t *counter = &c->reuse_counters[reuse_signature(c, entry)];
+
+    c->stats.num_reuse_no_pc += (c->reuse_signature == REUSE_PC && !entry->pc);
+    if (*history == line + 1) {
+        c->stats.num_bypass_rereferences++;
+        c->stats.num_reuse_wrong++;
+        *counter -= *counter > 0;
+        *history = 0;
+    }
+    return *counter >= REUSE_COUNTER_DEAD;
+}
+
+// A read miss was served without allocating. The bypass it displaces from the
+// history was never missed on again, so that prediction was right.
+static void record_bypass(Cache *c, const TraceEntry *entry) {
+    unsigned int line = entry->address >> c->offset_bits;
+    uint32_t *history = &c->bypass_history[line & (BYPASS_HISTORY_ENTRIES - 1)];
+
+    if (*history != 0) {
+        c->stats.num_reuse_correct++;
+    }
+    *history = line + 1;
+    c->stats.num_bypasses++;
+}
+
+// The first hit on a line settles its prediction and trains its signature towards reuse
+static inline void reuse_hit(Cache *c, unsigned int index, int way) {
+    uint16_t *meta = line_reuse(c, index, way);
+
+    if (!(*meta & LINE_REUSED)) {
+        uint8_t *counter = &c->reuse_counters[*meta & ((1u << REUSE_SIGNATURE_BITS) - 1)];
+        *counter -= *counter > 0;
+        if (*meta & LINE_PREDICTED_DEAD) {
+            c->stats.num_reuse_wrong++;
+        } else {
+            c->stats.num_reuse_correct++;
+        }
+        *meta |= LINE_REUSED;
+    }
+}
+
+// A line evicted without ever being hit was dead: train its signature towards that
+static inline void reuse_evict(Cache *c, unsigned int index, int way) {
+    uint16_t meta = *line_reuse(c, index, way);
+
+    if (!(meta & LINE_REUSED)) {
+        uint8_t *counter = &c->reuse_counters[meta & ((1u << REUSE_SIGNATURE_BITS) - 1)];
+        *counter += *counter < REUSE_COUNTER_DEAD;
+        if (meta & LINE_PREDICTED_DEAD) {
+            c->stats.num_reuse_correct++;
+        } else {
+            c->stats.num_reuse_wrong++;
+        }
+    }
+}
+
+// `way` of set `index` was hit
+static inline void replacement_hit(Cache *c, unsigned int index, int way) {
+    if (c->reuse_counters) {
+        reuse_hit(c, index, way);
+    }
+    switch (c->policy) {
+        case POLICY_PLRU: update_plru_tree(c, &c->pseudo_LRU[index], way); break;
+        case POLICY_LRU: lru_touch(c, index, way); break;
+        case POLICY_SRRIP:
+        case POLICY_DRRIP: set_repl_state(c, index)[way] = 0; break;
+        case POLICY_RANDOM: break;
+    }
+}
+
+// The line `entry` missed on was filled into `way` of set `index`. `dead` is
+// the reuse predictor's verdict on the miss, taken before the victim was chosen.
+static inline void replacement_fill(Cache *c, unsigned int index, int way, const TraceEntry *entry, int dead) {
+    InsertionPolicy insertion = c->insertion;
+
+    if (c->reuse_counters) {
+        // Only reads can bypass; a write predicted dead goes in next in line for eviction
+        *line_reuse(c, index, way) = (uint16_t)(reuse_signature(c, entry) | (dead ? LINE_PREDICTED_DEAD : 0));
+        if (dead) {
+            insertion = INSERT_LRU;
+        }
+    }
+    if (insertion == INSERT_BIP) {
+        insertion = next_random(c) % BIP_MRU_ODDS == 0 ? INSERT_MRU : INSERT_LRU;
+    }
+
+    switch (c->policy) {
+        case POLICY_PLRU:
+            if (insertion == INSERT_LRU) {
+                demote_plru_way(c, &c->pseudo_LRU[index], way);
+            } else {
+                update_plru_tree(c, &c->pseudo_LRU[index], way);
+            }
+            break;
+        case POLICY_LRU:
+            if (insertion == INSERT_LRU) {
+                lru_demote(c, index, way);
+            } else {
+                lru_touch(c, index, way);
+            }
+            break;
+        case POLICY_SRRIP:
+        case POLICY_DRRIP:
+            set_repl_state(c, index)[way] =
+                insertion == INSERT_MRU ? 0 :
+                insertion == INSERT_LRU ? RRPV_MAX :
+                c->policy == POLICY_DRRIP ? drrip_insertion(c, index) : RRPV_MAX - 1;
+            break;
+        case POLICY_RANDOM:
+            break;
+    }
+}
+
+// Way to evict from the full set `index`
+static inline int replacement_victim(Cache *c, unsigned int index) {
+    int victim;
+
+    switch (c->policy) {
+        case POLICY_LRU: victim = lru_victim(c, index); break;
+        case POLICY_SRRIP:
+        case POLICY_DRRIP: victim = rrip_victim(c, index); break;
+        case POLICY_RANDOM: victim = (int)(next_random(c) & (c->num_ways - 1)); break;
+        default: victim = find_eviction_way(c, c->pseudo_LRU[index]); break;
+    }
+    if (c->reuse_counters) {
+        reuse_evict(c, index, victim);
+    }
+    return victim;
 }
 
+// `way` of set `index` was invalidated. The tree PLRU has always been left alone.
+static inline void replacement_invalidate(Cache *c, unsigned int index, int way) {
+    switch (c->policy) {
+        case POLICY_LRU: lru_demote(c, index, way); break;
+        case POLICY_SRRIP:
+        case POLICY_DRRIP: set_repl_state(c, index)[way] = RRPV_MAX; break;
+        default: break;
+    }
+}
+
+void invalidate_cache_line(Cache *c, unsigned int index, int way) {
+    unsigned int w;
+
+    // A recalled line stays in the classifier's shadow cache, whose capacity
+    // and conflict verdicts then cover its next miss
+    if (c->miss_classifier && !recalling) {
+        classifier_invalidate(c, line_address(c, LINE_TAG(load_line(c, index, way)), index));
+    }
+    put_line(c, index, way, MAKE_LINE(0, INVALID, 0)); // Clear the tag and dirty bit, mark INVALID
+    replacement_invalidate(c, index, way);
+    if (c->prefetched_ways && (c->prefetched_ways[index] & WAY_BIT(way))) {
+        c->prefetched_ways[index] &= ~WAY_BIT(way);
+        c->stats.num_prefetch_unused++;
+    }
+    c->dirty_ways[index] &= ~WAY_BIT(way);
+    if (!c->dirty_ways[index]) {
+        clear_bitmap_bit(c->dirty_sets, index);
+    }
+
+    // Drop the set from the occupancy bitmap once its last line is gone
+    for (w = 0; w < c->num_ways; w++) {
+        if (LINE_IS_VALID(load_line(c, index, (int)w))) {
+            return;
+        }
+    }
+    clear_bitmap_bit(c->occupied_sets, index);
+}
+
+
 
 // Simulate the reporting of snoop results by other caches
 int GetSnoopResult(unsigned int Address) {
@@ -134,152 +927,321 @@ int GetSnoopResult(unsigned int Address) {
     return NOHIT; // Default to NOHIT
 }
 
-void BusOperation(int BusOp, unsigned int Address, int *SnoopResult) {
-    // Simulate snoop result
-    *SnoopResult = GetSnoopResult(Address);
+// Snoop result a cache answers for a line it holds in `state`
+static inline int snoop_answer(MESIState state) {
+    switch (state) {
+        case MODIFIED: return HITM;
+        case EXCLUSIVE:
+        case SHARED: return HIT;
+        default: return NOHIT;
+    }
+}
 
-    if (Mode == 1) { // Only print in normal mode
-        printf("Bus Communication:\n");
-        printf("  Operation: %s\n", 
-               (BusOp == READ) ? "READ" :
-               (BusOp == WRITE) ? "WRITE" :
-               (BusOp == INVALIDATE) ? "INVALIDATE" :
-               (BusOp == RWIM) ? "RWIM" : "UNKNOWN");
-        printf("  Address: 0x%08X\n", Address);
+// Snoop a bus request in cache `c` through its snooped-request handler and
+// return its answer. Write-backs are not snooped: no other cache can hold a
+// line one cache has modified.
+int snoop_cache(Cache *c, int BusOp, unsigned int Address) {
+    TraceEntry snoop;
+
+    memset(&snoop, 0, sizeof(snoop));
+    snoop.address = Address;
+    snoop.parsed_addr = decompose_cache_address(c, Address);
+    snoop.cpu = (unsigned int)c->bus_id;
+    switch (BusOp) {
+        case READ:
+            snoop.operation_code = 3;
+            return handle_snooped_read_request(c, &snoop);
+        case RWIM:
+            snoop.operation_code = 5;
+            return handle_snooped_rwim_request(c, &snoop);
+        case INVALIDATE:
+            snoop.operation_code = 6;
+            return handle_snooped_invalidate_command(c, &snoop);
+        default:
+            return NOHIT;
     }
+}
 
-    // Log the bus communication to the output file
-    if (output_file) {
-        fprintf(output_file, "Bus Communication: Operation=%s, Address=0x%08X\n",
-                (BusOp == READ) ? "READ" :
-                (BusOp == WRITE) ? "WRITE" :
-                (BusOp == INVALIDATE) ? "INVALIDATE" :
-                (BusOp == RWIM) ? "RWIM" : "UNKNOWN",
-                Address);
+// The inclusive snoop filter has stopped tracking the line at `Address`: take
+// it out of `c` with an RWIM snoop, which writes a modified copy back. No peer
+// wanted the line, so its next miss is not a coherence miss. Returns the
+// cache's snoop answer.
+int recall_line(Cache *c, unsigned int Address) {
+    int answer;
+
+    recalling = 1;
+    answer = snoop_cache(c, RWIM, Address);
+    recalling = 0;
+    return answer;
+}
+
+// Snoop a bus request from `c` in the other caches on the bus and combine
+// their answers: HITM if a peer held the line modified, else HIT if any peer
+// held it, else NOHIT. With a snoop filter only the peers it lists as possible
+// holders are asked; otherwise the request is broadcast.
+static int snoop_peers(const Cache *c, int BusOp, unsigned int Address) {
+    uint64_t targets;
+    uint64_t not_holding = 0;
+    int result = NOHIT;
+
+    if (BusOp != READ && BusOp != RWIM && BusOp != INVALIDATE) {
+        return NOHIT;
+    }
+    if (snoop_filter_active) {
+        targets = snoop_filter_sharers(c->bus_id, Address);
+    } else {
+        targets = (num_caches >= 64 ? ~(uint64_t)0 : ((uint64_t)1 << num_caches) - 1) &
+                  ~((uint64_t)1 << c->bus_id);
     }
 
-    // Report the snoop result
-    PutSnoopResult(Address, *SnoopResult);
+    while (targets) {
+        int i = __builtin_ctzll(targets);
+        int answer = snoop_cache(bus_caches[i], BusOp, Address);
+
+        targets &= targets - 1;
+        if (answer == NOHIT) {
+            not_holding |= (uint64_t)1 << i;
+        }
+        if (answer == HITM || (answer == HIT && result == NOHIT)) {
+            result = answer;
+        }
+    }
+
+    if (snoop_filter_active) {
+        snoop_filter_update(c->bus_id, BusOp, Address, not_holding);
+    }
+    return result;
 }
 
-void PutSnoopResult(unsigned int Address, int SnoopResult) {
-    if (Mode == 1) { // Normal mode
-        printf("SnoopResult: Address: 0x%08X, SnoopResult: %s\n",
-               Address,
-               (SnoopResult == HIT) ? "HIT" :
-               (SnoopResult == HITM) ? "HITM" :
-               (SnoopResult == NOHIT) ? "NOHIT" : "UNKNOWN");
+// Put a bus operation from `c` on the bus. On a multi-cache bus the peers snoop
+// it and *SnoopResult is their combined answer; otherwise it is simulated.
+void BusOperation(Cache *c, int BusOp, unsigned int Address, int *SnoopResult) {
+    switch (BusOp) {
+        case READ: c->stats.num_bus_reads++; break;
+        case WRITE: c->stats.num_bus_writes++; break;
+        case INVALIDATE: c->stats.num_bus_invalidates++; break;
+        case RWIM: c->stats.num_bus_rwims++; break;
     }
 
-    // Log the snoop result to the output file
-    if (output_file) {
-        fprintf(output_file, "SnoopResult: Address=0x%08X, SnoopResult=%s\n",
-                Address,
-                (SnoopResult == HIT) ? "HIT" :
-                (SnoopResult == HITM) ? "HITM" :
-                (SnoopResult == NOHIT) ? "NOHIT" : "UNKNOWN");
+    // Log the bus communication; the peers' snoops follow it in the log
+    if (LOG_ENABLED(LOG_TRANSACTIONS)) {
+        LogEvent ev = cache_event(c, EV_BUS_OPERATION);
+        ev.bus_op = (uint8_t)BusOp;
+        ev.address = Address;
+        log_event(&ev);
+    }
+
+    if (c->bus_id < 0) {
+        *SnoopResult = GetSnoopResult(Address);
+    } else {
+        *SnoopResult = snoop_peers(c, BusOp, Address);
+        c->stats.num_snoop_hits += (*SnoopResult == HIT);
+        c->stats.num_snoop_hitms += (*SnoopResult == HITM);
+    }
+    if (timing_active) {
+        timing_bus_operation(c, BusOp, Address, *SnoopResult);
+    }
+
+    // Report the snoop result
+    PutSnoopResult(c, Address, *SnoopResult);
+}
+
+void PutSnoopResult(const Cache *c, unsigned int Address, int SnoopResult) {
+    // Log the snoop result
+    if (LOG_ENABLED(LOG_TRANSACTIONS)) {
+        LogEvent ev = cache_event(c, EV_SNOOP_RESULT);
+        ev.snoop_result = (uint8_t)SnoopResult;
+        ev.address = Address;
+        log_event(&ev);
     }
 }
 
 
 // Simulate communication to our upper-level cache
-void MessageToCache(int Message, unsigned int Address) {
-    const char *message_type = NULL;
+void MessageToCache(const Cache *c, int Message, unsigned int Address) {
+    // GETLINE, SENDLINE, INVALIDATELINE or EVICTLINE; the log names them
+    if (LOG_ENABLED(LOG_TRANSACTIONS)) {
+        LogEvent ev = cache_event(c, EV_L1_MESSAGE);
+        ev.bus_op = (uint8_t)Message;
+        ev.address = Address;
+        log_event(&ev);
+    }
+}
 
-    switch (Message) {
-        case GETLINE:
-            message_type = "GETLINE"; // L2 requests data from L1
-            break;
-        case SENDLINE:
-            message_type = "SENDLINE"; // L2 sends data to L1
-            break;
-        case INVALIDATELINE:
-            message_type = "INVALIDATELINE"; // L2 invalidates L1's cache line
-            break;
-        case EVICTLINE:
-            message_type = "EVICTLINE"; // L2 evicts a line from L1
-            break;
-        default:
-            message_type = "UNKNOWN"; // For unexpected message types
-            break;
+// Evict the line in `way` of set `index` to make room for a fill: the L1 copy
+// goes, and a modified line is written back. Returns the evicted line's address.
+static unsigned int evict_line(Cache *c, unsigned int index, int way) {
+    CacheLine victim = load_line(c, index, way);
+    unsigned int evicted_address = line_address(c, LINE_TAG(victim), index); // Tag + Index + Block Offset
+    int snoop_result = NOHIT;
+
+    if (snoop_filter_active) {
+        snoop_filter_drop(c->bus_id, evicted_address); // No snoops for the victim from now on
+    }
+    if (c->prefetched_ways && (c->prefetched_ways[index] & WAY_BIT(way))) {
+        c->prefetched_ways[index] &= ~WAY_BIT(way);
+        c->stats.num_prefetch_unused++;
     }
 
-    if (Mode == 1) { // Print messages only in normal mode
-        printf("L2 to L1 Message: %s, Address: 0x%08X\n", message_type, Address);
+    // Check the state of the line being evicted
+    if (LINE_STATE(victim) == MODIFIED) {
+        // Modified line requires GETLINE and INVALIDATELINE
+        MessageToCache(c, GETLINE, evicted_address); // L2 requests modified line from L1
+        MessageToCache(c, INVALIDATELINE, evicted_address); // L2 invalidates the line in L1
+        BusOperation(c, WRITE, evicted_address, &snoop_result);
+    } else {
+        // Other states only require EVICTLINE
+        MessageToCache(c, EVICTLINE, evicted_address); // L2 evicts the line from L1
     }
-    fprintf(output_file, "L2 to L1 Message: %s, Address: 0x%08X\n", message_type, Address);
+    return evicted_address;
 }
 
-void handle_read_operation(TraceEntry *entry) {
-    unsigned int index = entry->parsed_addr.index;
-    unsigned int tag = entry->parsed_addr.tag;
+// A demand access hit `way`, which the prefetcher filled. The first such hit
+// makes the prefetch useful, and late if the line could not have arrived yet.
+// Returns 1 on that first hit.
+static int use_prefetched_line(Cache *c, unsigned int index, int way) {
+    if (!(c->prefetched_ways[index] & WAY_BIT(way))) {
+        return 0;
+    }
+    c->prefetched_ways[index] &= ~WAY_BIT(way);
+    c->stats.num_prefetch_useful++;
+    if (c->prefetch_clock - c->prefetch_issued[((size_t)index << c->way_bits) + (unsigned int)way] <
+        PREFETCH_LATENCY) {
+        c->stats.num_prefetch_late++;
+    }
+    return 1;
+}
 
-    CacheIndex *current_index = &cache[index];
-    int hit = -1; // Index of the hit line, -1 if miss
-    int all_filled = 1; // Flag to track if all lines in the index are filled
-    
+// A demand miss on a line a prefetch evicted not long ago: the prefetch polluted the cache
+static void check_prefetch_pollution(Cache *c, const TraceEntry *entry) {
+    unsigned int line = entry->address >> c->offset_bits;
+    uint32_t *victim = &c->prefetch_victims[line & (PREFETCH_VICTIM_ENTRIES - 1)];
 
-    // Check for a hit and verify if all lines are filled
-    int i;
-    for (i = 0; i < NUM_LINES_PER_INDEX; i++) {
-        if (current_index->lines[i].metadata.valid) {
-            // If we find a valid line, we check for a hit
-            if (current_index->lines[i].tag == tag) {
-                hit = i;
-                break;
-            }
-        } else {
-            // If we find an invalid line, we set all_filled to false
-            all_filled = 0;
-        }
+    if (*victim == line + 1) {
+        c->stats.num_prefetch_polluting++;
+        *victim = 0;
+    }
+}
+
+// Prefetcher bookkeeping after a demand access that hit `hit` (-1 on a miss).
+// Reads and fetches also train the prefetcher, which may issue prefetches.
+static void prefetch_after_access(Cache *c, const TraceEntry *entry, int hit, int train) {
+    int triggered = 1;
+
+    if (hit == -1) {
+        check_prefetch_pollution(c, entry);
+    } else {
+        triggered = use_prefetched_line(c, entry->parsed_addr.index, hit);
+    }
+    if (train) {
+        train_prefetcher(c, entry, triggered);
     }
+}
+
+// Fill the line at `Address` for the prefetcher triggered by `trigger`. The
+// line takes the demand read miss path, except that nothing is sent to L1.
+// Returns 1 if the line was filled, 0 if it was already in the cache.
+int prefetch_line(Cache *c, unsigned int Address, const TraceEntry *trigger) {
+    TraceEntry entry = *trigger;
+    unsigned int index, tag;
+    int empty_way, way, dead;
+    Cache *timed;
+
+    entry.address = Address & ~c->offset_mask;
+    entry.parsed_addr = decompose_cache_address(c, entry.address);
+    index = entry.parsed_addr.index;
+    tag = entry.parsed_addr.tag;
+
+    refresh_set(c, index);
+    if (find_way(c, index, tag, &empty_way) != -1) {
+        c->stats.num_prefetch_hits++;
+        return 0;
+    }
+    log_access_event(c, EV_PREFETCH, &entry, INVALID, INVALID);
+
+    // Nothing waits for a prefetch; its bus operations only hold the bus
+    timed = timing_detach(NULL);
+    dead = c->reuse_counters ? reuse_miss(c, &entry) : 0;
+    way = empty_way;
+    if (way == -1) {
+        unsigned int line;
+        way = replacement_victim(c, index);
+        line = evict_line(c, index, way) >> c->offset_bits;
+        c->prefetch_victims[line & (PREFETCH_VICTIM_ENTRIES - 1)] = line + 1;
+    }
+
+    int snoop_result = GetSnoopResult(entry.address);
+    BusOperation(c, READ, entry.address, &snoop_result);
+    MESIState new_state = (snoop_result == NOHIT) ? EXCLUSIVE : SHARED;
+    store_line(c, index, way, MAKE_LINE(tag, new_state, 0));
+    replacement_fill(c, index, way, &entry, dead);
+
+    c->prefetched_ways[index] |= WAY_BIT(way);
+    c->prefetch_issued[((size_t)index << c->way_bits) + (unsigned int)way] = c->prefetch_clock;
+    c->stats.num_prefetches++;
+    timing_detach(timed);
+    return 1;
+}
+
+// Whether `c` holds the line `entry` accesses, without touching its replacement state
+int cache_holds_line(Cache *c, const TraceEntry *entry) {
+    int empty_way;
+
+    refresh_set(c, entry->parsed_addr.index);
+    return find_way(c, entry->parsed_addr.index, entry->parsed_addr.tag, &empty_way) != -1;
+}
+
+// Serve a read miss the reuse predictor says is dead on arrival: the line goes
+// to L1 without being allocated here
+static void bypass_read_miss(Cache *c, TraceEntry *entry) {
+    int snoop_result = GetSnoopResult(entry->address);
+
+    log_access_event(c, EV_BYPASS, entry, INVALID, INVALID);
+    c->stats.num_cache_misses++;
+    BusOperation(c, READ, entry->address, &snoop_result);
+    MessageToCache(c, SENDLINE, entry->address); // Send line from L2 to L1
+    record_bypass(c, entry);
+}
+
+void handle_read_operation(Cache *c, TraceEntry *entry) {
+    unsigned int index = entry->parsed_addr.index;
+    unsigned int tag = entry->parsed_addr.tag;
+
+    refresh_set(c, index);
+    int empty_way; // First invalid way, -1 if all lines in the index are filled
+    int hit = find_way(c, index, tag, &empty_way); // Index of the hit line, -1 if miss
+    // Reuse prediction for a miss, made once before a victim's eviction retrains it
+    int dead = (hit == -1 && c->reuse_counters) ? reuse_miss(c, entry) : 0;
 
     if (hit != -1) {
         // Cache hit: Handle based on MESI state
-        MESIState state = current_index->lines[hit].metadata.state;
-        num_cache_hits++;
-
-        // Log cache hit
-        fprintf(output_file,
-                "Cache Hit: Address 0x%08X (Index: 0x%X, Tag: 0x%08X, State: %s)\n",
-                entry->address, index, tag, get_mesi_state_name(state));
-        if (Mode == 1) {
-            printf("Cache Hit: Address 0x%08X (Index: 0x%X, Tag: 0x%08X, State: %s)\n",
-                   entry->address, index, tag, get_mesi_state_name(state));
-        }
-        MessageToCache(SENDLINE, entry->address); // Send line from L2 to L1
+        MESIState state = LINE_STATE(load_line(c, index, hit));
+        c->stats.num_cache_hits++;
 
-        // Update PLRU for this line
-        update_plru_tree(current_index->pseudo_LRU, hit);
+        log_access_event(c, EV_CACHE_HIT, entry, state, state);
 
-    } else if (all_filled == 0) {
-        // Cache is not fully filled (at least one line is invalid)
-        fprintf(output_file,
-                "Cache Miss (Empty Slot): Address 0x%08X (Index: 0x%X, Tag: 0x%08X)\n",
-                entry->address, index, tag);
+        MessageToCache(c, SENDLINE, entry->address); // Send line from L2 to L1
 
-        if (Mode == 1) {
-            printf("Cache Miss (Empty Slot): Address 0x%08X (Index: 0x%X, Tag: 0x%08X).\n",
-                   entry->address, index, tag);
-        }
+        // Update the replacement state for this line
+        replacement_hit(c, index, hit);
+
+    } else if (dead) {
+        // Miss predicted dead on arrival: bypass this cache
+        bypass_read_miss(c, entry);
+
+    } else if (empty_way != -1) {
+        // Cache is not fully filled (at least one line is invalid)
+        log_access_event(c, EV_MISS_EMPTY, entry, INVALID, INVALID);
 
         // Perform bus communication
         int snoop_result = GetSnoopResult(entry->address);
-        num_cache_misses++;
-        BusOperation(READ, entry->address, &snoop_result);
-
-        // Find the first empty slot to fill
-        int first_empty_slot = -1;
-        for (i = 0; i < NUM_LINES_PER_INDEX; i++) {
-            if (!current_index->lines[i].metadata.valid) {
-                first_empty_slot = i;
-                break;
-            }
-        }
+        c->stats.num_cache_misses++;
+        BusOperation(c, READ, entry->address, &snoop_result);
+
+        // Fill the first empty slot
+        int first_empty_slot = empty_way;
 
         // Insert the new line in the first available way
-        current_index->lines[first_empty_slot].tag = tag;
-        current_index->lines[first_empty_slot].metadata.valid = 1;
         MESIState new_state;
         if (snoop_result == HIT) {
             new_state = SHARED;
@@ -288,60 +1250,29 @@ void handle_read_operation(TraceEntry *entry) {
         } else {
             new_state = EXCLUSIVE;
         }
-        current_index->lines[first_empty_slot].metadata.state = new_state; // Set initial state
+        store_line(c, index, first_empty_slot, MAKE_LINE(tag, new_state, 0)); // Set initial state
 
-        // Update PLRU for this line
-        update_plru_tree(current_index->pseudo_LRU, first_empty_slot);
+        // Update the replacement state for this line
+        replacement_fill(c, index, first_empty_slot, entry, dead);
 
-        MessageToCache(SENDLINE, entry->address); // Send line from L2 to L1
+        MessageToCache(c, SENDLINE, entry->address); // Send line from L2 to L1
 
-        if (Mode == 1) {
-            printf("Address 0x%08X (Index: 0x%X, Tag: 0x%08X, New State: %s)\n\n",
-                   entry->address, index, tag, get_mesi_state_name(new_state));
-        }
-        fprintf(output_file,
-                    "Address 0x%08X (Index: 0x%X, Tag: 0x%08X, New State: %s)\n\n",
-                   entry->address, index, tag, get_mesi_state_name(new_state));
+        log_access_event(c, EV_FILL, entry, INVALID, new_state);
 
     } else {
         // Cache miss with a collision
-        fprintf(output_file,
-                "Cache Miss (collision): Address 0x%08X (Index: 0x%X, Tag: 0x%08X)\n",
-                entry->address, index, tag);
-        if (Mode == 1) {
-            printf("Cache Miss (collision): Address 0x%08X (Index: 0x%X, Tag: 0x%08X).\n",
-                   entry->address, index, tag);
-        }
+        log_access_event(c, EV_MISS_COLLISION, entry, INVALID, INVALID);
 
-        // Find a way to evict using PLRU
-        int eviction_way = find_eviction_way(current_index->pseudo_LRU);
-        num_cache_misses++;
+        // Find a way to evict using the replacement policy
+        int eviction_way = replacement_victim(c, index);
+        c->stats.num_cache_misses++;
         int snoop_result = GetSnoopResult(entry->address);
-	unsigned int evicted_tag = current_index->lines[eviction_way].tag;
-	unsigned int evicted_index = index; // The current index is the same
-	unsigned int evicted_address = (evicted_tag << 20) | (evicted_index << 6); // Tag + Index + Block Offset
-
-        // Check the state of the line being evicted
-        if (current_index->lines[eviction_way].metadata.state == MODIFIED) {
-            // Modified line requires GETLINE and INVALIDATELINE
-            MessageToCache(GETLINE, evicted_address); // L2 requests modified line from L1
-            MessageToCache(INVALIDATELINE, evicted_address); // L2 invalidates the line in L1
-	    BusOperation(WRITE, evicted_address, &snoop_result);
-        } else {
-            // Other states only require EVICTLINE
-            MessageToCache(EVICTLINE, evicted_address); // L2 evicts the line from L1
-        }
+        evict_line(c, index, eviction_way);
 
         // Perform bus communication
-        BusOperation(READ, entry->address, &snoop_result);
-
-        // Invalidate the line being evicted
-        invalidate_cache_line(&current_index->lines[eviction_way]);
-
-        // Insert the new tag and update the line's state
-        current_index->lines[eviction_way].tag = tag;
-        current_index->lines[eviction_way].metadata.valid = 1;
+        BusOperation(c, READ, entry->address, &snoop_result);
 
+        // Insert the new tag and update the line's state; the new line replaces the evicted one
         MESIState new_state;
         if (snoop_result == HIT) {
             new_state = SHARED;
@@ -350,255 +1281,155 @@ void handle_read_operation(TraceEntry *entry) {
         } else {
             new_state = EXCLUSIVE;
         }
-        current_index->lines[eviction_way].metadata.state = new_state;
+        store_line(c, index, eviction_way, MAKE_LINE(tag, new_state, 0));
 
-        // Update PLRU after inserting the new tag
-        update_plru_tree(current_index->pseudo_LRU, eviction_way);
+        // Update the replacement state after inserting the new tag
+        replacement_fill(c, index, eviction_way, entry, dead);
 
-        MessageToCache(SENDLINE, entry->address); // Send line from L2 to L1
+        MessageToCache(c, SENDLINE, entry->address); // Send line from L2 to L1
 
-        if (Mode == 1) {
-            printf("Address 0x%08X (Index: 0x%X, Tag: 0x%08X, New State: %s)\n\n",
-                   entry->address, index, tag, get_mesi_state_name(new_state));
-        }
-        fprintf(output_file,
-                "Address 0x%08X (Index: 0x%X, Tag: 0x%08X, New State: %s)\n\n",
-                entry->address, index, tag, get_mesi_state_name(new_state));
+        log_access_event(c, EV_FILL, entry, INVALID, new_state);
+    }
+
+    if (c->miss_classifier) {
+        classify_access(c, entry, hit != -1);
+    }
+    if (c->prefetcher) {
+        prefetch_after_access(c, entry, hit, 1);
     }
 }
 
-void handle_write_operation(TraceEntry *entry) {
+void handle_write_operation(Cache *c, TraceEntry *entry) {
     unsigned int index = entry->parsed_addr.index;
     unsigned int tag = entry->parsed_addr.tag;
 
-    CacheIndex *current_index = &cache[index];
-    int hit = -1; // Index of the hit line, -1 if miss
-    int all_filled = 1; // Flag to track if all lines in the index are filled
-
-    // Check for a hit and verify if all lines are filled
-    int i;
-    for (i = 0; i < NUM_LINES_PER_INDEX; i++) {
-        if (current_index->lines[i].metadata.valid) {
-            // If we find a valid line, we check for a hit
-            if (current_index->lines[i].tag == tag) {
-                hit = i;
-                break;
-            }
-        } else {
-            // If we find an invalid line, we set all_filled to false
-            all_filled = 0;
-        }
-    }
+    refresh_set(c, index);
+    int empty_way; // First invalid way, -1 if all lines in the index are filled
+    int hit = find_way(c, index, tag, &empty_way); // Index of the hit line, -1 if miss
+    // Reuse prediction for a miss, made once before a victim's eviction retrains it
+    int dead = (hit == -1 && c->reuse_counters) ? reuse_miss(c, entry) : 0;
 
     if (hit != -1) {
         // Cache hit: Handle based on MESI state
-        MESIState state = current_index->lines[hit].metadata.state;
-        num_cache_hits++;
-
-        fprintf(output_file,
-                "Cache Hit: Address 0x%08X (Index: 0x%X, Tag: 0x%08X, State: %s)\n",
-                entry->address, index, tag, get_mesi_state_name(state));
-        if (Mode == 1) {
-            printf("Cache Hit: Address 0x%08X (Index: 0x%08X, Tag: 0x%08X, State: %s)\n",
-                   entry->address, index, tag, get_mesi_state_name(state));
-        }
-	if (state == SHARED) {
+        MESIState state = LINE_STATE(load_line(c, index, hit));
+        c->stats.num_cache_hits++;
+
+        log_access_event(c, EV_CACHE_HIT, entry, state, state);
+
+        if (state == SHARED) {
             // SHARED -> MODIFIED: Invalidate other caches
             state = MODIFIED;
             int snoop_result = HIT;
-            BusOperation(INVALIDATE, entry->address, &snoop_result); // Invalidate other caches
+            BusOperation(c, INVALIDATE, entry->address, &snoop_result); // Invalidate other caches
 	}else if (state == EXCLUSIVE || state == MODIFIED) {
             // EXCLUSIVE/MODIFIED: Stay in MODIFIED state, no bus communication
             state = MODIFIED;
 	}
 
-	current_index->lines[hit].metadata.dirty = 1;
-	current_index->lines[hit].metadata.state = state;
-        // Log cache hit
-        fprintf(output_file,
-                "Address 0x%08X (Index: 0x%X, Tag: 0x%08X, State: %s)\n",
-                entry->address, index, tag, get_mesi_state_name(state));
-        if (Mode == 1) {
-            printf("Address 0x%08X (Index: 0x%08X, Tag: 0x%08X, State: %s)\n",
-                   entry->address, index, tag, get_mesi_state_name(state));
-        }
-        MessageToCache(SENDLINE, entry->address); // Send line from L2 to L1
+	store_line(c, index, hit, MAKE_LINE(tag, state, 1));
+        log_access_event(c, EV_WRITE_HIT, entry, state, state);
+        MessageToCache(c, SENDLINE, entry->address); // Send line from L2 to L1
 
-        // Update PLRU for this line
-        update_plru_tree(current_index->pseudo_LRU, hit);
+        // Update the replacement state for this line
+        replacement_hit(c, index, hit);
 
-    } else if (all_filled == 0) {
+    } else if (empty_way != -1) {
         // Cache is not fully filled (at least one line is invalid)
-        fprintf(output_file,
-                "Cache Miss (Empty Slot): Address 0x%08X (Index: 0x%08X, Tag: 0x%08X)\n",
-                entry->address, index, tag);
-
-        if (Mode == 1) {
-            printf("Cache Miss (Empty Slot): Address 0x%08X (Index: 0x%08X, Tag: 0x%08X).\n",
-                   entry->address, index, tag);
-        }
+        log_access_event(c, EV_MISS_EMPTY, entry, INVALID, INVALID);
 
         // Perform bus communication
         int snoop_result = GetSnoopResult(entry->address);
-        BusOperation(RWIM, entry->address, &snoop_result);
-        num_cache_misses++;
-
-        // Find the first empty slot to fill
-        int first_empty_slot = -1;
-        for (i = 0; i < NUM_LINES_PER_INDEX; i++) {
-            if (!current_index->lines[i].metadata.valid) {
-                first_empty_slot = i;
-                break;
-            }
-        }
-        MESIState state = current_index->lines[hit].metadata.state;
+        BusOperation(c, RWIM, entry->address, &snoop_result);
+        c->stats.num_cache_misses++;
+
+        // Fill the first empty slot
+        int first_empty_slot = empty_way;
+        MESIState state;
         // Insert the new line in the first available way
-        current_index->lines[first_empty_slot].tag = tag;
-        current_index->lines[first_empty_slot].metadata.valid = 1;
-        current_index->lines[first_empty_slot].metadata.dirty = 1;
         state = MODIFIED; // Set initial state
-	current_index->lines[first_empty_slot].metadata.state = state;
+        store_line(c, index, first_empty_slot, MAKE_LINE(tag, state, 1)); // Dirty from the start
 
-        // Update PLRU for this line
-        update_plru_tree(current_index->pseudo_LRU, first_empty_slot);
+        // Update the replacement state for this line
+        replacement_fill(c, index, first_empty_slot, entry, dead);
 
-        MessageToCache(SENDLINE, entry->address); // Send line from L2 to L1
+        MessageToCache(c, SENDLINE, entry->address); // Send line from L2 to L1
 
-        if (Mode == 1) {
-            printf("Address 0x%08X (Index: 0x%08X, Tag: 0x%08X, New State: %s)\n\n",
-                   entry->address, index, tag, get_mesi_state_name(state));
-        }
-        fprintf(output_file,
-                    "Address 0x%08X (Index: 0x%08X, Tag: 0x%08X, New State: %s)\n\n",
-                   entry->address, index, tag, get_mesi_state_name(state));
+        log_access_event(c, EV_FILL, entry, INVALID, state);
 
     } else {
         // Cache miss with a collision
-        fprintf(output_file,
-                "Cache Miss (collision): Address 0x%08X (Index: 0x%08X, Tag: 0x%08X)\n",
-               entry->address, index, tag);
-        if (Mode == 1) {
-            printf("Cache Miss (collision): Address 0x%08X (Index: 0x%08X, Tag: 0x%08X).\n",
-                   entry->address, index, tag);
-        }
+        log_access_event(c, EV_MISS_COLLISION, entry, INVALID, INVALID);
 
-        // Find a way to evict using PLRU
-        int eviction_way = find_eviction_way(current_index->pseudo_LRU);
-        num_cache_misses++;
+        // Find a way to evict using the replacement policy
+        int eviction_way = replacement_victim(c, index);
+        c->stats.num_cache_misses++;
         int snoop_result = GetSnoopResult(entry->address);
-	unsigned int evicted_tag = current_index->lines[eviction_way].tag;
-	unsigned int evicted_index = index; // The current index is the same
-	unsigned int evicted_address = (evicted_tag << 20) | (evicted_index << 6); // Tag + Index + Block Offset
-
-        // Check the state of the line being evicted
-        if (current_index->lines[eviction_way].metadata.state == MODIFIED) {
-            // Modified line requires GETLINE and INVALIDATELINE
-            MessageToCache(GETLINE, evicted_address); // L2 requests modified line from L1
-            MessageToCache(INVALIDATELINE, evicted_address); // L2 invalidates the line in L1
-	    BusOperation(WRITE, evicted_address, &snoop_result);
-        } else {
-            // Other states only require EVICTLINE
-            MessageToCache(EVICTLINE, evicted_address); // L2 evicts the line from L1
-        }
+        evict_line(c, index, eviction_way);
 
         // Perform bus communication
-        BusOperation(RWIM, entry->address, &snoop_result);
+        BusOperation(c, RWIM, entry->address, &snoop_result);
 
-        // Invalidate the line being evicted
-        invalidate_cache_line(&current_index->lines[eviction_way]);
-        MESIState state = current_index->lines[hit].metadata.state;
+        MESIState state;
 
-        // Insert the new tag and update the line's state
-        current_index->lines[eviction_way].tag = tag;
-        current_index->lines[eviction_way].metadata.valid = 1;
-        current_index->lines[eviction_way].metadata.dirty = 1;
+        // Insert the new tag and update the line's state; the new line replaces the evicted one
         state = MODIFIED;
-	current_index->lines[eviction_way].metadata.state = state;
-        // Update PLRU after inserting the new tag
-        update_plru_tree(current_index->pseudo_LRU, eviction_way);
+        store_line(c, index, eviction_way, MAKE_LINE(tag, state, 1));
+        // Update the replacement state after inserting the new tag
+        replacement_fill(c, index, eviction_way, entry, dead);
 
-        MessageToCache(SENDLINE, entry->address); // Send line from L2 to L1
+        MessageToCache(c, SENDLINE, entry->address); // Send line from L2 to L1
 
-        if (Mode == 1) {
-            printf("Address 0x%08X (Index: 0x%08X, Tag: 0x%08X, New State: %s)\n\n",
-                  entry->address, index, tag, get_mesi_state_name(state));
-        }
-        fprintf(output_file,
-                "Address 0x%08X (Index: 0x%08X, Tag: 0x%08X, New State: %s)\n\n",
-                entry->address, index, tag, get_mesi_state_name(state));
+        log_access_event(c, EV_FILL, entry, INVALID, state);
+    }
+
+    if (c->miss_classifier) {
+        classify_access(c, entry, hit != -1);
+    }
+    if (c->prefetcher) {
+        prefetch_after_access(c, entry, hit, 0);
     }
 }
 
 
-void handle_instruction_cache_read(TraceEntry *entry) {
+void handle_instruction_cache_read(Cache *c, TraceEntry *entry) {
     unsigned int index = entry->parsed_addr.index;
     unsigned int tag = entry->parsed_addr.tag;
 
-    CacheIndex *current_index = &cache[index];
-    int hit = -1; // Index of the hit line, -1 if miss
-    int all_filled = 1; // Flag to track if all lines in the index are filled
-
-    // Check for a hit and verify if all lines are filled
-    int i;
-    for (i = 0; i < NUM_LINES_PER_INDEX; i++) {
-        if (current_index->lines[i].metadata.valid) {
-            // If we find a valid line, we check for a hit
-            if (current_index->lines[i].tag == tag) {
-                hit = i;
-                break;
-            }
-        } else {
-            // If we find an invalid line, we set all_filled to false
-            all_filled = 0;
-        }
-    }
+    refresh_set(c, index);
+    int empty_way; // First invalid way, -1 if all lines in the index are filled
+    int hit = find_way(c, index, tag, &empty_way); // Index of the hit line, -1 if miss
+    // Reuse prediction for a miss, made once before a victim's eviction retrains it
+    int dead = (hit == -1 && c->reuse_counters) ? reuse_miss(c, entry) : 0;
 
     if (hit != -1) {
         // Cache hit: Handle based on MESI state
-        MESIState state = current_index->lines[hit].metadata.state;
-        num_cache_hits++;
-
-        // Log cache hit
-        fprintf(output_file,
-                "Cache Hit: Address 0x%08X (Index: 0x%X, Tag: 0x%08X, State: %s)\n",
-                entry->address, index, tag, get_mesi_state_name(state));
-        if (Mode == 1) {
-            printf("Cache Hit: Address 0x%08X (Index: 0x%X, Tag: 0x%08X, State: %s)\n",
-                   entry->address, index, tag, get_mesi_state_name(state));
-        }
-        MessageToCache(SENDLINE, entry->address); // Send line from L2 to L1
+        MESIState state = LINE_STATE(load_line(c, index, hit));
+        c->stats.num_cache_hits++;
 
-        // Update PLRU for this line
-        update_plru_tree(current_index->pseudo_LRU, hit);
+        log_access_event(c, EV_CACHE_HIT, entry, state, state);
 
-    } else if (all_filled == 0) {
-        // Cache is not fully filled (at least one line is invalid)
-        fprintf(output_file,
-                "Cache Miss (Empty Slot): Address 0x%08X (Index: 0x%X, Tag: 0x%08X)\n",
-               entry->address, index, tag);
+        MessageToCache(c, SENDLINE, entry->address); // Send line from L2 to L1
 
-        if (Mode == 1) {
-            printf("Cache Miss (Empty Slot): Address 0x%08X (Index: 0x%X, Tag: 0x%08X).\n",
-                   entry->address, index, tag);
-        }
+        // Update the replacement state for this line
+        replacement_hit(c, index, hit);
+
+    } else if (dead) {
+        // Miss predicted dead on arrival: bypass this cache
+        bypass_read_miss(c, entry);
+
+    } else if (empty_way != -1) {
+        // Cache is not fully filled (at least one line is invalid)
+        log_access_event(c, EV_MISS_EMPTY, entry, INVALID, INVALID);
 
         // Perform bus communication
         int snoop_result = GetSnoopResult(entry->address);
-        num_cache_misses++;
-        BusOperation(READ, entry->address, &snoop_result);
-
-        // Find the first empty slot to fill
-        int first_empty_slot = -1;
-        for (i = 0; i < NUM_LINES_PER_INDEX; i++) {
-            if (!current_index->lines[i].metadata.valid) {
-                first_empty_slot = i;
-                break;
-            }
-        }
+        c->stats.num_cache_misses++;
+        BusOperation(c, READ, entry->address, &snoop_result);
+
+        // Fill the first empty slot
+        int first_empty_slot = empty_way;
 
         // Insert the new line in the first available way
-        current_index->lines[first_empty_slot].tag = tag;
-        current_index->lines[first_empty_slot].metadata.valid = 1;
         MESIState new_state;
         if (snoop_result == HIT) {
             new_state = SHARED;
@@ -607,60 +1438,29 @@ void handle_instruction_cache_read(TraceEntry *entry) {
         } else {
             new_state = EXCLUSIVE;
         }
-        current_index->lines[first_empty_slot].metadata.state = new_state; // Set initial state
+        store_line(c, index, first_empty_slot, MAKE_LINE(tag, new_state, 0)); // Set initial state
 
-        // Update PLRU for this line
-        update_plru_tree(current_index->pseudo_LRU, first_empty_slot);
+        // Update the replacement state for this line
+        replacement_fill(c, index, first_empty_slot, entry, dead);
 
-        MessageToCache(SENDLINE, entry->address); // Send line from L2 to L1
+        MessageToCache(c, SENDLINE, entry->address); // Send line from L2 to L1
 
-        if (Mode == 1) {
-            printf("Address 0x%08X (Index: 0x%X, Tag: 0x%08X, New State: %s)\n\n",
-                   entry->address, index, tag, get_mesi_state_name(new_state));
-        }
-        fprintf(output_file,
-                    "Address 0x%08X (Index: 0x%X, Tag: 0x%08X, New State: %s)\n\n",
-                   entry->address, index, tag, get_mesi_state_name(new_state));
+        log_access_event(c, EV_FILL, entry, INVALID, new_state);
 
     } else {
         // Cache miss with a collision
-        fprintf(output_file,
-                "Cache Miss (collision): Address 0x%08X (Index: 0x%X, Tag: 0x%08X)\n",
-                entry->address, index, tag);
-        if (Mode == 1) {
-            printf("Cache Miss (collision): Address 0x%08X (Index: 0x%X, Tag: 0x%08X).\n",
-                   entry->address, index, tag);
-        }
+        log_access_event(c, EV_MISS_COLLISION, entry, INVALID, INVALID);
 
-        // Find a way to evict using PLRU
-        int eviction_way = find_eviction_way(current_index->pseudo_LRU);
-        num_cache_misses++;
+        // Find a way to evict using the replacement policy
+        int eviction_way = replacement_victim(c, index);
+        c->stats.num_cache_misses++;
         int snoop_result = GetSnoopResult(entry->address);
-	unsigned int evicted_tag = current_index->lines[eviction_way].tag;
-	unsigned int evicted_index = index; // The current index is the same
-	unsigned int evicted_address = (evicted_tag << 20) | (evicted_index << 6); // Tag + Index + Block Offset
-
-        // Check the state of the line being evicted
-        if (current_index->lines[eviction_way].metadata.state == MODIFIED) {
-            // Modified line requires GETLINE and INVALIDATELINE
-            MessageToCache(GETLINE, evicted_address); // L2 requests modified line from L1
-            MessageToCache(INVALIDATELINE, evicted_address); // L2 invalidates the line in L1
-	    BusOperation(WRITE, evicted_address, &snoop_result);
-        } else {
-            // Other states only require EVICTLINE
-            MessageToCache(EVICTLINE, evicted_address); // L2 evicts the line from L1
-        }
+        evict_line(c, index, eviction_way);
 
         // Perform bus communication
-        BusOperation(READ, entry->address, &snoop_result);
-
-        // Invalidate the line being evicted
-        invalidate_cache_line(&current_index->lines[eviction_way]);
-
-        // Insert the new tag and update the line's state
-        current_index->lines[eviction_way].tag = tag;
-        current_index->lines[eviction_way].metadata.valid = 1;
+        BusOperation(c, READ, entry->address, &snoop_result);
 
+        // Insert the new tag and update the line's state; the new line replaces the evicted one
         MESIState new_state;
         if (snoop_result == HIT) {
             new_state = SHARED;
@@ -669,452 +1469,309 @@ void handle_instruction_cache_read(TraceEntry *entry) {
         } else {
             new_state = EXCLUSIVE;
         }
-        current_index->lines[eviction_way].metadata.state = new_state;
+        store_line(c, index, eviction_way, MAKE_LINE(tag, new_state, 0));
 
-        // Update PLRU after inserting the new tag
-        update_plru_tree(current_index->pseudo_LRU, eviction_way);
+        // Update the replacement state after inserting the new tag
+        replacement_fill(c, index, eviction_way, entry, dead);
 
-        MessageToCache(SENDLINE, entry->address); // Send line from L2 to L1
+        MessageToCache(c, SENDLINE, entry->address); // Send line from L2 to L1
 
-        if (Mode == 1) {
-            printf("Address 0x%08X (Index: 0x%X, Tag: 0x%08X, New State: %s)\n\n",
-                   entry->address, index, tag, get_mesi_state_name(new_state));
-        }
-        fprintf(output_file,
-                "Address 0x%08X (Index: 0x%X, Tag: 0x%08X, New State: %s)\n\n",
-                entry->address, index, tag, get_mesi_state_name(new_state));
+        log_access_event(c, EV_FILL, entry, INVALID, new_state);
+    }
+
+    if (c->miss_classifier) {
+        classify_access(c, entry, hit != -1);
+    }
+    if (c->prefetcher) {
+        prefetch_after_access(c, entry, hit, 1);
     }
 }
 
-void handle_snooped_read_request(TraceEntry *entry) {
+int handle_snooped_read_request(Cache *c, TraceEntry *entry) {
     unsigned int index = entry->parsed_addr.index;
     unsigned int tag = entry->parsed_addr.tag;
 
-    CacheIndex *current_index = &cache[index];
+    refresh_set(c, index);
     int line_found = -1; // Index of the matching line, -1 if not found
+    MESIState state = INVALID; // State before the snoop, which decides our answer
 
-    // Log the snooped read request in both modes
-    if (Mode == 1) {
-        printf("Snooped Read Request: Address 0x%08X (Index: 0x%X, Tag: 0x%X)\n", 
-               entry->address, index, tag);
-    }
-    fprintf(output_file,
-            "Operation: Snooped read request (code 3), Address: 0x%08X\n"
-            "  Decomposed Address: Byte Offset=0x%X, Index=0x%X, Tag=0x%X\n",
-            entry->address, entry->parsed_addr.byte_offset, index, tag);
+    // Log the snooped read request
+    log_access_event(c, EV_SNOOP_REQUEST, entry, INVALID, INVALID);
     int snoop_result = GetSnoopResult(entry->address);
     // Search for the matching cache line
-    int i;
-    for (i = 0; i < NUM_LINES_PER_INDEX; i++) {
-        if (current_index->lines[i].metadata.valid && current_index->lines[i].tag == tag) {
-            line_found = i;
-            break;
-        }
-    }
+    int empty_way;
+    line_found = find_way(c, index, tag, &empty_way);
 
     if (line_found != -1) {
-        CacheLine *line = &current_index->lines[line_found];
-        MESIState state = line->metadata.state;
+        CacheLine line = load_line(c, index, line_found);
+        state = LINE_STATE(line);
 
         if (state == MODIFIED) {
-            line->metadata.state = SHARED;
-	    BusOperation(WRITE, entry->address, &snoop_result);
-            MessageToCache(GETLINE, entry->address);
-
-            if (Mode == 1) {
-                printf("Snooped Read: MODIFIED -> SHARED (Write-back to memory).\n\n");
-            }
-
-            fprintf(output_file,
-                    "  Snooped Read: MODIFIED -> SHARED (Write-back to memory).\n"
-                    "  Metadata: Valid=%d, Dirty=%d, MESI State=%s\n"
-                    "  Pseudo-LRU: 0x%X\n\n",
-                    line->metadata.valid, line->metadata.dirty,
-                    get_mesi_state_name(line->metadata.state),
-                    current_index->pseudo_LRU);
-
+            // On a real bus the write-back leaves memory up to date, so a later
+            // clear must not write the line again. The single-cache model has
+            // always kept the dirty bit here, and its logs still show it.
+            store_line(c, index, line_found, MAKE_LINE(tag, SHARED, c->bus_id < 0 && LINE_IS_DIRTY(line)));
+	    BusOperation(c, WRITE, entry->address, &snoop_result);
+            MessageToCache(c, GETLINE, entry->address);
         } else if (state == EXCLUSIVE) {
-            line->metadata.state = SHARED;
-            MessageToCache(GETLINE, entry->address);
-
-            if (Mode == 1) {
-                printf("Snooped Read: EXCLUSIVE -> SHARED.\n\n");
-            }
-
-            fprintf(output_file,
-                    "  Snooped Read: EXCLUSIVE -> SHARED.\n"
-                    "  Metadata: Valid=%d, Dirty=%d, MESI State=%s\n"
-                    "  Pseudo-LRU: 0x%X\n\n",
-                    line->metadata.valid, line->metadata.dirty,
-                    get_mesi_state_name(line->metadata.state),
-                    current_index->pseudo_LRU);
-
-        } else if (state == SHARED) {
-            if (Mode == 1) {
-                printf("Snooped Read: Already in SHARED state. No action needed.\n\n");
-            }
-
-            fprintf(output_file,
-                    "  Snooped Read: Already in SHARED state. No action needed.\n"
-                    "  Metadata: Valid=%d, Dirty=%d, MESI State=%s\n"
-                    "  Pseudo-LRU: 0x%X\n\n",
-                    line->metadata.valid, line->metadata.dirty,
-                    get_mesi_state_name(line->metadata.state),
-                    current_index->pseudo_LRU);
-
-        } else if (state == INVALID) {
-            if (Mode == 1) {
-                printf("Snooped Read: Line in INVALID state. No action needed.\n\n");
-            }
-
-            fprintf(output_file,
-                    "  Snooped Read: Line in INVALID state. Invalidating line.\n"
-                    "  Metadata: Valid=%d, Dirty=%d, MESI State=%s\n"
-                    "  Pseudo-LRU: 0x%X\n\n",
-                    line->metadata.valid, line->metadata.dirty,
-                    get_mesi_state_name(line->metadata.state),
-                    current_index->pseudo_LRU);
+            store_line(c, index, line_found, MAKE_LINE(tag, SHARED, LINE_IS_DIRTY(line)));
+            MessageToCache(c, GETLINE, entry->address);
         }
+        // SHARED (and INVALID) lines need no action
+        log_snoop_outcome(c, entry, line_found, state, LINE_STATE(load_line(c, index, line_found)));
     } else {
         // Line not present in cache
-        if (Mode == 1) {
-            printf("Snooped Read: Line not present in cache. No action needed.\n\n");
-        }
-
-        fprintf(output_file,
-                "  Snooped Read: Line not present in cache. No action needed.\n\n");
+        log_snoop_outcome(c, entry, -1, INVALID, INVALID);
     }
+    return snoop_answer(state);
 }
 
-void handle_snooped_write_request(TraceEntry *entry) {
+int handle_snooped_write_request(Cache *c, TraceEntry *entry) {
     unsigned int index = entry->parsed_addr.index;
     unsigned int tag = entry->parsed_addr.tag;
 
-    CacheIndex *current_index = &cache[index];
+    refresh_set(c, index);
     int line_found = -1; // Index of the matching line, -1 if not found
+    MESIState state = INVALID; // State before the snoop, which decides our answer
 
     // Search for the matching cache line
-    int i;
-    for (i = 0; i < NUM_LINES_PER_INDEX; i++) {
-        if (current_index->lines[i].metadata.valid && current_index->lines[i].tag == tag) {
-            line_found = i;
-            break;
-        }
-    }
+    int empty_way;
+    line_found = find_way(c, index, tag, &empty_way);
 
     if (line_found != -1) {
         // Line is present in the cache
-        CacheLine *line = &current_index->lines[line_found];
-        MESIState state = line->metadata.state;
+        CacheLine line = load_line(c, index, line_found);
+        state = LINE_STATE(line);
 
         if (state == MODIFIED || state == EXCLUSIVE || state == SHARED) {
             // Throw an error if the state is invalid for a bus write
             fprintf(stderr, "Error: Invalid MESI state (%s) for bus write operation (Address: 0x%08X)\n\n",
                     get_mesi_state_name(state), entry->address);
-            fprintf(output_file, "Error: Invalid MESI state (%s) for bus write operation (Address: 0x%08X)\n\n",
-                    get_mesi_state_name(state), entry->address);
-
-            if (Mode == 1) {
-                printf("Error: Invalid MESI state (%s) for bus write operation (Address: 0x%08X)\n\n",
-                       get_mesi_state_name(state), entry->address);
-            }
-        } else if (state == INVALID) {
-            // If the state is INVALID, no action is required
-            if (Mode == 1) {
-                printf("Snooped Write: Line already in INVALID state. No action needed (Address: 0x%08X).\n\n",
-                       entry->address);
-            }
-            fprintf(output_file,
-                    "Snooped Write: Line already in INVALID state. No action needed (Address: 0x%08X).\n\n",
-                    entry->address);
         }
+        // An INVALID line needs no action
+        log_snoop_outcome(c, entry, line_found, state, state);
     } else {
         // Line not present in cache
-        if (Mode == 1) {
-            printf("Snooped Write: Line not present in cache. No action needed (Address: 0x%08X).\n\n",
-                   entry->address);
-        }
-        fprintf(output_file,
-                "Snooped Write: Line not present in cache. No action needed (Address: 0x%08X).\n\n",
-                entry->address);
+        log_snoop_outcome(c, entry, -1, INVALID, INVALID);
     }
+    return snoop_answer(state);
 }
 
-void handle_snooped_rwim_request(TraceEntry *entry) {
+int handle_snooped_rwim_request(Cache *c, TraceEntry *entry) {
     unsigned int index = entry->parsed_addr.index;
     unsigned int tag = entry->parsed_addr.tag;
 
-    CacheIndex *current_index = &cache[index];
+    refresh_set(c, index);
     int line_found = -1; // Index of the matching line, -1 if not found
+    MESIState state = INVALID; // State before the snoop, which decides our answer
 
-    // Log the snooped RWIM request in both modes
-    if (Mode == 1) {
-        printf("Snooped RWIM Request: Address 0x%08X (Index: 0x%X, Tag: 0x%X)\n", 
-               entry->address, index, tag);
-    }
-    fprintf(output_file,
-            "Operation: Snooped RWIM request (code 5), Address: 0x%08X\n"
-            "  Decomposed Address: Byte Offset=0x%X, Index=0x%X, Tag=0x%X\n",
-            entry->address, entry->parsed_addr.byte_offset, index, tag);
+    // Log the snooped RWIM request
+    log_access_event(c, EV_SNOOP_REQUEST, entry, INVALID, INVALID);
 
     // Search for the matching cache line
-    int i;
-    for (i = 0; i < NUM_LINES_PER_INDEX; i++) {
-        if (current_index->lines[i].metadata.valid && current_index->lines[i].tag == tag) {
-            line_found = i;
-            break;
-        }
-    }
+    int empty_way;
+    line_found = find_way(c, index, tag, &empty_way);
 
     if (line_found != -1) {
-        CacheLine *line = &current_index->lines[line_found];
-        MESIState state = line->metadata.state;
+        CacheLine line = load_line(c, index, line_found);
+        state = LINE_STATE(line);
 
         if (state == MODIFIED) {
             // Transition MODIFIED -> INVALID and write back to memory
-            MessageToCache(GETLINE, entry->address); // Simulate L2 requesting data
-            MessageToCache(INVALIDATELINE, entry->address); // Invalidate 
+            MessageToCache(c, GETLINE, entry->address); // Simulate L2 requesting data
+            MessageToCache(c, INVALIDATELINE, entry->address); // Invalidate 
             int snoop_result = NOHIT;
-	    BusOperation(WRITE, entry->address, &snoop_result);
-            invalidate_cache_line(line); // Invalidate the line
-            if (Mode == 1) {
-                printf("Snooped RWIM: MODIFIED -> INVALID (Write-back to memory).\n\n");
-            }
-            fprintf(output_file,
-                    "  Snooped RWIM: MODIFIED -> INVALID (Write-back to memory).\n\n"
-                    "  Metadata: Valid=%d, Dirty=%d, MESI State=%s\n"
-                    "  Pseudo-LRU: 0x%X\n",
-                    line->metadata.valid, line->metadata.dirty,
-                    get_mesi_state_name(INVALID),
-                    current_index->pseudo_LRU);
-
-        } else if (state == SHARED) {
+	    BusOperation(c, WRITE, entry->address, &snoop_result);
+            invalidate_cache_line(c, index, line_found); // Invalidate the line
+        } else if (state == SHARED || state == EXCLUSIVE) {
             // Transition SHARED/EXCLUSIVE -> INVALID
-            MessageToCache(INVALIDATELINE, entry->address); // Invalidate shared/exclusive copies
-            invalidate_cache_line(line); // Invalidate the line
-            
-	    if (Mode == 1) {
-                printf("Snooped RWIM: SHARED-> INVALID.\n\n");
-            }
-            fprintf(output_file,
-                    "  Snooped RWIM: SHARED-> INVALID.\n"
-                    "  Metadata: Valid=%d, Dirty=%d, MESI State=%s\n"
-                    "  Pseudo-LRU: 0x%X\n\n",
-                    line->metadata.valid, line->metadata.dirty,
-                    get_mesi_state_name(INVALID),
-                    current_index->pseudo_LRU);
-
-        } else if (state == EXCLUSIVE) {
-            // Transition SHARED/EXCLUSIVE -> INVALID
-            MessageToCache(INVALIDATELINE, entry->address); // Invalidate shared/exclusive copies
-            invalidate_cache_line(line); // Invalidate the line
-            
-	    if (Mode == 1) {
-                printf("Snooped RWIM: EXCLUSIVE -> INVALID.\n\n");
-            }
-            fprintf(output_file,
-                    "  Snooped RWIM: EXCLUSIVE -> INVALID.\n"
-                    "  Metadata: Valid=%d, Dirty=%d, MESI State=%s\n"
-                    "  Pseudo-LRU: 0x%X\n\n",
-                    line->metadata.valid, line->metadata.dirty,
-                    get_mesi_state_name(INVALID),
-                    current_index->pseudo_LRU);
-
-        } else if (state == INVALID) {
-            // Line already in INVALID state
-            if (Mode == 1) {
-                printf("Snooped RWIM: Line already in INVALID state. No action needed.\n\n");
-            }
-            fprintf(output_file,
-                    "  Snooped RWIM: Line already in INVALID state. No action needed.\n"
-                    "  Metadata: Valid=%d, Dirty=%d, MESI State=%s\n"
-                    "  Pseudo-LRU: 0x%X\n\n",
-                    line->metadata.valid, line->metadata.dirty,
-                    get_mesi_state_name(INVALID),
-                    current_index->pseudo_LRU);
+            MessageToCache(c, INVALIDATELINE, entry->address); // Invalidate shared/exclusive copies
+            invalidate_cache_line(c, index, line_found); // Invalidate the line
         }
+        // Line already in INVALID state: no action needed
+        log_snoop_outcome(c, entry, line_found, state, INVALID);
     } else {
         // Line not present in cache
-        if (Mode == 1) {
-            printf("Snooped RWIM: Line not present in cache. No action needed.\n\n");
-        }
-        fprintf(output_file,
-                "  Snooped RWIM: Line not present in cache. No action needed.\n\n");
+        log_snoop_outcome(c, entry, -1, INVALID, INVALID);
     }
+    return snoop_answer(state);
 }
 
-void handle_snooped_invalidate_command(TraceEntry *entry) {
+int handle_snooped_invalidate_command(Cache *c, TraceEntry *entry) {
     unsigned int index = entry->parsed_addr.index;
     unsigned int tag = entry->parsed_addr.tag;
 
-    CacheIndex *current_index = &cache[index];
+    refresh_set(c, index);
     int line_found = -1; // Index of the matching line, -1 if not found
+    MESIState state = INVALID; // State before the snoop, which decides our answer
 
-    // Log the snooped invalidate request in both modes
-    if (Mode == 1) {
-        printf("Snooped Invalidate Request: Address 0x%08X (Index: 0x%X, Tag: 0x%X)\n", 
-               entry->address, index, tag);
-    }
-    fprintf(output_file,
-            "Operation: Snooped invalidate command (code 6), Address: 0x%08X\n"
-            "  Decomposed Address: Byte Offset=0x%X, Index=0x%X, Tag=0x%X\n",
-            entry->address, entry->parsed_addr.byte_offset, index, tag);
+    // Log the snooped invalidate request
+    log_access_event(c, EV_SNOOP_REQUEST, entry, INVALID, INVALID);
 
     // Search for the matching cache line
-    int i;
-    for (i = 0; i < NUM_LINES_PER_INDEX; i++) {
-        if (current_index->lines[i].metadata.valid && current_index->lines[i].tag == tag) {
-            line_found = i;
-            break;
-        }
-    }
+    int empty_way;
+    line_found = find_way(c, index, tag, &empty_way);
 
     if (line_found != -1) {
         // Line is present in the cache
-        CacheLine *line = &current_index->lines[line_found];
-        MESIState state = line->metadata.state;
+        CacheLine line = load_line(c, index, line_found);
+        state = LINE_STATE(line);
 
         if (state == SHARED) {
             // SHARED -> INVALID: Invalidate the line
-            MessageToCache(INVALIDATELINE, entry->address);
-            invalidate_cache_line(line); // Properly invalidate the line and update PLRU
-            if (Mode == 1) {
-                printf("Snooped Invalidate: SHARED -> INVALID.\n\n");
-            }
-            fprintf(output_file,
-                    "  Snooped Invalidate: SHARED -> INVALID.\n"
-                    "  Metadata: Valid=%d, Dirty=%d, MESI State=%s\n"
-                    "  Pseudo-LRU: 0x%X\n\n",
-                    line->metadata.valid, line->metadata.dirty,
-                    get_mesi_state_name(INVALID),
-                    current_index->pseudo_LRU);
-
+            MessageToCache(c, INVALIDATELINE, entry->address);
+            invalidate_cache_line(c, index, line_found); // Properly invalidate the line and update PLRU
+            log_snoop_outcome(c, entry, line_found, state, INVALID);
         } else if (state == INVALID) {
             // INVALID: No action needed
-            if (Mode == 1) {
-                printf("Snooped Invalidate: Line already in INVALID state. No action needed.\n\n");
-            }
-            fprintf(output_file,
-                    "  Snooped Invalidate: Line already in INVALID state. No action needed.\n"
-                    "  Metadata: Valid=%d, Dirty=%d, MESI State=%s\n"
-                    "  Pseudo-LRU: 0x%X\n\n",
-                    line->metadata.valid, line->metadata.dirty,
-                    get_mesi_state_name(INVALID),
-                    current_index->pseudo_LRU);
-
-        } else if (state == MODIFIED || state == EXCLUSIVE) {
+            log_snoop_outcome(c, entry, line_found, state, INVALID);
+        } else {
             // Error: Invalid scenario for snooped invalidate in MODIFIED or EXCLUSIVE state
-            if (Mode == 1) {
-                printf("Error: Snooped Invalidate: Line in %s state (Invalid scenario).\n\n",
-                       get_mesi_state_name(state));
-            }
-            fprintf(output_file,
-                    "  Error: Invalid scenario. Line in %s state.\n"
-                    "  Metadata: Valid=%d, Dirty=%d, MESI State=%s\n"
-                    "  Pseudo-LRU: 0x%X\n\n",
-                    get_mesi_state_name(state),
-                    line->metadata.valid, line->metadata.dirty,
-                    get_mesi_state_name(line->metadata.state),
-                    current_index->pseudo_LRU);
+            log_snoop_outcome(c, entry, line_found, state, LINE_STATE(line));
         }
     } else {
         // Line not present in cache
-        if (Mode == 1) {
-            printf("Snooped Invalidate: Line not present in cache. No action needed.\n\n");
-        }
-        fprintf(output_file,
-                "  Snooped Invalidate: Line not present in cache. No action needed.\n\n");
+        log_snoop_outcome(c, entry, -1, INVALID, INVALID);
     }
+    return snoop_answer(state);
 }
 
-void handle_clear_cache_request() {
-    if (Mode == 1) {
-        printf("Clearing cache and resetting all states to initial values...\n");
+// Log a clear/print event that is not tied to a trace entry; `way` -1 means no line
+static void log_cache_event(const Cache *c, int type, unsigned int set, int way, unsigned int address) {
+    LogEvent ev = cache_event(c, type);
+    ev.set = set;
+    ev.way = (int8_t)way;
+    ev.address = address;
+    if (way >= 0) {
+        CacheLine line = load_line(c, set, way);
+        ev.tag = LINE_TAG(line);
+        ev.new_state = LINE_STATE(line);
+        ev.flags |= (LINE_IS_VALID(line) ? LOG_VALID : 0) | (LINE_IS_DIRTY(line) ? LOG_DIRTY : 0);
     }
+    log_event(&ev);
+}
 
-    fprintf(output_file, "Operation: Clear cache (code 8)\n");
+// Clear the cache in O(dirty lines): dirty lines are written back, then the
+// epoch moves on and every set is emptied lazily by refresh_set().
+// Tell the snoop filter `c` holds none of its lines any more, so a clear does
+// not leave entries behind that crowd out the lines other caches hold
+static void drop_snoop_filter_lines(const Cache *c) {
+    unsigned int words = (c->num_sets + 63) / 64;
+    unsigned int word, j;
+
+    for (word = 0; word < words; word++) {
+        uint64_t bits = c->occupied_sets[word];
+        while (bits) {
+            unsigned int i = word * 64 + (unsigned int)__builtin_ctzll(bits);
+            bits &= bits - 1;
+            for (j = 0; j < c->num_ways; j++) {
+                CacheLine line = load_line(c, i, (int)j);
+                if (LINE_IS_VALID(line)) {
+                    snoop_filter_drop(c->bus_id, line_address(c, LINE_TAG(line), i));
+                }
+            }
+        }
+    }
+}
 
-    // Iterate over all cache indexes and lines
-    int i, j;
-    for (i = 0; i < NUM_INDEXES; i++) {
-        for (j = 0; j < NUM_LINES_PER_INDEX; j++) {
-            // Check if the line is dirty
-            if (cache[i].lines[j].metadata.dirty) {
-                // Generate the 32-bit address: concatenate 12 bits for tag + 14 bits for index + 6 bits of 0s
-                unsigned int tag = cache[i].lines[j].tag;
-                unsigned int index = i;
-                unsigned int address = (tag << 20) | (index << 6); // Concatenate tag and index, 6 zero bits for block offset
+void handle_clear_cache_request(Cache *c) {
+    unsigned int words = (c->num_sets + 63) / 64;
+    unsigned int word;
+    int logging = LOG_ENABLED(LOG_TRANSACTIONS);
 
-                // Perform bus write operation for the dirty line
-                int snoop_result = NOHIT; 
-                BusOperation(WRITE, address, &snoop_result);
+    if (logging) {
+        log_cache_event(c, EV_CLEAR_BEGIN, 0, -1, 0);
+    }
 
-                // Log the write operation to output file
-                fprintf(output_file, "Bus Operation: Write address 0x%08X (from dirty cache line)\n", address);
-                if (Mode == 1) {
-                    printf("Bus Operation: Write address 0x%08X (from dirty cache line)\n", address);
-                }
+    // Visit only the dirty lines, in index and way order, and forget them
+    for (word = 0; word < words; word++) {
+        uint64_t bits = c->dirty_sets[word];
+        while (bits) {
+            unsigned int i = word * 64 + (unsigned int)__builtin_ctzll(bits);
+            WayMask ways = c->dirty_ways[i];
+            bits &= bits - 1;
+
+            if (!logging) {
+                c->stats.num_bus_writes += __builtin_popcount(ways);
+            }
+            while (!logging && timing_active && ways) {
+                // The same bus and memory time as the logged write-backs below
+                int j = __builtin_ctz(ways);
+                ways &= ways - 1;
+                timing_bus_operation(c, WRITE, line_address(c, LINE_TAG(load_line(c, i, j)), i), NOHIT);
             }
+            while (logging && ways) {
+                int j = __builtin_ctz(ways);
+                ways &= ways - 1;
 
-            // Clear the cache line after performing bus operations (if any)
-            cache[i].lines[j].tag = 0;                            // Clear the tag
-            cache[i].lines[j].metadata.valid = 0;                 // Mark as invalid
-            cache[i].lines[j].metadata.dirty = 0;                 // Clear the dirty bit
-            cache[i].lines[j].metadata.state = INVALID;           // Reset state to INVALID
-        }
+                // Generate the 32-bit address: tag + index + zero bits for the block offset
+                unsigned int address = line_address(c, LINE_TAG(load_line(c, i, j)), i);
+
+                // Perform bus write operation for the dirty line (the write-back only exists in the log)
+                int snoop_result = NOHIT;
+                BusOperation(c, WRITE, address, &snoop_result);
 
-        // Reset pseudo_LRU using the discussed approach
-        for (j = 0; j < NUM_LINES_PER_INDEX - 1; j++) {
-            cache[i].pseudo_LRU[j] = 0; // Clear all the bits in pseudo_LRU array
+                // Log the write operation
+                log_cache_event(c, EV_WRITEBACK, i, j, address);
+            }
+            c->dirty_ways[i] = 0;
         }
     }
 
-    if (Mode == 1) {
-        printf("Cache successfully cleared.\n\n");
+    if (snoop_filter_active) {
+        drop_snoop_filter_lines(c);
     }
 
-    fprintf(output_file, "Cache successfully cleared and reset to initial values.\n\n");
+    // Every set goes stale and none is occupied or dirty any more
+    memset(c->occupied_sets, 0, words * sizeof(uint64_t));
+    memset(c->dirty_sets, 0, words * sizeof(uint64_t));
+    c->epoch++;
+    if (c->epoch == 0) {
+        // The stamps would be ambiguous after wrapping; empty everything for real
+        memset(c->lines, 0, (size_t)c->num_sets * c->num_ways * line_bytes(c));
+        memset(c->pseudo_LRU, 0, c->num_sets * sizeof(PlruTree));
+        if (c->repl_state) {
+            memset(c->repl_state, initial_repl_state(c), (size_t)c->num_sets * c->num_ways);
+        }
+        memset(c->set_epoch, 0, c->num_sets * sizeof(uint32_t));
+    }
+    if (c->miss_classifier) {
+        classifier_clear(c);
+    }
+
+    if (logging) {
+        log_cache_event(c, EV_CLEAR_END, 0, -1, 0);
+    }
 }
 
 
-void handle_print_cache_state_request() {
-    printf("Cache Contents and States:\n");
-    fprintf(output_file, "Operation: Print cache state (code 9)\n");
+// Print the valid lines of every occupied set. The occupancy bitmap only holds
+// sets filled since the last clear, so empty and stale sets are never visited.
+void handle_print_cache_state_request(Cache *c) {
+    unsigned int words = (c->num_sets + 63) / 64;
+    unsigned int word;
 
-    int i;
-    for (i = 0; i < NUM_INDEXES; i++) {
-        int has_valid_lines = 0;
-
-        // Check if there are any valid lines in the current index
-        int j;
-        for (j = 0; j < NUM_LINES_PER_INDEX; j++) {
-            if (cache[i].lines[j].metadata.valid) {
-                has_valid_lines = 1;
-                break;
-            }
-        }
-
-        if (!has_valid_lines) {
-            continue; // Skip this index if no valid lines are present
-        }
+    if (!LOG_ENABLED(LOG_STATS)) {
+        return; // Nothing to print to
+    }
+    log_cache_event(c, EV_PRINT_BEGIN, 0, -1, 0);
 
-        printf("Index %d:\n", i);
-        fprintf(output_file, "Index %d:\n", i);
+    for (word = 0; word < words; word++) {
+        uint64_t bits = c->occupied_sets[word];
+        while (bits) {
+            unsigned int i = word * 64 + (unsigned int)__builtin_ctzll(bits);
+            unsigned int j;
+            bits &= bits - 1;
 
-        for (j = 0; j < NUM_LINES_PER_INDEX; j++) {
-            CacheLine *line = &cache[i].lines[j];
-            if (line->metadata.valid) {
-                printf("  Line %d: Tag=0x%X, State=%s, Dirty=%d\n",
-                       j, line->tag, get_mesi_state_name(line->metadata.state), line->metadata.dirty);
+            log_cache_event(c, EV_PRINT_SET, i, -1, 0);
 
-                fprintf(output_file,
-                        "  Line %d: Tag=0x%X, State=%s, Dirty=%d\n",
-                        j, line->tag, get_mesi_state_name(line->metadata.state), line->metadata.dirty);
+            for (j = 0; j < c->num_ways; j++) {
+                if (LINE_IS_VALID(load_line(c, i, (int)j))) {
+                    log_cache_event(c, EV_PRINT_LINE, i, (int)j, 0);
+                }
             }
         }
     }
 
-    printf("Cache state printed successfully.\n\n");
-    fprintf(output_file, "Cache state printed successfully.\n\n");
+    log_cache_event(c, EV_PRINT_END, 0, -1, 0);
 }
-
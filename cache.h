@@ -1,9 +1,17 @@
 #ifndef CACHE_H
 #define CACHE_H
 
+// Default cache geometry; sets=, ways= and linesize= change it at run time
 #define NUM_INDEXES 16384
 #define NUM_LINES_PER_INDEX 16
+#define LINE_SIZE 64
+// Widest set the way masks and PLRU tree can describe
+#define MAX_LINES_PER_INDEX 32
+// Most caches caches= can put on the snooping bus (cpu= numbers them from 0)
+#define MAX_CACHES 64
 #include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
 #include <sys/stat.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -23,14 +31,11 @@
 #define SENDLINE 2     /* Send requested cache line to L1 */
 #define INVALIDATELINE 3 /* Invalidate a line in L1 */
 #define EVICTLINE 4    /* Evict a line from L1 */
-// Declare global variables for cache statistics
-extern num_cache_reads;
-extern num_cache_writes;
-extern num_cache_hits;
-extern num_cache_misses;
-
 extern FILE *output_file;
 extern int Mode;
+extern int parser_threads;
+extern int shard_threads;
+extern int log_level;
 // MESI states (Invalid, Modified, Exclusive, Shared)
 typedef enum {
     INVALID,
@@ -39,39 +44,443 @@ typedef enum {
     SHARED
 } MESIState;
 
-// Cache metadata (valid, dirty, MESI state)
+// Cache metadata (dirty, MESI state) of a trace entry
 typedef struct {
-    int valid;       // Valid bit (0 or 1)
     int dirty;       // Dirty bit (0 or 1)
     MESIState state; // MESI state (INVALID, MODIFIED, EXCLUSIVE, SHARED)
 } CacheMetadata;
 
-// Cache line structure (holds tag and metadata)
+// One bit per way of a set
+typedef uint32_t WayMask;
+#define WAY_BIT(way) ((WayMask)1 << (way))
+
+// A cache line packed into one word: the tag in the low bits, the dirty bit
+// above it and the MESI state in the top two bits. A line is valid exactly
+// when its state is not INVALID, so there is no separate valid bit.
+typedef uint32_t CacheLine;
+#define LINE_TAG_BITS 29
+#define LINE_TAG_MASK ((1u << LINE_TAG_BITS) - 1)
+#define LINE_DIRTY (1u << LINE_TAG_BITS)
+#define LINE_STATE_SHIFT 30
+#define LINE_STATE_MASK (3u << LINE_STATE_SHIFT)
+
+// A cache whose tags fit NARROW_TAG_BITS stores its lines in 16 bits with the
+// same layout squeezed down: tag in bits 0-12, dirty bit 13, state in 14-15.
+// initialize_cache() picks the width from the geometry.
+typedef uint16_t NarrowLine;
+#define NARROW_TAG_BITS 13
+#define NARROW_TAG_MASK ((1u << NARROW_TAG_BITS) - 1)
+#define NARROW_STATE_MASK 0xC000u
+#define NARROW_LINE(line) ((NarrowLine)(((line) & NARROW_TAG_MASK) | (((line) >> 16) & 0xE000u)))
+#define WIDE_LINE(narrow) ((CacheLine)(((narrow) & NARROW_TAG_MASK) | (((uint32_t)(narrow) & 0xE000u) << 16)))
+
+#define MAKE_LINE(tag, state, dirty) \
+    ((CacheLine)((tag) | ((dirty) ? LINE_DIRTY : 0) | ((unsigned int)(state) << LINE_STATE_SHIFT)))
+#define LINE_TAG(line) ((unsigned int)(line) & LINE_TAG_MASK)
+#define LINE_STATE(line) ((MESIState)((unsigned int)(line) >> LINE_STATE_SHIFT))
+#define LINE_IS_DIRTY(line) (((line) & LINE_DIRTY) != 0)
+#define LINE_IS_VALID(line) (((line) & LINE_STATE_MASK) != 0)
+
+// Pseudo-LRU tree packed into one word: bit i is tree node i in heap order
+// (node 0 is the root, the children of node n are 2n+1 and 2n+2)
+typedef uint32_t PlruTree;
+
+// Lookup/replacement code picked once by initialize_cache(). The common
+// associativities get kernels with the way count fixed at compile time.
+typedef enum {
+    KERNEL_GENERIC,   // Any supported associativity
+    KERNEL_4WAY,
+    KERNEL_8WAY,
+    KERNEL_16WAY,
+    KERNEL_32WAY
+} CacheKernel;
+
+// Replacement policies, chosen with policy= (or per sweep configuration)
+typedef enum {
+    POLICY_PLRU,      // Tree pseudo-LRU (the default)
+    POLICY_LRU,       // True LRU
+    POLICY_SRRIP,     // Static re-reference interval prediction
+    POLICY_DRRIP,     // Dynamic RRIP: set dueling between SRRIP and bimodal RRIP insertion
+    POLICY_RANDOM
+} ReplacementPolicy;
+
+// Where a filled line enters the replacement order, from insert=
+typedef enum {
+    INSERT_DEFAULT,   // The policy's own choice: MRU, or RRPV_MAX - 1 and DRRIP's dueling for RRIP
+    INSERT_MRU,
+    INSERT_LRU,       // Next in line for eviction
+    INSERT_BIP        // Bimodal: MRU once in BIP_MRU_ODDS fills, LRU otherwise
+} InsertionPolicy;
+
+#define BIP_MRU_ODDS 32
+
+// What the reuse predictor (bypass=) keys its counters by
+typedef enum {
+    REUSE_OFF,
+    REUSE_PC,         // The pc= of the access, or its region if the trace gives none
+    REUSE_REGION      // The REUSE_REGION_BITS-aligned region of memory the line is in
+} ReuseSignature;
+
+// Reuse predictor: 2-bit counters, one per signature; a saturated counter
+// predicts a line dead on arrival
+#define REUSE_SIGNATURE_BITS 12
+#define REUSE_COUNTER_DEAD 3
+#define REUSE_REGION_BITS 12
+// Bypassed lines remembered to catch a wrong bypass (direct mapped, power of 2)
+#define BYPASS_HISTORY_ENTRIES 4096
+// Per-line predictor metadata: the signature, and whether the line was reused
+// and whether it had been predicted dead
+#define LINE_REUSED 0x8000
+#define LINE_PREDICTED_DEAD 0x4000
+
+// Hardware prefetchers in front of the cache, from prefetch=
+typedef enum {
+    PREFETCH_OFF,
+    PREFETCH_NEXT_LINE,   // The lines after each demand miss
+    PREFETCH_STRIDE,      // A stride learned per region from the demand accesses to it
+    PREFETCH_STREAM       // Runs ahead of ascending or descending streams of misses
+} PrefetcherKind;
+
+// Lines each trigger may prefetch, unless prefetchdegree= says otherwise
+#define PREFETCH_DEGREE 2
+// Prefetches stay within the aligned region of this many address bits (a 4 KB page)
+#define PREFETCH_REGION_BITS 12
+// Stride table entries, one region each (direct mapped, power of 2)
+#define PREFETCH_STRIDE_ENTRIES 256
+// Repeats of a stride before it is prefetched
+#define PREFETCH_STRIDE_CONFIDENCE 2
+// Streams tracked at once, how near a miss must fall to a stream to join it,
+// and how far ahead of the demand accesses a stream may prefetch (in lines)
+#define PREFETCH_STREAMS 16
+#define PREFETCH_STREAM_WINDOW 16
+#define PREFETCH_STREAM_DISTANCE 16
+// Demand reads and fetches a prefetch takes to arrive; a hit on it sooner is late
+#define PREFETCH_LATENCY 16
+// Lines evicted by prefetches remembered to catch pollution (direct mapped, power of 2)
+#define PREFETCH_VICTIM_ENTRIES 4096
+
+// Classes of demand misses (classify=)
+typedef enum {
+    MISS_COMPULSORY,  // First access to the line
+    MISS_CAPACITY,    // A fully associative LRU cache of the same size misses too
+    MISS_CONFLICT,    // ... but it would have hit
+    MISS_COHERENCE,   // First miss on a line a snoop invalidated
+    MISS_CLASSES
+} MissClass;
+
+// Timing model defaults, in cycles; hitlatency=, memlatency=, busarbitration=,
+// busread=, buswrite=, businvalidate=, busrwim=, writeback= and snoopdelay= change them
+#define TIMING_HIT_LATENCY 20
+#define TIMING_MEMORY_LATENCY 100
+#define TIMING_BUS_ARBITRATION 2
+#define TIMING_BUS_READ 8
+#define TIMING_BUS_WRITE 8
+#define TIMING_BUS_INVALIDATE 1
+#define TIMING_BUS_RWIM 8
+#define TIMING_WRITEBACK 0
+#define TIMING_SNOOP_DELAY 4
+// Miss status holding registers per cache (mshrs=); 0 keeps the cache blocking
+#define TIMING_MSHRS 0
+// Cycles between the demand accesses of a non-blocking cache (issueinterval=)
+#define TIMING_ISSUE_INTERVAL 1
+// Stretches of bus activity the timing model remembers; an operation ready
+// before the oldest of them is granted no earlier than its end
+#define TIMING_BUS_INTERVALS 4096
+
+// DRAM backend defaults (memory=dram); channels=, banks=, rowsize=,
+// pagepolicy=, tcas=, trcd=, trp= and tburst= change them. Times are in cycles.
+#define DRAM_CHANNELS 2
+#define DRAM_BANKS 8
+#define DRAM_ROW_SIZE 8192
+#define DRAM_OPEN_PAGE 1
+#define DRAM_TCAS 42
+#define DRAM_TRCD 42
+#define DRAM_TRP 42
+#define DRAM_TBURST 8
+
+// Re-reference prediction values are 2 bits: 0 is imminent, RRPV_MAX distant
+#define RRPV_MAX 3
+// DRRIP policy selector: a 10-bit counter, BRRIP above the midpoint
+#define DRRIP_PSEL_MAX 1023
+// BRRIP inserts at RRPV_MAX - 1 once in this many fills, at RRPV_MAX otherwise
+#define BRRIP_LONG_ODDS 32
+
+// Access and bus counters of a cache
 typedef struct {
-    unsigned int tag;          // 12-bit tag
-    CacheMetadata metadata;    // Metadata for cache line
-} CacheLine;
+    uint64_t num_cache_reads;
+    uint64_t num_cache_writes;
+    uint64_t num_cache_hits;
+    uint64_t num_cache_misses;
+    uint64_t num_bus_reads;          // Bus operations this cache issued
+    uint64_t num_bus_writes;
+    uint64_t num_bus_invalidates;
+    uint64_t num_bus_rwims;
+    uint64_t num_snoop_hits;         // Its bus requests that peers answered HIT
+    uint64_t num_snoop_hitms;        // ... and HITM
+    uint64_t num_bypasses;           // Read misses predicted dead and not allocated
+    uint64_t num_bypass_rereferences; // ... that missed again while still in the bypass history
+    uint64_t num_reuse_correct;      // Predictions resolved right (reuse seen or line died as predicted)
+    uint64_t num_reuse_wrong;
+    uint64_t num_reuse_no_pc;        // Misses bypass=pc predicted by region for want of a pc=
+    uint64_t num_prefetches;         // Lines the prefetcher filled
+    uint64_t num_prefetch_hits;      // Prefetches dropped because the line was already here
+    uint64_t num_prefetch_useful;    // Prefetched lines a demand access used
+    uint64_t num_prefetch_late;      // ... before the prefetch could have arrived
+    uint64_t num_prefetch_unused;    // Prefetched lines evicted or invalidated unused
+    uint64_t num_prefetch_polluting; // Demand misses on lines a prefetch had evicted
+    uint64_t num_class_misses[MISS_CLASSES]; // Demand misses by MissClass (classify=on)
+} CacheStats;
 
-// Cache index structure (holds multiple cache lines)
+typedef struct Prefetcher Prefetcher;
+typedef struct MissClassifier MissClassifier;
+typedef struct MshrFile MshrFile;
+
+// A modeled cache: its geometry, the shifts and masks derived from it, and
+// the line and replacement storage. Lines are stored one set after another.
 typedef struct {
-    CacheLine lines[NUM_LINES_PER_INDEX]; // Multiple cache lines per index
-    unsigned char pseudo_LRU[NUM_LINES_PER_INDEX-1];            // 15-bit pseudo-LRU bits for the index
-} CacheIndex;
+    unsigned int num_sets;          // Sets (power of 2)
+    unsigned int num_ways;          // Lines per set (power of 2, up to MAX_LINES_PER_INDEX)
+    unsigned int line_size;         // Bytes per line (power of 2)
+    unsigned int way_bits;          // log2(num_ways); also the PLRU tree depth
+    unsigned int offset_bits;       // Byte offset width, where the index starts
+    unsigned int tag_shift;         // Byte offset plus index width, where the tag starts
+    unsigned int offset_mask;
+    unsigned int index_mask;
+    unsigned int tag_mask;
+    CacheKernel kernel;
+    ReplacementPolicy policy;
+    int bus_id;                     // Index in bus_caches[] when peers answer snoops,
+                                    // -1 when snoop results are simulated from the address
+    int wide_lines;                 // Lines are CacheLines; 0: NarrowLines (tags of NARROW_TAG_BITS or less)
+    void *lines;                    // num_sets * num_ways packed lines
+    PlruTree *pseudo_LRU;           // One PLRU tree per set
+    uint8_t *repl_state;            // Every other policy: per way, the LRU age or the RRPV
+    uint32_t rng;                   // Random victims and BRRIP insertions
+    int psel;                       // DRRIP set-dueling counter
+    InsertionPolicy insertion;
+    // Reuse predictor and bypass (bypass=); the tables are NULL when it is off
+    ReuseSignature reuse_signature;
+    uint8_t *reuse_counters;        // 1 << REUSE_SIGNATURE_BITS saturating counters
+    uint16_t *line_reuse;           // Per line: signature | LINE_REUSED | LINE_PREDICTED_DEAD
+    uint32_t *bypass_history;       // Line number + 1 of recent bypasses, 0 if empty
+    // Prefetcher (prefetch=); the tables are NULL when it is off
+    PrefetcherKind prefetch_kind;
+    unsigned int prefetch_degree;
+    Prefetcher *prefetcher;         // Stride table or stream trackers
+    WayMask *prefetched_ways;       // Per set, the ways prefetched and not yet used
+    uint32_t *prefetch_issued;      // Per line, prefetch_clock when it was prefetched
+    uint32_t *prefetch_victims;     // Line number + 1 of lines recent prefetches evicted, 0 if empty
+    uint32_t prefetch_clock;        // Demand reads and fetches so far, timing the prefetches
+    MissClassifier *miss_classifier; // Shadow cache and seen lines (classify=on), NULL when off
+    uint64_t clock;                 // Cycle the cache's next demand access issues (timing=on)
+    MshrFile *mshr_file;            // Outstanding misses (mshrs=), NULL for a blocking cache
+    // Lazy clear: a clear bumps `epoch`, and a set whose stamp is older is
+    // emptied the next time it is touched (see refresh_set())
+    uint32_t epoch;
+    uint32_t *set_epoch;            // Epoch each set was last emptied in
+    // Occupancy and dirty summaries, kept in step with every fill, write and
+    // invalidate so a print or clear only visits the lines it reports
+    uint64_t *occupied_sets;        // Bit per set holding at least one valid line
+    uint64_t *dirty_sets;           // Bit per set with a nonzero dirty_ways mask
+    WayMask *dirty_ways;            // Per set, the ways holding dirty lines
+    // For each way, the tree nodes on its root-to-leaf path and the values an
+    // access to that way writes into them
+    PlruTree plru_path_mask[MAX_LINES_PER_INDEX];
+    PlruTree plru_path_bits[MAX_LINES_PER_INDEX];
+    CacheStats stats;
+} Cache;
 
 // Decompose address into its components
 typedef struct {
-    unsigned int byte_offset;  // 6-bit byte offset
-    unsigned int index;        // 14-bit index
-    unsigned int tag;          // 12-bit tag
+    unsigned int byte_offset;  // Byte offset (6 bits by default)
+    unsigned int index;        // Set index (14 bits by default)
+    unsigned int tag;          // Tag (12 bits by default)
 } CacheAddress;
 
 typedef struct {
     int operation_code;       // Operation code from the trace file
     unsigned int address;     // Original 32-bit address
     CacheAddress parsed_addr; // Decomposed address fields
-    CacheMetadata metadata;   // Metadata for cache entry (valid, dirty, MESI state)
+    CacheMetadata metadata;   // Metadata for cache entry (dirty, MESI state)
+    unsigned int cpu;         // Cache on the bus the record is issued to
+    unsigned int pc;          // Instruction address from pc=, 0 if the trace has none
+    uint64_t time;            // Cycle from t= before which the access cannot issue, 0 if none
 } TraceEntry;
 
+// Optional name=value fields that may follow the address on a text trace line
+typedef struct {
+    unsigned int cpu;         // cpu=N (default 0)
+    unsigned int pc;          // pc=X (default 0)
+    uint64_t time;            // t=N (default 0)
+} TraceExtras;
+
+// Counters of the snoop filter
+typedef struct {
+    uint64_t lookups;               // Bus requests checked against the filter
+    uint64_t hits;                  // ... that found the line tracked
+    uint64_t snoops_sent;           // Snoops delivered to peers
+    uint64_t snoops_filtered;       // Snoops a broadcast would have sent but the filter did not
+    uint64_t stale_snoops;          // Snoops sent to a peer that no longer held the line
+    uint64_t back_invalidations;    // Entries evicted while peers still held the line
+    uint64_t back_invalidated_lines; // Cache lines those evictions invalidated
+    uint64_t occupancy;             // Entries tracking a line now
+    uint64_t peak_occupancy;
+    uint64_t capacity;
+} SnoopFilterStats;
+
+// Latencies of the timing model, in cycles
+typedef struct {
+    unsigned int hit_latency;       // Lookup, paid by every demand access
+    unsigned int memory_latency;    // Data from memory after a bus read or RWIM no peer answered HITM,
+                                    // unless the DRAM backend times it
+    unsigned int bus_arbitration;   // Winning the bus, before every bus operation
+    unsigned int bus_occupancy[5];  // Cycles each bus operation holds the bus, by READ .. RWIM
+    unsigned int writeback;         // Extra wait for an access that writes a victim back
+    unsigned int snoop_delay;       // Collecting the snoop responses to a read, RWIM or invalidate
+    unsigned int mshrs;             // Outstanding misses per cache; 0 blocks on every access
+    unsigned int issue_interval;    // Cycles between the accesses of a non-blocking cache
+} TimingConfig;
+
+// What the timing model measured
+typedef struct {
+    uint64_t accesses[3];           // Demand accesses timed, by operation (read, write, fetch)
+    uint64_t access_cycles[3];      // ... and their total latency
+    uint64_t bus_operations[5];     // Bus operations, by READ .. RWIM
+    uint64_t bus_queue_cycles[5];   // ... and the cycles they waited for the bus
+    uint64_t bus_busy_cycles;       // Cycles the bus was held
+    uint64_t elapsed;               // Cycle the last access or bus operation finished
+    // Non-blocking caches (mshrs=)
+    uint64_t mshr_misses;           // Misses that took an MSHR
+    uint64_t mshr_merges;           // Secondary misses merged into an outstanding one
+    uint64_t mshr_full_stalls;      // Misses that found every MSHR taken
+    uint64_t mshr_stall_cycles;     // ... and the cycles they waited for one
+    uint64_t mshr_occupancy_cycles; // Outstanding misses summed over every cycle
+    uint64_t mshr_busy_cycles;      // Cycles with at least one miss outstanding
+    uint64_t mshr_peak;             // Most misses one cache had outstanding
+} TimingStats;
+
+// Geometry and timing of the DRAM backend
+typedef struct {
+    unsigned int channels;          // Power of 2
+    unsigned int banks;             // Per channel, power of 2
+    unsigned int row_size;          // Bytes per row buffer, power of 2
+    int open_page;                  // 1: rows stay open after an access; 0: closed page
+    unsigned int tcas;              // Column access
+    unsigned int trcd;              // Row activation
+    unsigned int trp;               // Precharge
+    unsigned int tburst;            // Data transfer on the channel
+} DramConfig;
+
+// Counters of the DRAM backend
+typedef struct {
+    uint64_t reads;                 // Bus reads and RWIMs memory answered
+    uint64_t writes;                // Write-backs
+    uint64_t read_cycles;           // Total latency of the reads
+    uint64_t row_hits;              // Accesses to the row already open
+    uint64_t row_empty;             // Accesses to a bank with no row open
+    uint64_t row_conflicts;         // Accesses that had to close another row first
+    uint64_t bank_busy;             // Accesses that waited for their bank
+    uint64_t bank_wait_cycles;
+} DramStats;
+
+// Binary trace format: a TraceBinHeader followed by fixed-width TraceBinRecords
+#define TRACE_BIN_MAGIC "LLCTRACE"
+#define TRACE_BIN_VERSION 1
+#define TRACE_BIN_BYTE_ORDER 0x01020304u
+#define TRACE_BIN_DELTA 0x1u   /* Addresses are deltas from the previous record */
+
+typedef struct {
+    char magic[8];          // TRACE_BIN_MAGIC (not NUL terminated)
+    uint16_t version;       // TRACE_BIN_VERSION
+    uint16_t record_size;   // sizeof(TraceBinRecord)
+    uint32_t flags;         // TRACE_BIN_* flags
+    uint32_t byte_order;    // TRACE_BIN_BYTE_ORDER as written by the host
+    uint32_t reserved;
+} TraceBinHeader;
+
+typedef struct {
+    uint32_t address;       // Address, or delta from the previous address (TRACE_BIN_DELTA)
+    uint8_t operation_code; // Trace operation code (0-9)
+    uint8_t cpu;            // Cache on the bus the record is issued to
+    uint8_t reserved[2];
+} TraceBinRecord;
+
+// Event log: every message the handlers used to print is a fixed-size LogEvent.
+// Events are rendered to simulation_output.txt as before, or appended to a
+// binary event log by a writer thread and rendered later by "decode".
+#define LOG_FILE_MAGIC "LLCEVLOG"
+#define LOG_FILE_VERSION 1
+#define LOG_RING_SIZE (1 << 16)   /* Events buffered for the writer thread (power of 2) */
+
+// LogEvent.flags
+#define LOG_VALID 0x1
+#define LOG_DIRTY 0x2
+#define LOG_METADATA 0x4  /* Snoop outcome carries the line metadata and PLRU dump */
+#define LOG_CACHE_ID 0x8  /* Event of one of several caches on the bus (see cache_id) */
+
+// Logging tiers; each tier includes everything below it
+#define LOG_OFF 0           /* No log output (errors still go to stderr) */
+#define LOG_STATS 1         /* Banners, trace errors, statistics and cache dumps */
+#define LOG_TRANSACTIONS 2  /* Hits, misses, bus operations, snoops and L1 messages */
+#define LOG_FULL 3          /* PLRU updates and line metadata as well */
+
+// Highest tier compiled in. Build with e.g. -DLLC_LOG_MAX=LOG_STATS and every
+// LOG_ENABLED() test above that tier folds to 0, taking the logging code with it.
+#ifndef LLC_LOG_MAX
+#define LLC_LOG_MAX LOG_FULL
+#endif
+#define LOG_ENABLED(tier) ((tier) <= LLC_LOG_MAX && (tier) <= log_level)
+
+typedef enum {
+    EV_TEXT,            // Free-form text; aux bytes of text follow in payload records
+    EV_CACHE_HIT,       // Hit on a line in old_state
+    EV_WRITE_HIT,       // Line state after a write hit
+    EV_MISS_EMPTY,      // Miss with an invalid way available
+    EV_MISS_COLLISION,  // Miss that needs a victim
+    EV_FILL,            // State of a newly filled line
+    EV_PLRU_UPDATE,     // PLRU bits after touching `way` (aux = associativity)
+    EV_BUS_OPERATION,   // Bus operation bus_op on address
+    EV_SNOOP_RESULT,    // Snoop result reported for address
+    EV_L1_MESSAGE,      // L2 to L1 message (bus_op holds the message)
+    EV_SNOOP_REQUEST,   // Snooped request received (aux = byte offset)
+    EV_SNOOP_OUTCOME,   // What a snooped request did to the line (way -1: not present)
+    EV_CLEAR_BEGIN,
+    EV_WRITEBACK,       // Dirty line written back by a clear
+    EV_CLEAR_END,
+    EV_PRINT_BEGIN,
+    EV_PRINT_SET,
+    EV_PRINT_LINE,
+    EV_PRINT_END,
+    EV_BYPASS,          // Read miss predicted dead, served without allocating
+    EV_PREFETCH         // Line filled by the prefetcher
+} LogEventType;
+
+typedef struct {
+    uint8_t type;           // LogEventType
+    uint8_t operation;      // Trace operation code being handled
+    uint8_t bus_op;         // Bus operation or L2 to L1 message
+    uint8_t snoop_result;   // HIT, HITM or NOHIT
+    uint8_t old_state;      // MESI state before the event
+    uint8_t new_state;      // MESI state after the event
+    int8_t way;             // Way within the set, -1 if none
+    uint8_t flags;          // LOG_VALID, LOG_DIRTY, ...
+    uint32_t address;
+    uint32_t set;
+    uint32_t tag;
+    uint32_t plru;          // Pseudo-LRU bits, bit i is tree node i
+    uint32_t aux;           // Event specific
+    uint16_t cache_id;      // Cache on the bus that logged the event (with LOG_CACHE_ID)
+    uint16_t reserved;
+} LogEvent;
+
+typedef struct {
+    char magic[8];          // LOG_FILE_MAGIC (not NUL terminated)
+    uint16_t version;       // LOG_FILE_VERSION
+    uint16_t record_size;   // sizeof(LogEvent)
+    uint32_t ways;          // Associativity of the logged cache
+    uint32_t reserved[2];
+} LogFileHeader;
+
 // Bus message types
 typedef enum {
     BUS_READ,
@@ -80,30 +489,144 @@ typedef enum {
 } BusMessageType;
 
 
+// scan_trace_fields() result for blank or whitespace-only lines
+#define TRACE_LINE_EMPTY -1
+// Passes per reader in benchmark_trace_readers() (best time is reported)
+#define TRACE_BENCH_ROUNDS 3
+// Bytes of text handed to a parser thread at a time (rounded up to a line end)
+#define TRACE_CHUNK_SIZE (1 << 20)
+// Parsed chunks each parser thread may run ahead of the simulation
+#define TRACE_CHUNKS_PER_THREAD 2
+// Read size when streaming a trace from stdin or a pipe
+#define TRACE_STREAM_BUFFER_SIZE (4 << 20)
+// Entries each simulation shard can have queued (power of 2)
+#define SHARD_QUEUE_SIZE (1 << 14)
+// Entries queued before the shard's worker is told about them
+#define SHARD_BATCH 64
+// Sets are dealt to shards in blocks of this many, so no two shards share a
+// word of the occupancy and dirty bitmaps
+#define SHARD_SET_BLOCK 64
+// Trace records per batch handed to the sweep threads
+#define SWEEP_BATCH_SIZE (1 << 16)
+// Batches the reader may fill ahead of the slowest sweep thread
+#define SWEEP_BATCHES 4
+// Largest associativity the stack-distance analysis reports by default, and at most
+#define STACK_DISTANCE_DEPTH 64
+#define STACK_DISTANCE_MAX_DEPTH 4096
+// Demand accesses per interval of the time series (intervals=), unless interval= says otherwise
+#define INTERVAL_ACCESSES 100000
+// Associativity of the snoop filter (snoopfilter=<entries>)
+#define SNOOP_FILTER_WAYS 16
+
 // Function prototypes
+int scan_trace_fields(const char *p, const char *end, int *operation_code, unsigned int *address,
+                      TraceExtras *extras);
 int parse_trace_line(const char *line, TraceEntry *entry);
+void report_trace_line_error(int items_parsed, const char *line, size_t length);
+void report_trace_parse_failure(uint64_t line_number, const char *line, size_t length);
+int process_trace_buffer_parallel(const char *data, size_t size, int threads, uint64_t *line_number);
 void read_trace_file(const char *filename);
+void benchmark_trace_readers(const char *filename);
+void process_binary_trace_buffer(const unsigned char *data, size_t size, const char *filename);
+void process_binary_trace_stream(int fd, char *buffer, size_t filled, size_t capacity);
+ssize_t read_trace_chunk(int fd, char *buffer, size_t size);
+int convert_trace_file(const char *text_filename, const char *binary_filename, int delta);
+void log_event(const LogEvent *ev);
+void log_text(const char *format, ...);
+void render_event(FILE *out, const LogEvent *ev, int console);
+int open_event_log(const char *filename);
+void close_event_log();
+int decode_event_log(const char *log_filename, const char *text_filename);
 const char *get_operation_name(int code);
 const char *get_mesi_state_name(MESIState state);
 void print_summary();
+void print_cache_statistics();
 CacheAddress decompose_address(unsigned int address);
+CacheAddress decompose_cache_address(const Cache *c, unsigned int address);
 CacheMetadata initialize_cache_metadata();
-void initialize_cache();
-extern CacheIndex cache[NUM_INDEXES];
-void BusOperation(int BusOp, unsigned int Address, int *SnoopResult);
+int initialize_cache(Cache *c, unsigned int sets, unsigned int ways, unsigned int line_size,
+                     ReplacementPolicy policy);
+int parse_replacement_policy(const char *name);
+int parse_insertion_policy(const char *name);
+int initialize_reuse_predictor(Cache *c, ReuseSignature signature);
+int parse_prefetcher(const char *name);
+const char *prefetcher_name(PrefetcherKind kind);
+int initialize_prefetcher(Cache *c, PrefetcherKind kind, unsigned int degree);
+void train_prefetcher(Cache *c, const TraceEntry *entry, int triggered);
+int prefetch_line(Cache *c, unsigned int Address, const TraceEntry *trigger);
+int cache_holds_line(Cache *c, const TraceEntry *entry);
+int initialize_miss_classifier(Cache *c);
+void free_miss_classifier(Cache *c);
+void classify_access(Cache *c, const TraceEntry *entry, int hit);
+void classifier_invalidate(Cache *c, unsigned int Address);
+void classifier_clear(Cache *c);
+const char *miss_class_name(MissClass kind);
+unsigned int conflict_miss_sets(const Cache *c, uint64_t *worst);
+int write_miss_class_csv(const char *csv_filename);
+const char *replacement_policy_name(ReplacementPolicy policy);
+void free_cache(Cache *c);
+int initialize_bus(int count);
+void free_bus();
+void add_cache_stats(CacheStats *total, const CacheStats *stats);
+extern Cache cache;
+extern Cache *bus_caches[MAX_CACHES];
+extern int num_caches;
+void BusOperation(Cache *c, int BusOp, unsigned int Address, int *SnoopResult);
 int GetSnoopResult(unsigned int Address);
-void PutSnoopResult(unsigned int Address, int SnoopResult);
-void MessageToCache(int Message, unsigned int Address);
-void handle_read_operation(TraceEntry *entry);
-void handle_write_operation(TraceEntry *entry);
-void handle_instruction_cache_read(TraceEntry *entry);
-void handle_snooped_read_request(TraceEntry *entry);
-void handle_snooped_write_request(TraceEntry *entry);
-void handle_snooped_rwim_request(TraceEntry *entry);
-void handle_snooped_invalidate_command(TraceEntry *entry);
-void handle_clear_cache_request();
-void handle_print_cache_state_request();
+void PutSnoopResult(const Cache *c, unsigned int Address, int SnoopResult);
+void MessageToCache(const Cache *c, int Message, unsigned int Address);
+void handle_read_operation(Cache *c, TraceEntry *entry);
+void handle_write_operation(Cache *c, TraceEntry *entry);
+void handle_instruction_cache_read(Cache *c, TraceEntry *entry);
+int handle_snooped_read_request(Cache *c, TraceEntry *entry);
+int handle_snooped_write_request(Cache *c, TraceEntry *entry);
+int handle_snooped_rwim_request(Cache *c, TraceEntry *entry);
+int handle_snooped_invalidate_command(Cache *c, TraceEntry *entry);
+void handle_clear_cache_request(Cache *c);
+void handle_print_cache_state_request(Cache *c);
 void handle_trace_entry(TraceEntry *entry);
+void dispatch_trace_entry(Cache *c, TraceEntry *entry);
+int start_shard_engine(int shards);
+void stop_shard_engine();
+void shard_trace_entry(TraceEntry *entry);
+extern int shard_engine_active;
+int run_sweep(const char *trace_filename, const char *csv_filename, char **specs, int spec_count,
+              ReplacementPolicy policy, int thread_count);
+void sweep_trace_entry(const TraceEntry *entry);
+extern int sweep_active;
+int run_stack_distance(const char *trace_filename, const char *csv_filename,
+                       unsigned int sets, unsigned int line_size, unsigned int depth);
+void stack_distance_entry(const TraceEntry *entry);
+extern int stack_distance_active;
+int snoop_cache(Cache *c, int BusOp, unsigned int Address);
+int recall_line(Cache *c, unsigned int Address);
+int initialize_snoop_filter(unsigned int entries, unsigned int line_size);
+void free_snoop_filter();
+uint64_t snoop_filter_sharers(int requester, unsigned int Address);
+void snoop_filter_update(int requester, int BusOp, unsigned int Address, uint64_t not_holding);
+void snoop_filter_drop(int holder, unsigned int Address);
+extern int snoop_filter_active;
+extern SnoopFilterStats snoop_filter_stats;
+int open_interval_log(const char *filename, uint64_t length, int by_clears);
+int close_interval_log(const char *filename);
+void interval_trace_entry(int operation_code);
+extern int interval_active;
+int initialize_timing();
+void free_timing();
+void finish_timing();
+uint64_t timing_begin_access(Cache *c, const TraceEntry *entry);
+void timing_end_access(Cache *c, int operation_code, uint64_t start);
+Cache *timing_detach(Cache *resume);
+void timing_bus_operation(Cache *c, int BusOp, unsigned int Address, int SnoopResult);
+extern TimingConfig timing_config;
+extern int timing_active;
+extern TimingStats timing_stats;
+int initialize_dram();
+void free_dram();
+uint64_t dram_access(unsigned int Address, int write, uint64_t cycle);
+extern DramConfig dram_config;
+extern int dram_active;
+extern DramStats dram_stats;
 
 #endif // CACHE_H
 
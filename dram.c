@@ -0,0 +1,123 @@
+#include "cache.h"
+#include <stdio.h>
+#include <string.h>
+
+// DRAM behind the bus (memory=dram). An address is split, from the top, into
+// row, bank, channel and column: every row is `row_size` consecutive bytes,
+// and consecutive rows go to the next channel, then the next bank.
+//
+// Each bank keeps one row open in its row buffer. With the open-page policy
+// the row stays open after an access: the next access to it pays only tCAS (a
+// row hit), an access to an idle bank tRCD + tCAS, and one to another row tRP
+// + tRCD + tCAS (a row conflict). With the closed-page policy every access
+// activates its row and the bank precharges right after, so every access is
+// tRCD + tCAS and the bank is busy tRP longer. A bank serves one access at a
+// time, and each channel's data bus one burst at a time.
+typedef struct {
+    int64_t open_row;       // Row in the row buffer, -1 if precharged
+    uint64_t ready;         // Cycle the bank can take its next access
+} DramBank;
+
+DramConfig dram_config = {
+    DRAM_CHANNELS, DRAM_BANKS, DRAM_ROW_SIZE, DRAM_OPEN_PAGE,
+    DRAM_TCAS, DRAM_TRCD, DRAM_TRP, DRAM_TBURST
+};
+int dram_active = 0;
+DramStats dram_stats;
+
+static DramBank *banks;         // channels * banks_per_channel
+static uint64_t *channel_free;  // Cycle each channel's data bus is next free
+static unsigned int column_bits, channel_bits, bank_bits;
+
+// Access the line at `Address` for a read, or a write-back if `write`, that
+// reaches memory at `cycle`. Returns the cycle its data burst is done.
+uint64_t dram_access(unsigned int Address, int write, uint64_t cycle) {
+    unsigned int channel = (Address >> column_bits) & (dram_config.channels - 1);
+    unsigned int bank_index = (Address >> (column_bits + channel_bits)) & (dram_config.banks - 1);
+    int64_t row = (int64_t)(Address >> (column_bits + channel_bits + bank_bits));
+    DramBank *bank = &banks[channel * dram_config.banks + bank_index];
+    uint64_t start = cycle > bank->ready ? cycle : bank->ready;
+    uint64_t done;
+    unsigned int latency;
+
+    if (start > cycle) {
+        dram_stats.bank_busy++;
+        dram_stats.bank_wait_cycles += start - cycle;
+    }
+    if (dram_config.open_page && bank->open_row == row) {
+        dram_stats.row_hits++;
+        latency = dram_config.tcas;
+    } else if (bank->open_row < 0) {
+        dram_stats.row_empty++;
+        latency = dram_config.trcd + dram_config.tcas;
+    } else {
+        dram_stats.row_conflicts++;
+        latency = dram_config.trp + dram_config.trcd + dram_config.tcas;
+    }
+
+    done = start + latency;
+    if (done < channel_free[channel]) {
+        done = channel_free[channel]; // Wait for the channel's data bus
+    }
+    done += dram_config.tburst;
+    channel_free[channel] = done;
+
+    if (dram_config.open_page) {
+        bank->open_row = row;
+        bank->ready = done;
+    } else {
+        bank->open_row = -1;
+        bank->ready = done + dram_config.trp;
+    }
+
+    if (write) {
+        dram_stats.writes++;
+    } else {
+        dram_stats.reads++;
+        dram_stats.read_cycles += done - cycle;
+    }
+    return done;
+}
+
+// Set up the banks for dram_config. Returns 0 on success.
+int initialize_dram() {
+    unsigned int count = dram_config.channels * dram_config.banks;
+    unsigned int i;
+
+    if (!dram_config.channels || (dram_config.channels & (dram_config.channels - 1)) != 0 ||
+        !dram_config.banks || (dram_config.banks & (dram_config.banks - 1)) != 0 ||
+        !dram_config.row_size || (dram_config.row_size & (dram_config.row_size - 1)) != 0) {
+        fprintf(stderr, "Error: channels, banks and rowsize must be powers of two.\n");
+        return -1;
+    }
+    column_bits = (unsigned int)__builtin_ctz(dram_config.row_size);
+    channel_bits = (unsigned int)__builtin_ctz(dram_config.channels);
+    bank_bits = (unsigned int)__builtin_ctz(dram_config.banks);
+    if (column_bits + channel_bits + bank_bits >= 32) {
+        fprintf(stderr, "Error: channels * banks * rowsize must be below 4 GB (32-bit addresses).\n");
+        return -1;
+    }
+
+    banks = malloc(count * sizeof(DramBank));
+    channel_free = calloc(dram_config.channels, sizeof(uint64_t));
+    if (!banks || !channel_free) {
+        fprintf(stderr, "Error: Out of memory allocating %u DRAM banks.\n", count);
+        free_dram();
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        banks[i].open_row = -1;
+        banks[i].ready = 0;
+    }
+    memset(&dram_stats, 0, sizeof(dram_stats));
+    dram_active = 1;
+    return 0;
+}
+
+void free_dram() {
+    free(banks);
+    free(channel_free);
+    banks = NULL;
+    channel_free = NULL;
+    dram_active = 0;
+}
@@ -0,0 +1,603 @@
+#include "cache.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+// Single-producer ring between the simulation thread and the log writer thread
+typedef struct {
+    LogEvent *events;
+    _Atomic size_t head;        // Next slot the simulation thread fills
+    _Atomic size_t tail;        // Next slot the writer thread drains
+    _Atomic int done;           // Set once the simulation has finished
+    FILE *file;
+    pthread_t writer;
+} EventRing;
+
+static EventRing ring;
+static int event_log_active = 0;
+
+// Longest line format_dump_event() produces
+#define DUMP_LINE_MAX 96
+
+// A cache dump is formatted into memory and written out in one go at EV_PRINT_END
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+} DumpBuffer;
+
+static DumpBuffer console_dump;
+static DumpBuffer file_dump;
+
+static const char *bus_operation_name(int BusOp) {
+    return (BusOp == READ) ? "READ" :
+           (BusOp == WRITE) ? "WRITE" :
+           (BusOp == INVALIDATE) ? "INVALIDATE" :
+           (BusOp == RWIM) ? "RWIM" : "UNKNOWN";
+}
+
+static const char *snoop_result_name(int SnoopResult) {
+    return (SnoopResult == HIT) ? "HIT" :
+           (SnoopResult == HITM) ? "HITM" :
+           (SnoopResult == NOHIT) ? "NOHIT" : "UNKNOWN";
+}
+
+static const char *l1_message_name(int Message) {
+    switch (Message) {
+        case GETLINE: return "GETLINE";               // L2 requests data from L1
+        case SENDLINE: return "SENDLINE";             // L2 sends data to L1
+        case INVALIDATELINE: return "INVALIDATELINE"; // L2 invalidates L1's cache line
+        case EVICTLINE: return "EVICTLINE";           // L2 evicts a line from L1
+        default: return "UNKNOWN";                    // For unexpected message types
+    }
+}
+
+// Print the "Metadata/Pseudo-LRU" block the snoop handlers append to the file log
+static void render_snoop_metadata(FILE *out, const LogEvent *ev) {
+    if (!(ev->flags & LOG_METADATA)) {
+        fputc('\n', out); // Logged below LOG_FULL: keep the blank line only
+        return;
+    }
+    fprintf(out,
+            "  Metadata: Valid=%d, Dirty=%d, MESI State=%s\n"
+            "  Pseudo-LRU: 0x%X\n\n",
+            (ev->flags & LOG_VALID) != 0, (ev->flags & LOG_DIRTY) != 0,
+            get_mesi_state_name((MESIState)ev->new_state), ev->plru);
+}
+
+static void render_snoop_outcome(FILE *out, const LogEvent *ev, int console) {
+    const char *old_state = get_mesi_state_name((MESIState)ev->old_state);
+
+    switch (ev->operation) {
+        case 3: // Snooped read
+            if (ev->way < 0) {
+                fprintf(out, console ? "Snooped Read: Line not present in cache. No action needed.\n\n"
+                                     : "  Snooped Read: Line not present in cache. No action needed.\n\n");
+                return;
+            }
+            switch (ev->old_state) {
+                case MODIFIED:
+                    fprintf(out, "%sSnooped Read: MODIFIED -> SHARED (Write-back to memory).\n%s",
+                            console ? "" : "  ", console ? "\n" : "");
+                    break;
+                case EXCLUSIVE:
+                    fprintf(out, "%sSnooped Read: EXCLUSIVE -> SHARED.\n%s",
+                            console ? "" : "  ", console ? "\n" : "");
+                    break;
+                case SHARED:
+                    fprintf(out, "%sSnooped Read: Already in SHARED state. No action needed.\n%s",
+                            console ? "" : "  ", console ? "\n" : "");
+                    break;
+                default:
+                    fprintf(out, console ? "Snooped Read: Line in INVALID state. No action needed.\n\n"
+                                         : "  Snooped Read: Line in INVALID state. Invalidating line.\n");
+                    break;
+            }
+            if (!console) {
+                render_snoop_metadata(out, ev);
+            }
+            return;
+
+        case 4: // Snooped write
+            if (ev->way < 0) {
+                fprintf(out, "Snooped Write: Line not present in cache. No action needed (Address: 0x%08X).\n\n",
+                        ev->address);
+            } else if (ev->old_state == INVALID) {
+                fprintf(out, "Snooped Write: Line already in INVALID state. No action needed (Address: 0x%08X).\n\n",
+                        ev->address);
+            } else {
+                fprintf(out, "Error: Invalid MESI state (%s) for bus write operation (Address: 0x%08X)\n\n",
+                        old_state, ev->address);
+            }
+            return;
+
+        case 5: // Snooped read with intent to modify
+            if (ev->way < 0) {
+                fprintf(out, console ? "Snooped RWIM: Line not present in cache. No action needed.\n\n"
+                                     : "  Snooped RWIM: Line not present in cache. No action needed.\n\n");
+                return;
+            }
+            if (console) {
+                switch (ev->old_state) {
+                    case MODIFIED: fprintf(out, "Snooped RWIM: MODIFIED -> INVALID (Write-back to memory).\n\n"); break;
+                    case SHARED: fprintf(out, "Snooped RWIM: SHARED-> INVALID.\n\n"); break;
+                    case EXCLUSIVE: fprintf(out, "Snooped RWIM: EXCLUSIVE -> INVALID.\n\n"); break;
+                    default: fprintf(out, "Snooped RWIM: Line already in INVALID state. No action needed.\n\n"); break;
+                }
+                return;
+            }
+            switch (ev->old_state) {
+                case MODIFIED:
+                    // This message has always put its blank line before the metadata
+                    if (!(ev->flags & LOG_METADATA)) {
+                        fprintf(out, "  Snooped RWIM: MODIFIED -> INVALID (Write-back to memory).\n\n");
+                        return;
+                    }
+                    fprintf(out,
+                            "  Snooped RWIM: MODIFIED -> INVALID (Write-back to memory).\n\n"
+                            "  Metadata: Valid=%d, Dirty=%d, MESI State=%s\n"
+                            "  Pseudo-LRU: 0x%X\n",
+                            (ev->flags & LOG_VALID) != 0, (ev->flags & LOG_DIRTY) != 0,
+                            get_mesi_state_name((MESIState)ev->new_state), ev->plru);
+                    return;
+                case SHARED: fprintf(out, "  Snooped RWIM: SHARED-> INVALID.\n"); break;
+                case EXCLUSIVE: fprintf(out, "  Snooped RWIM: EXCLUSIVE -> INVALID.\n"); break;
+                default: fprintf(out, "  Snooped RWIM: Line already in INVALID state. No action needed.\n"); break;
+            }
+            render_snoop_metadata(out, ev);
+            return;
+
+        case 6: // Snooped invalidate
+            if (ev->way < 0) {
+                fprintf(out, console ? "Snooped Invalidate: Line not present in cache. No action needed.\n\n"
+                                     : "  Snooped Invalidate: Line not present in cache. No action needed.\n\n");
+                return;
+            }
+            switch (ev->old_state) {
+                case SHARED:
+                    fprintf(out, "%sSnooped Invalidate: SHARED -> INVALID.\n%s",
+                            console ? "" : "  ", console ? "\n" : "");
+                    break;
+                case INVALID:
+                    fprintf(out, "%sSnooped Invalidate: Line already in INVALID state. No action needed.\n%s",
+                            console ? "" : "  ", console ? "\n" : "");
+                    break;
+                default:
+                    if (console) {
+                        fprintf(out, "Error: Snooped Invalidate: Line in %s state (Invalid scenario).\n\n", old_state);
+                    } else {
+                        fprintf(out, "  Error: Invalid scenario. Line in %s state.\n", old_state);
+                    }
+                    break;
+            }
+            if (!console) {
+                render_snoop_metadata(out, ev);
+            }
+            return;
+    }
+}
+
+static char *put_decimal(char *p, unsigned int value) {
+    char digits[10];
+    int n = 0;
+    do {
+        digits[n++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+    while (n) {
+        *p++ = digits[--n];
+    }
+    return p;
+}
+
+// Uppercase hex without leading zeros, like %X
+static char *put_hex(char *p, unsigned int value) {
+    char digits[8];
+    int n = 0;
+    do {
+        digits[n++] = "0123456789ABCDEF"[value & 0xF];
+        value >>= 4;
+    } while (value);
+    while (n) {
+        *p++ = digits[--n];
+    }
+    return p;
+}
+
+static char *put_string(char *p, const char *text) {
+    size_t length = strlen(text);
+    memcpy(p, text, length);
+    return p + length;
+}
+
+// Format one cache dump event into `out` (at least DUMP_LINE_MAX bytes) and
+// return its length. A dump can run to millions of lines, so this avoids printf.
+static size_t format_dump_event(char *out, const LogEvent *ev, int console) {
+    char *p = out;
+
+    if (ev->flags & LOG_CACHE_ID) {
+        p = put_string(p, "[cache ");
+        p = put_decimal(p, ev->cache_id);
+        p = put_string(p, "] ");
+    }
+    switch (ev->type) {
+        case EV_PRINT_BEGIN:
+            p = put_string(p, console ? "Cache Contents and States:\n" : "Operation: Print cache state (code 9)\n");
+            break;
+        case EV_PRINT_SET:
+            p = put_string(p, "Index ");
+            p = put_decimal(p, ev->set);
+            p = put_string(p, ":\n");
+            break;
+        case EV_PRINT_LINE:
+            p = put_string(p, "  Line ");
+            p = put_decimal(p, (unsigned int)ev->way);
+            p = put_string(p, ": Tag=0x");
+            p = put_hex(p, ev->tag);
+            p = put_string(p, ", State=");
+            p = put_string(p, get_mesi_state_name((MESIState)ev->new_state));
+            p = put_string(p, (ev->flags & LOG_DIRTY) ? ", Dirty=1\n" : ", Dirty=0\n");
+            break;
+        case EV_PRINT_END:
+            p = put_string(p, "Cache state printed successfully.\n\n");
+            break;
+    }
+    return (size_t)(p - out);
+}
+
+// Render one event as the text the handlers used to print. The console and the
+// log file have always used slightly different wording for some messages.
+void render_event(FILE *out, const LogEvent *ev, int console) {
+    // Write requests print the index zero-padded, except where noted
+    const char *index_format = (ev->operation == 1) ? "0x%08X" : "0x%X";
+    const char *state = get_mesi_state_name((MESIState)ev->new_state);
+    int i;
+
+    // With several caches on the bus, say whose event this is
+    if ((ev->flags & LOG_CACHE_ID) && (ev->type < EV_PRINT_BEGIN || ev->type > EV_PRINT_END)) {
+        fprintf(out, "[cache %u] ", ev->cache_id);
+    }
+    switch (ev->type) {
+        case EV_CACHE_HIT:
+            fprintf(out, "Cache Hit: Address 0x%08X (Index: ", ev->address);
+            fprintf(out, console ? index_format : "0x%X", ev->set);
+            fprintf(out, ", Tag: 0x%08X, State: %s)\n", ev->tag, get_mesi_state_name((MESIState)ev->old_state));
+            break;
+        case EV_WRITE_HIT:
+            fprintf(out, "Address 0x%08X (Index: ", ev->address);
+            fprintf(out, console ? index_format : "0x%X", ev->set);
+            fprintf(out, ", Tag: 0x%08X, State: %s)\n", ev->tag, state);
+            break;
+        case EV_MISS_EMPTY:
+        case EV_MISS_COLLISION:
+            fprintf(out, "Cache Miss (%s): Address 0x%08X (Index: ",
+                    ev->type == EV_MISS_EMPTY ? "Empty Slot" : "collision", ev->address);
+            fprintf(out, index_format, ev->set);
+            fprintf(out, ", Tag: 0x%08X)%s\n", ev->tag, console ? "." : "");
+            break;
+        case EV_FILL:
+            fprintf(out, "Address 0x%08X (Index: ", ev->address);
+            fprintf(out, index_format, ev->set);
+            fprintf(out, ", Tag: 0x%08X, New State: %s)\n\n", ev->tag, state);
+            break;
+        case EV_PLRU_UPDATE:
+            fputs(console ? "Updated PLRu Bits:" : "Updated PLRU bits: ", out);
+            for (i = 0; i + 1 < (int)ev->aux; i++) {
+                fputc((ev->plru >> i) & 1 ? '1' : '0', out);
+            }
+            fputc('\n', out);
+            break;
+        case EV_BUS_OPERATION:
+            if (console) {
+                fprintf(out, "Bus Communication:\n  Operation: %s\n  Address: 0x%08X\n",
+                        bus_operation_name(ev->bus_op), ev->address);
+            } else {
+                fprintf(out, "Bus Communication: Operation=%s, Address=0x%08X\n",
+                        bus_operation_name(ev->bus_op), ev->address);
+            }
+            break;
+        case EV_SNOOP_RESULT:
+            fprintf(out, console ? "SnoopResult: Address: 0x%08X, SnoopResult: %s\n"
+                                 : "SnoopResult: Address=0x%08X, SnoopResult=%s\n",
+                    ev->address, snoop_result_name(ev->snoop_result));
+            break;
+        case EV_L1_MESSAGE:
+            fprintf(out, "L2 to L1 Message: %s, Address: 0x%08X\n", l1_message_name(ev->bus_op), ev->address);
+            break;
+        case EV_SNOOP_REQUEST: {
+            const char *console_name = (ev->operation == 3) ? "Read" :
+                                       (ev->operation == 5) ? "RWIM" : "Invalidate";
+            const char *file_name = (ev->operation == 3) ? "Snooped read request" :
+                                    (ev->operation == 5) ? "Snooped RWIM request" : "Snooped invalidate command";
+            if (console) {
+                fprintf(out, "Snooped %s Request: Address 0x%08X (Index: 0x%X, Tag: 0x%X)\n",
+                        console_name, ev->address, ev->set, ev->tag);
+            } else {
+                fprintf(out,
+                        "Operation: %s (code %d), Address: 0x%08X\n"
+                        "  Decomposed Address: Byte Offset=0x%X, Index=0x%X, Tag=0x%X\n",
+                        file_name, ev->operation, ev->address, ev->aux, ev->set, ev->tag);
+            }
+            break;
+        }
+        case EV_SNOOP_OUTCOME:
+            render_snoop_outcome(out, ev, console);
+            break;
+        case EV_CLEAR_BEGIN:
+            fputs(console ? "Clearing cache and resetting all states to initial values...\n"
+                          : "Operation: Clear cache (code 8)\n", out);
+            break;
+        case EV_WRITEBACK:
+            fprintf(out, "Bus Operation: Write address 0x%08X (from dirty cache line)\n", ev->address);
+            break;
+        case EV_CLEAR_END:
+            fputs(console ? "Cache successfully cleared.\n\n"
+                          : "Cache successfully cleared and reset to initial values.\n\n", out);
+            break;
+        case EV_PRINT_BEGIN:
+        case EV_PRINT_SET:
+        case EV_PRINT_LINE:
+        case EV_PRINT_END: {
+            char line[DUMP_LINE_MAX];
+            fwrite(line, 1, format_dump_event(line, ev, console), out);
+            break;
+        }
+        case EV_BYPASS:
+            fprintf(out, "Cache Bypass: Address 0x%08X (Index: 0x%X, Tag: 0x%08X) predicted dead, not allocated\n",
+                    ev->address, ev->set, ev->tag);
+            break;
+        case EV_PREFETCH:
+            fprintf(out, "Prefetch: Address 0x%08X (Index: 0x%X, Tag: 0x%08X) filled for the prefetcher\n",
+                    ev->address, ev->set, ev->tag);
+            break;
+        default:
+            fprintf(out, "Unknown log event type %d\n", ev->type);
+            break;
+    }
+}
+
+// Writer thread: drain the ring to disk in large contiguous writes
+static void *event_log_writer(void *arg) {
+    const struct timespec pause = {0, 200000}; // 200 us when there is nothing to write
+    (void)arg;
+
+    for (;;) {
+        size_t head = atomic_load_explicit(&ring.head, memory_order_acquire);
+        size_t tail = atomic_load_explicit(&ring.tail, memory_order_relaxed);
+
+        if (head == tail) {
+            if (atomic_load_explicit(&ring.done, memory_order_acquire) &&
+                atomic_load_explicit(&ring.head, memory_order_acquire) == tail) {
+                break;
+            }
+            nanosleep(&pause, NULL);
+            continue;
+        }
+
+        // Write up to the end of the ring; the wrapped part goes next time round
+        size_t start = tail & (LOG_RING_SIZE - 1);
+        size_t count = head - tail;
+        if (count > LOG_RING_SIZE - start) {
+            count = LOG_RING_SIZE - start;
+        }
+        fwrite(&ring.events[start], sizeof(LogEvent), count, ring.file);
+        atomic_store_explicit(&ring.tail, tail + count, memory_order_release);
+    }
+    return NULL;
+}
+
+static void push_event(const LogEvent *ev) {
+    size_t head = atomic_load_explicit(&ring.head, memory_order_relaxed);
+
+    // Ring full: let the writer catch up
+    while (head - atomic_load_explicit(&ring.tail, memory_order_acquire) >= LOG_RING_SIZE) {
+        sched_yield();
+    }
+    ring.events[head & (LOG_RING_SIZE - 1)] = *ev;
+    atomic_store_explicit(&ring.head, head + 1, memory_order_release);
+}
+
+static void flush_dump(DumpBuffer *dump, FILE *out) {
+    fwrite(dump->data, 1, dump->length, out);
+    dump->length = 0;
+}
+
+// Append a dump line to `dump`, growing it as needed. If memory runs out the
+// dump so far and this line go straight to `out` instead.
+static void buffer_dump_event(DumpBuffer *dump, FILE *out, const LogEvent *ev, int console) {
+    if (dump->capacity - dump->length < DUMP_LINE_MAX) {
+        size_t capacity = dump->capacity ? dump->capacity * 2 : 1 << 16;
+        char *data = realloc(dump->data, capacity);
+        if (!data) {
+            char line[DUMP_LINE_MAX];
+            flush_dump(dump, out);
+            fwrite(line, 1, format_dump_event(line, ev, console), out);
+            return;
+        }
+        dump->data = data;
+        dump->capacity = capacity;
+    }
+    dump->length += format_dump_event(dump->data + dump->length, ev, console);
+}
+
+// The cache dump has always gone to the console, even in silent mode. It is
+// collected in memory and each destination gets a single write at the end.
+static void log_dump_event(const LogEvent *ev) {
+    buffer_dump_event(&console_dump, stdout, ev, 1);
+    if (event_log_active) {
+        push_event(ev);
+    } else if (output_file) {
+        buffer_dump_event(&file_dump, output_file, ev, 0);
+    }
+    if (ev->type == EV_PRINT_END) {
+        flush_dump(&console_dump, stdout);
+        if (output_file) {
+            flush_dump(&file_dump, output_file);
+        }
+    }
+}
+
+// Record one simulation event: echo it on the console in normal mode, then
+// append it to the binary event log or render it into the text log file.
+void log_event(const LogEvent *ev) {
+    if (ev->type >= EV_PRINT_BEGIN && ev->type <= EV_PRINT_END) {
+        log_dump_event(ev);
+        return;
+    }
+    if (Mode == 1) {
+        render_event(stdout, ev, 1);
+    }
+    if (event_log_active) {
+        push_event(ev);
+    } else if (output_file) {
+        render_event(output_file, ev, 0);
+    }
+}
+
+// Append free-form text to the log (start/finish banners, parse errors, statistics).
+// In the binary log the text is stored as an EV_TEXT record followed by raw payload records.
+void log_text(const char *format, ...) {
+    char small[512];
+    char *text = small;
+    va_list args;
+    int length;
+
+    if (!LOG_ENABLED(LOG_STATS)) {
+        return;
+    }
+    va_start(args, format);
+    if (!event_log_active) {
+        if (output_file) {
+            vfprintf(output_file, format, args);
+        }
+        va_end(args);
+        return;
+    }
+    length = vsnprintf(small, sizeof(small), format, args);
+    va_end(args);
+    if (length < 0) {
+        return;
+    }
+    if ((size_t)length >= sizeof(small)) {
+        text = malloc((size_t)length + 1);
+        if (!text) {
+            return;
+        }
+        va_start(args, format);
+        vsnprintf(text, (size_t)length + 1, format, args);
+        va_end(args);
+    }
+
+    LogEvent header;
+    memset(&header, 0, sizeof(header));
+    header.type = EV_TEXT;
+    header.aux = (uint32_t)length;
+    push_event(&header);
+
+    int offset;
+    for (offset = 0; offset < length; offset += (int)sizeof(LogEvent)) {
+        LogEvent payload;
+        int chunk = length - offset < (int)sizeof(LogEvent) ? length - offset : (int)sizeof(LogEvent);
+        memset(&payload, 0, sizeof(payload));
+        memcpy(&payload, text + offset, (size_t)chunk);
+        push_event(&payload);
+    }
+    if (text != small) {
+        free(text);
+    }
+}
+
+// Start logging binary event records to `filename` through the writer thread
+int open_event_log(const char *filename) {
+    LogFileHeader header;
+
+    ring.file = fopen(filename, "wb");
+    if (!ring.file) {
+        return -1;
+    }
+    ring.events = malloc(LOG_RING_SIZE * sizeof(LogEvent));
+    if (!ring.events) {
+        fclose(ring.file);
+        return -1;
+    }
+    setvbuf(ring.file, NULL, _IOFBF, 1 << 20);
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, LOG_FILE_MAGIC, sizeof(header.magic));
+    header.version = LOG_FILE_VERSION;
+    header.record_size = sizeof(LogEvent);
+    header.ways = cache.num_ways;
+    fwrite(&header, sizeof(header), 1, ring.file);
+
+    atomic_store(&ring.head, 0);
+    atomic_store(&ring.tail, 0);
+    atomic_store(&ring.done, 0);
+    if (pthread_create(&ring.writer, NULL, event_log_writer, NULL) != 0) {
+        free(ring.events);
+        fclose(ring.file);
+        return -1;
+    }
+    event_log_active = 1;
+    return 0;
+}
+
+// Flush everything still in the ring and close the event log
+void close_event_log() {
+    if (!event_log_active) {
+        return;
+    }
+    atomic_store_explicit(&ring.done, 1, memory_order_release);
+    pthread_join(ring.writer, NULL);
+    fclose(ring.file);
+    free(ring.events);
+    event_log_active = 0;
+}
+
+// Render a binary event log back into the text format of simulation_output.txt
+int decode_event_log(const char *log_filename, const char *text_filename) {
+    FILE *in = fopen(log_filename, "rb");
+    FILE *out;
+    LogFileHeader header;
+    LogEvent ev;
+    char text[sizeof(LogEvent)];
+
+    if (!in) {
+        fprintf(stderr, "Error: Could not open file: %s\n", log_filename);
+        return -1;
+    }
+    if (fread(&header, sizeof(header), 1, in) != 1 ||
+        memcmp(header.magic, LOG_FILE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != LOG_FILE_VERSION || header.record_size != sizeof(LogEvent)) {
+        fprintf(stderr, "Error: Not an event log: %s\n", log_filename);
+        fclose(in);
+        return -1;
+    }
+    out = fopen(text_filename, "w");
+    if (!out) {
+        fprintf(stderr, "Error: Could not create file: %s\n", text_filename);
+        fclose(in);
+        return -1;
+    }
+
+    while (fread(&ev, sizeof(ev), 1, in) == 1) {
+        if (ev.type != EV_TEXT) {
+            render_event(out, &ev, 0);
+            continue;
+        }
+        // Copy the text payload records through verbatim
+        uint32_t remaining = ev.aux;
+        while (remaining > 0 && fread(text, sizeof(text), 1, in) == 1) {
+            uint32_t chunk = remaining < sizeof(text) ? remaining : (uint32_t)sizeof(text);
+            fwrite(text, 1, chunk, out);
+            remaining -= chunk;
+        }
+    }
+
+    fclose(in);
+    fclose(out);
+    return 0;
+}
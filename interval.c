@@ -0,0 +1,152 @@
+#include "cache.h"
+#include <stdio.h>
+#include <string.h>
+
+// Interval statistics (intervals=<file>). The run is cut into intervals of
+// `length` demand accesses, or of `length` clears (opcode 8) so each interval
+// is a phase of the workload, and every interval becomes one row of a time
+// series: its accesses, hit ratio, misses (by class with classify=on), bus
+// operations and write-backs. The series is CSV, or JSON when the file name
+// ends in ".json". Counters of all the caches on the bus are summed.
+
+typedef struct {
+    FILE *file;
+    int json;
+    int by_clears;          // Intervals end on clears rather than accesses
+    uint64_t length;        // Accesses or clears per interval
+    uint64_t counted;       // ... so far in the current interval
+    uint64_t rows;          // Intervals written
+    uint64_t first_access;  // Demand accesses before the current interval
+    CacheStats last;        // Totals when the current interval began
+} IntervalLog;
+
+static IntervalLog intervals;
+int interval_active = 0;
+
+static void total_stats(CacheStats *total) {
+    int i;
+
+    memset(total, 0, sizeof(*total));
+    for (i = 0; i < num_caches; i++) {
+        add_cache_stats(total, &bus_caches[i]->stats);
+    }
+}
+
+// Write the interval that ends now and start the next one
+static void write_interval() {
+    IntervalLog *series = &intervals;
+    CacheStats now;
+    uint64_t reads, writes, hits, misses, accesses;
+    uint64_t classes[MISS_CLASSES];
+    int classify = (cache.miss_classifier != NULL);
+    int k;
+
+    total_stats(&now);
+    reads = now.num_cache_reads - series->last.num_cache_reads;
+    writes = now.num_cache_writes - series->last.num_cache_writes;
+    hits = now.num_cache_hits - series->last.num_cache_hits;
+    misses = now.num_cache_misses - series->last.num_cache_misses;
+    accesses = reads + writes;
+    for (k = 0; k < MISS_CLASSES; k++) {
+        classes[k] = now.num_class_misses[k] - series->last.num_class_misses[k];
+    }
+
+    if (series->json) {
+        fprintf(series->file, "%s\n  {\"interval\": %llu, \"first_access\": %llu, \"accesses\": %llu, "
+                "\"reads\": %llu, \"writes\": %llu, \"hits\": %llu, \"misses\": %llu, \"hit_ratio\": %.4f",
+                series->rows ? "," : "", (unsigned long long)series->rows, (unsigned long long)series->first_access,
+                (unsigned long long)accesses, (unsigned long long)reads, (unsigned long long)writes,
+                (unsigned long long)hits, (unsigned long long)misses, accesses ? (double)hits / accesses : 0.0);
+        for (k = 0; classify && k < MISS_CLASSES; k++) {
+            fprintf(series->file, ", \"%s\": %llu", miss_class_name(k), (unsigned long long)classes[k]);
+        }
+        fprintf(series->file, ", \"bus_reads\": %llu, \"bus_rwims\": %llu, \"bus_invalidates\": %llu, "
+                "\"writebacks\": %llu}",
+                (unsigned long long)(now.num_bus_reads - series->last.num_bus_reads),
+                (unsigned long long)(now.num_bus_rwims - series->last.num_bus_rwims),
+                (unsigned long long)(now.num_bus_invalidates - series->last.num_bus_invalidates),
+                (unsigned long long)(now.num_bus_writes - series->last.num_bus_writes));
+    } else {
+        fprintf(series->file, "%llu,%llu,%llu,%llu,%llu,%llu,%llu,%.4f",
+                (unsigned long long)series->rows, (unsigned long long)series->first_access,
+                (unsigned long long)accesses, (unsigned long long)reads, (unsigned long long)writes,
+                (unsigned long long)hits, (unsigned long long)misses, accesses ? (double)hits / accesses : 0.0);
+        for (k = 0; classify && k < MISS_CLASSES; k++) {
+            fprintf(series->file, ",%llu", (unsigned long long)classes[k]);
+        }
+        fprintf(series->file, ",%llu,%llu,%llu,%llu\n",
+                (unsigned long long)(now.num_bus_reads - series->last.num_bus_reads),
+                (unsigned long long)(now.num_bus_rwims - series->last.num_bus_rwims),
+                (unsigned long long)(now.num_bus_invalidates - series->last.num_bus_invalidates),
+                (unsigned long long)(now.num_bus_writes - series->last.num_bus_writes));
+    }
+
+    series->rows++;
+    series->first_access += accesses;
+    series->counted = 0;
+    series->last = now;
+}
+
+// Count a trace entry that has just run; the interval ends after its
+// `length`th demand access or clear
+void interval_trace_entry(int operation_code) {
+    int counts = intervals.by_clears ? operation_code == 8 : (operation_code >= 0 && operation_code <= 2);
+
+    if (counts && ++intervals.counted == intervals.length) {
+        write_interval();
+    }
+}
+
+// Start a time series of intervals of `length` accesses, or `length` clears if
+// `by_clears`, in `filename`. Returns 0 on success.
+int open_interval_log(const char *filename, uint64_t length, int by_clears) {
+    size_t name_length = strlen(filename);
+    int k;
+
+    memset(&intervals, 0, sizeof(intervals));
+    intervals.file = fopen(filename, "w");
+    if (!intervals.file) {
+        fprintf(stderr, "Error: Could not create file: %s\n", filename);
+        return -1;
+    }
+    intervals.json = (name_length >= 5 && strcmp(filename + name_length - 5, ".json") == 0);
+    intervals.by_clears = by_clears;
+    intervals.length = length;
+    total_stats(&intervals.last);
+
+    if (intervals.json) {
+        fprintf(intervals.file, "[");
+    } else {
+        fprintf(intervals.file, "interval,first_access,accesses,reads,writes,hits,misses,hit_ratio");
+        for (k = 0; cache.miss_classifier && k < MISS_CLASSES; k++) {
+            fprintf(intervals.file, ",%s", miss_class_name(k));
+        }
+        fprintf(intervals.file, ",bus_reads,bus_rwims,bus_invalidates,writebacks\n");
+    }
+    interval_active = 1;
+    return 0;
+}
+
+// Write the last, partial interval if anything happened in it and finish the
+// file. Returns 0 on success.
+int close_interval_log(const char *filename) {
+    CacheStats now;
+
+    if (!interval_active) {
+        return 0;
+    }
+    total_stats(&now);
+    if (intervals.counted > 0 || now.num_cache_reads + now.num_cache_writes >
+                                 intervals.last.num_cache_reads + intervals.last.num_cache_writes) {
+        write_interval();
+    }
+    if (intervals.json) {
+        fprintf(intervals.file, "%s]\n", intervals.rows ? "\n" : "");
+    }
+    interval_active = 0;
+    if (fclose(intervals.file) != 0) {
+        fprintf(stderr, "Error: Could not write file: %s\n", filename);
+        return -1;
+    }
+    return 0;
+}
@@ -2,58 +2,607 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <sys/stat.h>
 
 // Define the global file pointer for output
 FILE *output_file;
 int Mode = 0; // 0 = silent, 1 = normal
-int num_cache_reads = 0;
-int num_cache_writes = 0;
-int num_cache_hits = 0;
-int num_cache_misses = 0;
+int parser_threads = 1; // Text parser threads feeding the simulation
+static int threads_given = 0; // threads= was given; in sweep mode it sizes the sweep's pool
+int shard_threads = 1; // Simulation threads, each owning a slice of the sets
+const char *event_log_filename = NULL; // Binary event log instead of simulation_output.txt
+int log_level = LLC_LOG_MAX; // LOG_OFF .. LOG_FULL, never above what the build compiled in
+static int log_level_given = 0; // log= appeared on the command line or in a config file
+
+static const char *log_level_names[] = {"off", "stats", "transactions", "full"};
+
+// Geometry of the modeled cache, from sets=, ways= and linesize=
+static unsigned int cache_sets = NUM_INDEXES;
+static unsigned int cache_ways = NUM_LINES_PER_INDEX;
+static unsigned int cache_line_size = LINE_SIZE;
+static ReplacementPolicy replacement_policy = POLICY_PLRU; // policy=
+static InsertionPolicy insertion_policy = INSERT_DEFAULT; // insert=
+static ReuseSignature bypass_signature = REUSE_OFF; // bypass=
+static PrefetcherKind prefetcher_kind = PREFETCH_OFF; // prefetch=
+static unsigned int prefetch_degree = PREFETCH_DEGREE; // prefetchdegree=
+static int classify_misses = 0; // classify=on, or classifysets=
+static const char *miss_class_filename = NULL; // classifysets=; per-set miss classes CSV
+static const char *interval_filename = NULL; // intervals=; interval statistics time series
+static long interval_length = 0; // interval=; 0 for the unit's default
+static int interval_by_clears = 0; // intervalunit=clears
+static int cache_count = 1; // Caches on the snooping bus, from caches=
+static unsigned int snoop_filter_entries = 0; // snoopfilter=; 0 broadcasts every bus request
+
+static int timing_requested = 0; // timing=on, memory=dram, or any latency below
+static int dram_requested = 0; // memory=dram
+
+// Latencies of the timing model, which setting one turns on, and the DRAM
+// backend's parameters, which memory=dram uses
+static const struct {
+    const char *name;
+    unsigned int *value;
+    int *requests;          // Flag the option sets, if any
+} timing_options[] = {
+    {"hitlatency", &timing_config.hit_latency, &timing_requested},
+    {"memlatency", &timing_config.memory_latency, &timing_requested},
+    {"busarbitration", &timing_config.bus_arbitration, &timing_requested},
+    {"busread", &timing_config.bus_occupancy[READ], &timing_requested},
+    {"buswrite", &timing_config.bus_occupancy[WRITE], &timing_requested},
+    {"businvalidate", &timing_config.bus_occupancy[INVALIDATE], &timing_requested},
+    {"busrwim", &timing_config.bus_occupancy[RWIM], &timing_requested},
+    {"writeback", &timing_config.writeback, &timing_requested},
+    {"snoopdelay", &timing_config.snoop_delay, &timing_requested},
+    {"mshrs", &timing_config.mshrs, &timing_requested},
+    {"issueinterval", &timing_config.issue_interval, &timing_requested},
+    {"channels", &dram_config.channels, NULL},
+    {"banks", &dram_config.banks, NULL},
+    {"rowsize", &dram_config.row_size, NULL},
+    {"tcas", &dram_config.tcas, NULL},
+    {"trcd", &dram_config.trcd, NULL},
+    {"trp", &dram_config.trp, NULL},
+    {"tburst", &dram_config.tburst, NULL},
+};
+
+static int apply_option(const char *option);
+
+// Parse a whole-number option value within [min, max]. Returns 0 on success.
+static int parse_count_option(const char *name, const char *value, long min, long max, long *count) {
+    char *end;
+    long n = strtol(value, &end, 0);
+    if (*value == '\0' || *end != '\0' || n < min || n > max) {
+        fprintf(stderr, "Error: %s must be between %ld and %ld.\n", name, min, max);
+        return -1;
+    }
+    *count = n;
+    return 0;
+}
+
+// Apply the name=value lines of a config file. Blank lines and text after '#'
+// are ignored. Returns 0 on success.
+static int apply_config_file(const char *filename) {
+    FILE *file = fopen(filename, "r");
+    char line[1024];
+    int line_number = 0;
+
+    if (!file) {
+        fprintf(stderr, "Error: Could not open config file: %s\n", filename);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), file)) {
+        char *start = line;
+        char *end;
+
+        line_number++;
+        end = strchr(line, '#');
+        if (end) {
+            *end = '\0';
+        }
+        end = start + strlen(start);
+        while (end > start && isspace((unsigned char)end[-1])) {
+            *--end = '\0';
+        }
+        while (isspace((unsigned char)*start)) {
+            start++;
+        }
+        if (*start == '\0') {
+            continue;
+        }
+        if (!strchr(start, '=') || strncmp(start, "config=", 7) == 0) {
+            fprintf(stderr, "Error: %s line %d: expected name=value.\n", filename, line_number);
+            fclose(file);
+            return -1;
+        }
+        if (apply_option(start) != 0) {
+            fprintf(stderr, "Error: in %s line %d.\n", filename, line_number);
+            fclose(file);
+            return -1;
+        }
+    }
+    fclose(file);
+    return 0;
+}
+
+// Apply a name=value option from the command line. Returns 0 on success.
+static int apply_option(const char *option) {
+    const char *value = strchr(option, '=') + 1;
+    long count;
+    size_t t;
+
+    if (strncmp(option, "threads=", 8) == 0) {
+        if (parse_count_option("threads", value, 1, 256, &count) != 0) {
+            return -1;
+        }
+        parser_threads = (int)count;
+        threads_given = 1;
+        return 0;
+    }
+
+    if (strncmp(option, "shards=", 7) == 0) {
+        if (parse_count_option("shards", value, 1, 256, &count) != 0) {
+            return -1;
+        }
+        shard_threads = (int)count;
+        return 0;
+    }
+
+    if (strncmp(option, "caches=", 7) == 0) {
+        if (parse_count_option("caches", value, 1, MAX_CACHES, &count) != 0) {
+            return -1;
+        }
+        cache_count = (int)count;
+        return 0;
+    }
+
+    if (strncmp(option, "snoopfilter=", 12) == 0) {
+        // initialize_snoop_filter() checks the entry count
+        if (parse_count_option("snoopfilter", value, 1, 1L << 26, &count) != 0) {
+            return -1;
+        }
+        snoop_filter_entries = (unsigned int)count;
+        return 0;
+    }
+
+    // Geometry; initialize_cache() checks that the combination is usable
+    if (strncmp(option, "sets=", 5) == 0) {
+        if (parse_count_option("sets", value, 1, 1L << 26, &count) != 0) {
+            return -1;
+        }
+        cache_sets = (unsigned int)count;
+        return 0;
+    }
+
+    if (strncmp(option, "ways=", 5) == 0) {
+        if (parse_count_option("ways", value, 1, MAX_LINES_PER_INDEX, &count) != 0) {
+            return -1;
+        }
+        cache_ways = (unsigned int)count;
+        return 0;
+    }
+
+    if (strncmp(option, "linesize=", 9) == 0) {
+        if (parse_count_option("linesize", value, 1, 1L << 20, &count) != 0) {
+            return -1;
+        }
+        cache_line_size = (unsigned int)count;
+        return 0;
+    }
+
+    if (strncmp(option, "policy=", 7) == 0) {
+        int policy = parse_replacement_policy(value);
+        if (policy < 0) {
+            fprintf(stderr, "Error: policy must be 'plru', 'lru', 'srrip', 'drrip' or 'random'.\n");
+            return -1;
+        }
+        replacement_policy = (ReplacementPolicy)policy;
+        return 0;
+    }
+
+    if (strncmp(option, "insert=", 7) == 0) {
+        int insertion = parse_insertion_policy(value);
+        if (insertion < 0) {
+            fprintf(stderr, "Error: insert must be 'mru', 'lru' or 'bip'.\n");
+            return -1;
+        }
+        insertion_policy = (InsertionPolicy)insertion;
+        return 0;
+    }
+
+    if (strncmp(option, "bypass=", 7) == 0) {
+        if (strcmp(value, "off") == 0) {
+            bypass_signature = REUSE_OFF;
+        } else if (strcmp(value, "pc") == 0) {
+            bypass_signature = REUSE_PC;
+        } else if (strcmp(value, "region") == 0) {
+            bypass_signature = REUSE_REGION;
+        } else {
+            fprintf(stderr, "Error: bypass must be 'off', 'pc' or 'region'.\n");
+            return -1;
+        }
+        return 0;
+    }
+
+    if (strncmp(option, "prefetch=", 9) == 0) {
+        int kind = parse_prefetcher(value);
+        if (kind < 0) {
+            fprintf(stderr, "Error: prefetch must be 'off', 'next', 'stride' or 'stream'.\n");
+            return -1;
+        }
+        prefetcher_kind = (PrefetcherKind)kind;
+        return 0;
+    }
+
+    if (strncmp(option, "prefetchdegree=", 15) == 0) {
+        if (parse_count_option("prefetchdegree", value, 1, 64, &count) != 0) {
+            return -1;
+        }
+        prefetch_degree = (unsigned int)count;
+        return 0;
+    }
+
+    if (strncmp(option, "classify=", 9) == 0) {
+        if (strcmp(value, "on") != 0 && strcmp(value, "off") != 0) {
+            fprintf(stderr, "Error: classify must be 'on' or 'off'.\n");
+            return -1;
+        }
+        classify_misses = (strcmp(value, "on") == 0);
+        return 0;
+    }
+
+    if (strncmp(option, "classifysets=", 13) == 0) {
+        if (*value == '\0') {
+            fprintf(stderr, "Error: classifysets needs a file name.\n");
+            return -1;
+        }
+        miss_class_filename = value;
+        classify_misses = 1;
+        return 0;
+    }
+
+    if (strncmp(option, "intervals=", 10) == 0) {
+        if (*value == '\0') {
+            fprintf(stderr, "Error: intervals needs a file name.\n");
+            return -1;
+        }
+        interval_filename = value;
+        return 0;
+    }
+
+    if (strncmp(option, "interval=", 9) == 0) {
+        return parse_count_option("interval", value, 1, 1L << 40, &interval_length);
+    }
+
+    if (strncmp(option, "intervalunit=", 13) == 0) {
+        if (strcmp(value, "accesses") != 0 && strcmp(value, "clears") != 0) {
+            fprintf(stderr, "Error: intervalunit must be 'accesses' or 'clears'.\n");
+            return -1;
+        }
+        interval_by_clears = (strcmp(value, "clears") == 0);
+        return 0;
+    }
+
+    if (strncmp(option, "timing=", 7) == 0) {
+        if (strcmp(value, "on") != 0 && strcmp(value, "off") != 0) {
+            fprintf(stderr, "Error: timing must be 'on' or 'off'.\n");
+            return -1;
+        }
+        timing_requested = (strcmp(value, "on") == 0);
+        return 0;
+    }
+
+    if (strncmp(option, "memory=", 7) == 0) {
+        if (strcmp(value, "fixed") != 0 && strcmp(value, "dram") != 0) {
+            fprintf(stderr, "Error: memory must be 'fixed' or 'dram'.\n");
+            return -1;
+        }
+        dram_requested = (strcmp(value, "dram") == 0);
+        timing_requested |= dram_requested;
+        return 0;
+    }
+
+    if (strncmp(option, "pagepolicy=", 11) == 0) {
+        if (strcmp(value, "open") != 0 && strcmp(value, "closed") != 0) {
+            fprintf(stderr, "Error: pagepolicy must be 'open' or 'closed'.\n");
+            return -1;
+        }
+        dram_config.open_page = (strcmp(value, "open") == 0);
+        return 0;
+    }
+
+    for (t = 0; t < sizeof(timing_options) / sizeof(timing_options[0]); t++) {
+        size_t length = strlen(timing_options[t].name);
+        if (strncmp(option, timing_options[t].name, length) == 0 && option[length] == '=') {
+            if (parse_count_option(timing_options[t].name, value, 0, 1L << 20, &count) != 0) {
+                return -1;
+            }
+            *timing_options[t].value = (unsigned int)count;
+            if (timing_options[t].requests) {
+                *timing_options[t].requests = 1;
+            }
+            return 0;
+        }
+    }
+
+    if (strncmp(option, "config=", 7) == 0) {
+        return apply_config_file(value);
+    }
+
+    if (strncmp(option, "eventlog=", 9) == 0) {
+        if (*value == '\0') {
+            fprintf(stderr, "Error: eventlog needs a file name.\n");
+            return -1;
+        }
+        event_log_filename = value;
+        return 0;
+    }
+
+    if (strncmp(option, "log=", 4) == 0) {
+        int level;
+        for (level = LOG_OFF; level <= LOG_FULL; level++) {
+            if (strcmp(value, log_level_names[level]) == 0) {
+                break;
+            }
+        }
+        if (level > LOG_FULL) {
+            fprintf(stderr, "Error: log must be 'off', 'stats', 'transactions' or 'full'.\n");
+            return -1;
+        }
+        if (level > LLC_LOG_MAX) {
+            fprintf(stderr, "Error: log=%s is compiled out of this build (LLC_LOG_MAX=%d).\n", value, LLC_LOG_MAX);
+            return -1;
+        }
+        log_level = level;
+        log_level_given = 1;
+        return 0;
+    }
+
+    fprintf(stderr, "Error: Unknown option '%s'.\n", option);
+    return -1;
+}
+
 int main(int argc, char *argv[]) {
     const char *filename = "rwims.din"; // Default trace file name
+    const char *mode = NULL;
+    int mode_arg = 0;
+    int status = 0;
+    int i;
 
-    // Parse command-line arguments
+    // Parse command-line arguments: <trace> [mode] [name=value ...]
     if (argc > 1) {
         filename = argv[1]; // Use the provided trace file name
     }
 
-    if (argc > 2) {
-        if (strcmp(argv[2], "normal") == 0) {
+    for (i = 2; i < argc; i++) {
+        if (strchr(argv[i], '=')) {
+            if (apply_option(argv[i]) != 0) {
+                return EXIT_FAILURE;
+            }
+        } else if (!mode) {
+            mode = argv[i];
+            mode_arg = i;
+        }
+    }
+
+    if (mode) {
+        if (strcmp(mode, "normal") == 0) {
             Mode = 1; // Enable normal mode
-        } else if (strcmp(argv[2], "silent") == 0) {
+        } else if (strcmp(mode, "silent") == 0) {
             Mode = 0; // Enable silent mode
+        } else if (strcmp(mode, "bench") == 0) {
+            // Time the trace readers against each other; no simulation is run
+            if (initialize_cache(&cache, cache_sets, cache_ways, cache_line_size, replacement_policy) != 0) {
+                return EXIT_FAILURE;
+            }
+            benchmark_trace_readers(filename);
+            free_cache(&cache);
+            return 0;
+        } else if (strcmp(mode, "convert") == 0) {
+            // Write a binary copy of the text trace: <trace> convert <output> [delta]
+            if (mode_arg + 1 >= argc) {
+                fprintf(stderr, "Error: convert needs an output file name.\n");
+                return EXIT_FAILURE;
+            }
+            int delta = (mode_arg + 2 < argc && strcmp(argv[mode_arg + 2], "delta") == 0);
+            return convert_trace_file(filename, argv[mode_arg + 1], delta) < 0 ? EXIT_FAILURE : 0;
+        } else if (strcmp(mode, "sweep") == 0) {
+            // Simulate several configurations in one pass: <trace> sweep <csv> <sets>x<ways>[x<linesize>][:<policy>] ...
+            if (mode_arg + 1 >= argc) {
+                fprintf(stderr, "Error: sweep needs an output file name.\n");
+                return EXIT_FAILURE;
+            }
+            // The readers still decompose addresses for the modeled cache
+            if (initialize_cache(&cache, cache_sets, cache_ways, cache_line_size, replacement_policy) != 0) {
+                return EXIT_FAILURE;
+            }
+            char *specs[argc];
+            int spec_count = 0;
+            for (i = mode_arg + 2; i < argc; i++) {
+                if (!strchr(argv[i], '=')) {
+                    specs[spec_count++] = argv[i];
+                }
+            }
+            // threads= (or shards=, which sweeps took first) sets the pool; 0 is one per CPU
+            int pool = threads_given ? parser_threads : (shard_threads > 1 ? shard_threads : 0);
+            int status = run_sweep(filename, argv[mode_arg + 1], specs, spec_count, replacement_policy, pool);
+            free_cache(&cache);
+            return status < 0 ? EXIT_FAILURE : 0;
+        } else if (strcmp(mode, "stackdist") == 0) {
+            // LRU hit ratios for 1..maxways ways in one pass: <trace> stackdist <csv> [maxways]
+            long depth = STACK_DISTANCE_DEPTH;
+            if (mode_arg + 1 >= argc) {
+                fprintf(stderr, "Error: stackdist needs an output file name.\n");
+                return EXIT_FAILURE;
+            }
+            if (mode_arg + 2 < argc && !strchr(argv[mode_arg + 2], '=') &&
+                parse_count_option("maxways", argv[mode_arg + 2], 1, STACK_DISTANCE_MAX_DEPTH, &depth) != 0) {
+                return EXIT_FAILURE;
+            }
+            // The readers still decompose addresses for the modeled cache, whose
+            // tag width limits do not apply here
+            if (initialize_cache(&cache, NUM_INDEXES, NUM_LINES_PER_INDEX, LINE_SIZE, POLICY_PLRU) != 0) {
+                return EXIT_FAILURE;
+            }
+            int status = run_stack_distance(filename, argv[mode_arg + 1], cache_sets, cache_line_size,
+                                            (unsigned int)depth);
+            free_cache(&cache);
+            return status < 0 ? EXIT_FAILURE : 0;
+        } else if (strcmp(mode, "decode") == 0) {
+            // Render a binary event log as text: <eventlog> decode [output]
+            const char *text_filename = (mode_arg + 1 < argc) ? argv[mode_arg + 1] : "simulation_output.txt";
+            return decode_event_log(filename, text_filename) < 0 ? EXIT_FAILURE : 0;
         } else {
-            fprintf(stderr, "Error: Invalid mode specified. Use 'normal' or 'silent'.\n");
+            fprintf(stderr, "Error: Invalid mode specified. Use 'normal', 'silent', 'bench', 'convert', 'sweep', 'stackdist' or 'decode'.\n");
             return EXIT_FAILURE;
         }
     }
 
-    // Open the output file for logging
-    output_file = fopen("simulation_output.txt", "w");
-    if (!output_file) {
-        fprintf(stderr, "Error: Could not create output file.\n");
+    // Shards run transactions out of trace order, so only the statistics and
+    // the cache dumps (which run between shard barriers) can be logged
+    if (shard_threads > 1 && log_level > LOG_STATS) {
+        if (log_level_given) {
+            fprintf(stderr, "Error: shards= only supports log=off or log=stats.\n");
+            return EXIT_FAILURE;
+        }
+        log_level = LOG_STATS;
+    }
+
+    // DRRIP's selector and the random draws belong to the whole cache, so shards
+    // would each learn and draw on their own and diverge from a serial run
+    if (shard_threads > 1 && (replacement_policy == POLICY_DRRIP || replacement_policy == POLICY_RANDOM)) {
+        fprintf(stderr, "Error: shards= supports policy=plru, lru or srrip only.\n");
+        return EXIT_FAILURE;
+    }
+    // ... and the same goes for bimodal insertion and the reuse predictor's tables
+    if (shard_threads > 1 && (insertion_policy == INSERT_BIP || bypass_signature != REUSE_OFF)) {
+        fprintf(stderr, "Error: shards= cannot be combined with insert=bip or bypass=.\n");
+        return EXIT_FAILURE;
+    }
+    // A prefetch fills other sets than the access that triggered it
+    if (shard_threads > 1 && prefetcher_kind != PREFETCH_OFF) {
+        fprintf(stderr, "Error: shards= cannot be combined with prefetch=.\n");
         return EXIT_FAILURE;
     }
 
-    fprintf(output_file, "Starting simulation with trace file: %s\n", filename);
+    // The shadow cache is fully associative, so it spans every shard's sets
+    if (shard_threads > 1 && classify_misses) {
+        fprintf(stderr, "Error: shards= cannot be combined with classify=.\n");
+        return EXIT_FAILURE;
+    }
 
-    // Initialize the cache
-    initialize_cache();
+    // Intervals end between two trace entries, which shards run out of step
+    if (shard_threads > 1 && interval_filename) {
+        fprintf(stderr, "Error: shards= cannot be combined with intervals=.\n");
+        return EXIT_FAILURE;
+    }
+
+    // The bus and its clock are shared by every set
+    if (shard_threads > 1 && timing_requested) {
+        fprintf(stderr, "Error: shards= cannot be combined with timing=.\n");
+        return EXIT_FAILURE;
+    }
+
+    // A snoop runs a peer's handlers in the middle of another cache's access,
+    // which a shard cannot do without the other shards' sets
+    if (shard_threads > 1 && cache_count > 1) {
+        fprintf(stderr, "Error: shards= cannot be combined with caches=.\n");
+        return EXIT_FAILURE;
+    }
 
-    // Read and process the trace file
+    // Size the cache before anything decomposes an address
+    if (initialize_cache(&cache, cache_sets, cache_ways, cache_line_size, replacement_policy) != 0) {
+        return EXIT_FAILURE;
+    }
+    cache.insertion = insertion_policy;
+    if ((bypass_signature != REUSE_OFF && initialize_reuse_predictor(&cache, bypass_signature) != 0) ||
+        (prefetcher_kind != PREFETCH_OFF && initialize_prefetcher(&cache, prefetcher_kind, prefetch_degree) != 0) ||
+        (classify_misses && initialize_miss_classifier(&cache) != 0)) {
+        free_cache(&cache);
+        return EXIT_FAILURE;
+    }
+    if (initialize_bus(cache_count) != 0) {
+        free_cache(&cache);
+        return EXIT_FAILURE;
+    }
+    if (snoop_filter_entries > 0) {
+        if (cache_count < 2) {
+            fprintf(stderr, "Error: snoopfilter= needs caches= of at least 2.\n");
+        }
+        if (cache_count < 2 || initialize_snoop_filter(snoop_filter_entries, cache_line_size) != 0) {
+            free_bus();
+            free_cache(&cache);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (dram_requested && initialize_dram() != 0) {
+        free_snoop_filter();
+        free_bus();
+        free_cache(&cache);
+        return EXIT_FAILURE;
+    }
+    if (timing_requested && initialize_timing() != 0) {
+        free_dram();
+        free_snoop_filter();
+        free_bus();
+        free_cache(&cache);
+        return EXIT_FAILURE;
+    }
+    // With intervalunit=clears an interval is one clear unless interval= says otherwise
+    if (interval_filename &&
+        open_interval_log(interval_filename,
+                          interval_length ? (uint64_t)interval_length : (interval_by_clears ? 1 : INTERVAL_ACCESSES),
+                          interval_by_clears) != 0) {
+        free_timing();
+        free_dram();
+        free_snoop_filter();
+        free_bus();
+        free_cache(&cache);
+        return EXIT_FAILURE;
+    }
+
+    // Open the output file for logging, or the binary event log if one was requested.
+    // With logging off there is nothing to write, so neither is created.
+    if (log_level == LOG_OFF) {
+        output_file = NULL;
+    } else if (event_log_filename) {
+        if (open_event_log(event_log_filename) != 0) {
+            fprintf(stderr, "Error: Could not create event log: %s\n", event_log_filename);
+            return EXIT_FAILURE;
+        }
+    } else {
+        output_file = fopen("simulation_output.txt", "w");
+        if (!output_file) {
+            fprintf(stderr, "Error: Could not create output file.\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    log_text("Starting simulation with trace file: %s\n", filename);
+
+    // Read and process the trace file, text or binary
     read_trace_file(filename);
 
-    fprintf(output_file, "Simulation completed successfully.\n");
+    log_text("Simulation completed successfully.\n");
+
+    if (interval_filename && close_interval_log(interval_filename) != 0) {
+        status = EXIT_FAILURE;
+    }
+    if (miss_class_filename && write_miss_class_csv(miss_class_filename) != 0) {
+        status = EXIT_FAILURE;
+    }
 
     // Close the output file
-    fclose(output_file);
-    num_cache_reads = 0;
-    num_cache_writes = 0;
-    num_cache_hits = 0;
-    num_cache_misses = 0;
+    if (event_log_filename) {
+        close_event_log();
+    } else if (output_file) {
+        fclose(output_file);
+    }
+    free_timing();
+    free_dram();
+    free_snoop_filter();
+    free_bus();
+    free_cache(&cache);
 
-    return 0;
+    return status;
 }
 
@@ -0,0 +1,338 @@
+#include "cache.h"
+#include <stdio.h>
+#include <string.h>
+
+// Three-C miss classification (classify=on). Every demand access of a cache
+// is also run through a shadow cache: fully associative, LRU, and holding as
+// many lines as the real one. A miss is then
+//   compulsory  the first access to its line (since the last clear),
+//   capacity    a miss the shadow cache also takes,
+//   conflict    a miss the shadow cache would have hit,
+//   coherence   the first miss on a line a snoop invalidated, which is a miss
+//               no size or associativity would have avoided.
+// A line the snoop filter recalls (a back-invalidation) was not wanted by a
+// peer, so it stays in the shadow cache and its next miss is capacity or
+// conflict like any other.
+// Conflict misses call for more ways or a better index; capacity misses only
+// for a larger cache.
+//
+// The shadow is a hash table of chained nodes threaded on an LRU list, so an
+// access costs a bucket lookup and a few index updates whatever its size.
+// Lines seen so far live in an open-addressed hash set that doubles when half
+// full.
+
+#define SHADOW_NONE UINT32_MAX
+
+// Shadow cache line: its list neighbours and the next node in its bucket
+typedef struct {
+    uint32_t line;
+    uint32_t prev;          // Towards the MRU end, SHADOW_NONE at the head
+    uint32_t next;          // Towards the LRU end, SHADOW_NONE at the tail; links the free list too
+    uint32_t chain;         // Next node in the same bucket, SHADOW_NONE at the end
+} ShadowLine;
+
+// Seen-line set entry
+typedef struct {
+    uint32_t line;          // Line number + 1, 0 if the slot is empty
+    uint32_t invalidated;   // A snoop took the line away and it has not missed since
+} SeenLine;
+
+struct MissClassifier {
+    ShadowLine *shadow;     // capacity nodes
+    uint32_t *buckets;      // First node of each bucket, SHADOW_NONE if empty
+    uint32_t bucket_mask;
+    uint32_t capacity;      // Lines the real cache holds
+    uint32_t resident;      // Lines in the shadow cache
+    uint32_t used;          // Nodes handed out so far; the rest have never been used
+    uint32_t free_list;     // Nodes given back by invalidations
+    uint32_t mru, lru;
+    SeenLine *seen;
+    uint32_t seen_mask;
+    uint32_t seen_count;
+    uint64_t *set_misses;   // Per set, misses of each MissClass
+};
+
+static const char *miss_class_names[MISS_CLASSES] = {"compulsory", "capacity", "conflict", "coherence"};
+static int seen_overflow;       // The seen set could not grow (reported once)
+
+static inline uint32_t hash_line(uint32_t line) {
+    return line * 0x9E3779B1u;
+}
+
+// Node holding `line` in the shadow cache, or SHADOW_NONE
+static uint32_t find_shadow(const MissClassifier *m, uint32_t line) {
+    uint32_t node = m->buckets[hash_line(line) & m->bucket_mask];
+    while (node != SHADOW_NONE && m->shadow[node].line != line) {
+        node = m->shadow[node].chain;
+    }
+    return node;
+}
+
+static void unlink_shadow(MissClassifier *m, uint32_t node) {
+    ShadowLine *s = &m->shadow[node];
+    uint32_t *link = &m->buckets[hash_line(s->line) & m->bucket_mask];
+
+    while (*link != node) {
+        link = &m->shadow[*link].chain;
+    }
+    *link = s->chain;
+    if (s->prev != SHADOW_NONE) {
+        m->shadow[s->prev].next = s->next;
+    } else {
+        m->mru = s->next;
+    }
+    if (s->next != SHADOW_NONE) {
+        m->shadow[s->next].prev = s->prev;
+    } else {
+        m->lru = s->prev;
+    }
+    m->resident--;
+}
+
+static void push_mru(MissClassifier *m, uint32_t node) {
+    ShadowLine *s = &m->shadow[node];
+
+    s->prev = SHADOW_NONE;
+    s->next = m->mru;
+    if (m->mru != SHADOW_NONE) {
+        m->shadow[m->mru].prev = node;
+    } else {
+        m->lru = node;
+    }
+    m->mru = node;
+}
+
+// Access `line` in the shadow cache. Returns 1 on a hit.
+static int touch_shadow(MissClassifier *m, uint32_t line) {
+    uint32_t node = find_shadow(m, line);
+    uint32_t *bucket;
+
+    if (node != SHADOW_NONE) {
+        if (node != m->mru) {
+            ShadowLine *s = &m->shadow[node];
+            m->shadow[s->prev].next = s->next;
+            if (s->next != SHADOW_NONE) {
+                m->shadow[s->next].prev = s->prev;
+            } else {
+                m->lru = s->prev;
+            }
+            push_mru(m, node);
+        }
+        return 1;
+    }
+
+    if (m->resident == m->capacity) {
+        node = m->lru;
+        unlink_shadow(m, node);
+    } else if (m->free_list != SHADOW_NONE) {
+        node = m->free_list;
+        m->free_list = m->shadow[node].next;
+    } else {
+        node = m->used++;
+    }
+    bucket = &m->buckets[hash_line(line) & m->bucket_mask];
+    m->shadow[node].line = line;
+    m->shadow[node].chain = *bucket;
+    *bucket = node;
+    push_mru(m, node);
+    m->resident++;
+    return 0;
+}
+
+// Slot of `line` in the seen set, or the empty slot it would go in
+static SeenLine *find_seen(const MissClassifier *m, uint32_t line) {
+    uint32_t i = hash_line(line) & m->seen_mask;
+    while (m->seen[i].line != 0 && m->seen[i].line != line + 1) {
+        i = (i + 1) & m->seen_mask;
+    }
+    return &m->seen[i];
+}
+
+// Double the seen set. Returns 0 on success; on failure the set stays as it was.
+static int grow_seen(MissClassifier *m) {
+    SeenLine *old = m->seen;
+    uint32_t old_size = m->seen_mask + 1;
+    uint32_t i;
+
+    m->seen = calloc((size_t)old_size * 2, sizeof(SeenLine));
+    if (!m->seen) {
+        m->seen = old;
+        return -1;
+    }
+    m->seen_mask = old_size * 2 - 1;
+    for (i = 0; i < old_size; i++) {
+        if (old[i].line != 0) {
+            *find_seen(m, old[i].line - 1) = old[i];
+        }
+    }
+    free(old);
+    return 0;
+}
+
+// Run the demand access `entry` through the shadow cache and, if the real
+// cache missed (`hit` is 0), count the miss in its class
+void classify_access(Cache *c, const TraceEntry *entry, int hit) {
+    MissClassifier *m = c->miss_classifier;
+    uint32_t line = entry->address >> c->offset_bits;
+    int shadow_hit = touch_shadow(m, line);
+    SeenLine *seen = find_seen(m, line);
+    MissClass kind;
+
+    if (seen->line == 0) {
+        seen->line = line + 1;
+        m->seen_count++;
+        if (m->seen_count > m->seen_mask / 2 && grow_seen(m) != 0) {
+            // Out of memory: forget the line rather than let the table fill up,
+            // so its misses count as compulsory again
+            if (!seen_overflow) {
+                fprintf(stderr, "Error: Out of memory growing the seen-line set; some misses will count as compulsory.\n");
+                seen_overflow = 1;
+            }
+            m->seen_count--;
+            seen->line = 0;
+        }
+        kind = MISS_COMPULSORY;
+    } else if (seen->invalidated) {
+        seen->invalidated = 0; // Back in the cache, by this miss or by a prefetch
+        kind = MISS_COHERENCE;
+    } else {
+        kind = shadow_hit ? MISS_CONFLICT : MISS_CAPACITY;
+    }
+    if (!hit) {
+        c->stats.num_class_misses[kind]++;
+        m->set_misses[(size_t)entry->parsed_addr.index * MISS_CLASSES + kind]++;
+    }
+}
+
+// A snoop invalidated the line at `Address`: it leaves the shadow cache too,
+// and its next miss is a coherence miss
+void classifier_invalidate(Cache *c, unsigned int Address) {
+    MissClassifier *m = c->miss_classifier;
+    uint32_t line = Address >> c->offset_bits;
+    uint32_t node = find_shadow(m, line);
+    SeenLine *seen = find_seen(m, line);
+
+    if (node != SHADOW_NONE) {
+        unlink_shadow(m, node);
+        m->shadow[node].next = m->free_list;
+        m->free_list = node;
+    }
+    if (seen->line != 0) {
+        seen->invalidated = 1;
+    }
+}
+
+// The cache was cleared: the shadow empties and every line is new again
+void classifier_clear(Cache *c) {
+    MissClassifier *m = c->miss_classifier;
+
+    memset(m->buckets, 0xFF, ((size_t)m->bucket_mask + 1) * sizeof(uint32_t));
+    memset(m->seen, 0, ((size_t)m->seen_mask + 1) * sizeof(SeenLine));
+    m->resident = 0;
+    m->used = 0;
+    m->free_list = SHADOW_NONE;
+    m->mru = SHADOW_NONE;
+    m->lru = SHADOW_NONE;
+    m->seen_count = 0;
+}
+
+// Classify the misses of cache `c` from now on. Returns 0 on success.
+int initialize_miss_classifier(Cache *c) {
+    MissClassifier *m = calloc(1, sizeof(MissClassifier));
+    uint32_t buckets = 1;
+
+    c->miss_classifier = m;
+    if (!m) {
+        fprintf(stderr, "Error: Out of memory allocating the miss classifier.\n");
+        return -1;
+    }
+    m->capacity = c->num_sets * c->num_ways;
+    while (buckets < 2 * m->capacity) {
+        buckets <<= 1;
+    }
+    m->bucket_mask = buckets - 1;
+    m->seen_mask = buckets - 1; // Resized as the trace touches more lines
+    m->shadow = malloc((size_t)m->capacity * sizeof(ShadowLine));
+    m->buckets = malloc((size_t)buckets * sizeof(uint32_t));
+    m->seen = malloc((size_t)buckets * sizeof(SeenLine));
+    m->set_misses = calloc((size_t)c->num_sets * MISS_CLASSES, sizeof(uint64_t));
+    if (!m->shadow || !m->buckets || !m->seen || !m->set_misses) {
+        fprintf(stderr, "Error: Out of memory allocating the miss classifier.\n");
+        return -1;
+    }
+    classifier_clear(c);
+    return 0;
+}
+
+void free_miss_classifier(Cache *c) {
+    MissClassifier *m = c->miss_classifier;
+
+    if (m) {
+        free(m->shadow);
+        free(m->buckets);
+        free(m->seen);
+        free(m->set_misses);
+        free(m);
+        c->miss_classifier = NULL;
+    }
+}
+
+const char *miss_class_name(MissClass kind) {
+    return miss_class_names[kind];
+}
+
+// How the conflict misses of `c` spread over its sets: returns the number of
+// sets that took any, and the most one set took in `worst`
+unsigned int conflict_miss_sets(const Cache *c, uint64_t *worst) {
+    unsigned int set, count = 0;
+
+    *worst = 0;
+    for (set = 0; set < c->num_sets; set++) {
+        uint64_t conflicts = c->miss_classifier->set_misses[(size_t)set * MISS_CLASSES + MISS_CONFLICT];
+        count += (conflicts != 0);
+        if (conflicts > *worst) {
+            *worst = conflicts;
+        }
+    }
+    return count;
+}
+
+// Write each cache's misses by class for every set that missed at all. Returns 0 on success.
+int write_miss_class_csv(const char *csv_filename) {
+    FILE *csv = fopen(csv_filename, "w");
+    int i, k;
+    unsigned int set;
+
+    if (!csv) {
+        fprintf(stderr, "Error: Could not create file: %s\n", csv_filename);
+        return -1;
+    }
+    fprintf(csv, "cache,set,misses");
+    for (k = 0; k < MISS_CLASSES; k++) {
+        fprintf(csv, ",%s", miss_class_names[k]);
+    }
+    fprintf(csv, "\n");
+    for (i = 0; i < num_caches; i++) {
+        const Cache *c = bus_caches[i];
+        for (set = 0; set < c->num_sets; set++) {
+            const uint64_t *counts = &c->miss_classifier->set_misses[(size_t)set * MISS_CLASSES];
+            uint64_t misses = 0;
+            for (k = 0; k < MISS_CLASSES; k++) {
+                misses += counts[k];
+            }
+            if (misses == 0) {
+                continue;
+            }
+            fprintf(csv, "%d,%u,%llu", i, set, (unsigned long long)misses);
+            for (k = 0; k < MISS_CLASSES; k++) {
+                fprintf(csv, ",%llu", (unsigned long long)counts[k]);
+            }
+            fprintf(csv, "\n");
+        }
+    }
+    if (fclose(csv) != 0) {
+        fprintf(stderr, "Error: Could not write file: %s\n", csv_filename);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,209 @@
+#include "cache.h"
+#include <stdio.h>
+#include <string.h>
+
+// Hardware prefetchers. Each watches the demand reads and instruction fetches
+// of one cache and asks prefetch_line() for the lines it expects next; the
+// cache fills them through its miss path and keeps the score (see cache.c).
+// Prefetches never leave the aligned PREFETCH_REGION_BITS region (the page) of
+// the access that triggered them.
+
+// Stride table entry: the last line accessed in a region and the distance
+// between its last two accesses
+typedef struct {
+    uint32_t region;        // Region number + 1, 0 if the entry is free
+    uint32_t last_line;
+    int32_t stride;         // In lines
+    uint8_t confidence;     // Times in a row the stride repeated
+} StrideEntry;
+
+// Stream tracker: a run of misses moving through memory in one direction
+typedef struct {
+    uint32_t head;          // Line of the latest miss in the stream
+    uint32_t next;          // Next line to prefetch
+    int direction;          // +1 or -1, 0 until a second miss shows it
+    uint64_t stamp;         // Last use, for LRU replacement; 0 if free
+} Stream;
+
+struct Prefetcher {
+    StrideEntry strides[PREFETCH_STRIDE_ENTRIES];
+    Stream streams[PREFETCH_STREAMS];
+    uint64_t clock;
+};
+
+static const char *prefetcher_names[] = {"off", "next", "stride", "stream"};
+
+const char *prefetcher_name(PrefetcherKind kind) {
+    return prefetcher_names[kind];
+}
+
+// Prefetcher named `name`, or -1
+int parse_prefetcher(const char *name) {
+    int kind;
+    for (kind = PREFETCH_OFF; kind <= PREFETCH_STREAM; kind++) {
+        if (strcmp(name, prefetcher_names[kind]) == 0) {
+            return kind;
+        }
+    }
+    return -1;
+}
+
+// Lines per prefetch region; 1 when lines are a region or larger, so nothing is prefetched
+static inline unsigned int region_shift(const Cache *c) {
+    return c->offset_bits < PREFETCH_REGION_BITS ? PREFETCH_REGION_BITS - c->offset_bits : 0;
+}
+
+// Prefetch line number `line` if it is in the same region as `from`. Returns 0
+// once the region ends, so a caller walking away from `from` can stop.
+static int issue_prefetch(Cache *c, const TraceEntry *trigger, uint32_t from, int64_t line) {
+    unsigned int shift = region_shift(c);
+
+    if (line < 0 || (uint64_t)line >> shift != from >> shift) {
+        return 0;
+    }
+    prefetch_line(c, (unsigned int)line << c->offset_bits, trigger);
+    return 1;
+}
+
+// Next-line: the `degree` lines after a miss
+static void next_line_prefetch(Cache *c, const TraceEntry *entry, uint32_t line) {
+    unsigned int k;
+    for (k = 1; k <= c->prefetch_degree; k++) {
+        if (!issue_prefetch(c, entry, line, (int64_t)line + k)) {
+            break;
+        }
+    }
+}
+
+// Stride: every access trains its region's entry. Once the same nonzero stride
+// has repeated PREFETCH_STRIDE_CONFIDENCE times, the next `degree` lines along
+// it are prefetched.
+static void stride_prefetch(Cache *c, const TraceEntry *entry, uint32_t line) {
+    uint32_t region = (line >> region_shift(c)) + 1;
+    StrideEntry *e = &c->prefetcher->strides[(region * 0x9E3779B1u) >> (32 - __builtin_ctz(PREFETCH_STRIDE_ENTRIES))];
+    int32_t delta;
+    unsigned int k;
+
+    if (e->region != region) {
+        e->region = region;
+        e->last_line = line;
+        e->stride = 0;
+        e->confidence = 0;
+        return;
+    }
+    delta = (int32_t)(line - e->last_line);
+    if (delta == 0) {
+        return; // Another access to the same line
+    }
+    e->last_line = line;
+    if (delta == e->stride) {
+        e->confidence += e->confidence < PREFETCH_STRIDE_CONFIDENCE;
+    } else {
+        e->stride = delta;
+        e->confidence = 0;
+        return;
+    }
+    if (e->confidence < PREFETCH_STRIDE_CONFIDENCE) {
+        return;
+    }
+    for (k = 1; k <= c->prefetch_degree; k++) {
+        if (!issue_prefetch(c, entry, line, (int64_t)line + (int64_t)e->stride * k)) {
+            break;
+        }
+    }
+}
+
+// Stream: a miss within PREFETCH_STREAM_WINDOW lines of a stream's head joins
+// it (ahead of the head once the direction is known); any other miss starts a
+// new stream in place of the least recently used one. The second miss of a
+// stream sets its direction, and from then on every miss moves the stream up
+// to `degree` lines further ahead, at most PREFETCH_STREAM_DISTANCE lines in
+// front of the demand accesses.
+static void stream_prefetch(Cache *c, const TraceEntry *entry, uint32_t line) {
+    Prefetcher *p = c->prefetcher;
+    Stream *s = NULL, *oldest = &p->streams[0];
+    unsigned int i, k;
+
+    for (i = 0; i < PREFETCH_STREAMS; i++) {
+        Stream *t = &p->streams[i];
+        int64_t ahead = ((int64_t)line - t->head) * (t->direction ? t->direction : 1);
+
+        if (t->stamp != 0 &&
+            (t->direction ? ahead >= 0 : ahead >= -PREFETCH_STREAM_WINDOW) && ahead <= PREFETCH_STREAM_WINDOW) {
+            s = t;
+            break;
+        }
+        if (t->stamp < oldest->stamp) {
+            oldest = t;
+        }
+    }
+    if (!s) {
+        oldest->head = line;
+        oldest->direction = 0;
+        oldest->stamp = ++p->clock;
+        return;
+    }
+
+    s->stamp = ++p->clock;
+    if (s->direction == 0) {
+        if (line == s->head) {
+            return;
+        }
+        s->direction = line > s->head ? 1 : -1;
+        s->next = line + s->direction;
+    }
+    s->head = line;
+    if (((int64_t)s->next - line) * s->direction <= 0) {
+        s->next = line + s->direction; // The demand accesses caught up
+    }
+    for (k = 0; k < c->prefetch_degree; k++) {
+        if (((int64_t)s->next - line) * s->direction > PREFETCH_STREAM_DISTANCE ||
+            !issue_prefetch(c, entry, line, (int64_t)s->next)) {
+            break;
+        }
+        s->next += s->direction;
+    }
+}
+
+// Show the prefetcher a demand read or fetch. `triggered` is set for a miss
+// and for the first hit on a prefetched line, which is a miss the prefetcher
+// hid; the next-line and stream prefetchers only act on those, while the
+// stride table learns from every access.
+void train_prefetcher(Cache *c, const TraceEntry *entry, int triggered) {
+    uint32_t line = entry->address >> c->offset_bits;
+
+    c->prefetch_clock++;
+    switch (c->prefetch_kind) {
+        case PREFETCH_NEXT_LINE:
+            if (triggered) {
+                next_line_prefetch(c, entry, line);
+            }
+            break;
+        case PREFETCH_STRIDE:
+            stride_prefetch(c, entry, line);
+            break;
+        case PREFETCH_STREAM:
+            if (triggered) {
+                stream_prefetch(c, entry, line);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+// Put a `kind` prefetcher in front of cache `c`, prefetching up to `degree`
+// lines per trigger. Returns 0 on success.
+int initialize_prefetcher(Cache *c, PrefetcherKind kind, unsigned int degree) {
+    c->prefetch_kind = kind;
+    c->prefetch_degree = degree;
+    c->prefetcher = calloc(1, sizeof(Prefetcher));
+    c->prefetched_ways = calloc(c->num_sets, sizeof(WayMask));
+    c->prefetch_issued = calloc((size_t)c->num_sets * c->num_ways, sizeof(uint32_t));
+    c->prefetch_victims = calloc(PREFETCH_VICTIM_ENTRIES, sizeof(uint32_t));
+    if (!c->prefetcher || !c->prefetched_ways || !c->prefetch_issued || !c->prefetch_victims) {
+        fprintf(stderr, "Error: Out of memory allocating the prefetcher.\n");
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,160 @@
+#include "cache.h"
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+// One simulation worker. The reader thread is the only producer and the worker
+// the only consumer of its queue, so the queue needs no lock.
+typedef struct {
+    _Alignas(64) _Atomic size_t head;   // Entries published by the reader thread
+    _Alignas(64) _Atomic size_t tail;   // Entries the worker has finished
+    _Alignas(64) size_t pending;        // Entries written but not yet published
+    _Atomic int done;                   // Set once the trace has ended
+    TraceEntry *entries;
+    // The worker's copy of the cache: the same line, PLRU and bitmap storage,
+    // but counters of its own
+    Cache view;
+    pthread_t worker;
+} Shard;
+
+static Shard *shards;
+static int shard_count;
+int shard_engine_active = 0;
+
+// Run the queue until the trace ends. Every entry for a set comes through this
+// one queue, so each set still sees its accesses in trace order.
+static void *shard_worker(void *arg) {
+    Shard *shard = arg;
+    size_t tail = atomic_load_explicit(&shard->tail, memory_order_relaxed);
+
+    for (;;) {
+        size_t head = atomic_load_explicit(&shard->head, memory_order_acquire);
+
+        if (head == tail) {
+            if (atomic_load_explicit(&shard->done, memory_order_acquire) &&
+                atomic_load_explicit(&shard->head, memory_order_acquire) == tail) {
+                break;
+            }
+            sched_yield();
+            continue;
+        }
+        for (; tail != head; tail++) {
+            dispatch_trace_entry(&shard->view, &shard->entries[tail & (SHARD_QUEUE_SIZE - 1)]);
+        }
+        atomic_store_explicit(&shard->tail, tail, memory_order_release);
+    }
+    return NULL;
+}
+
+static void publish_entries(Shard *shard) {
+    atomic_store_explicit(&shard->head, shard->pending, memory_order_release);
+}
+
+// Give the worker a fresh copy of the cache (a clear moves the epoch on),
+// keeping the counters it has gathered so far
+static void refresh_view(Shard *shard) {
+    CacheStats stats = shard->view.stats;
+    shard->view = cache;
+    shard->view.stats = stats;
+}
+
+// Wait until every shard has run everything queued so far. Afterwards the
+// reader thread has the whole cache to itself until it queues more entries.
+static void drain_shards() {
+    int s;
+    for (s = 0; s < shard_count; s++) {
+        publish_entries(&shards[s]);
+    }
+    for (s = 0; s < shard_count; s++) {
+        while (atomic_load_explicit(&shards[s].tail, memory_order_acquire) != shards[s].pending) {
+            sched_yield();
+        }
+    }
+}
+
+// Split the simulation across `count` worker threads by set. Returns 0 when
+// the workers are running; otherwise the trace is simulated on this thread.
+int start_shard_engine(int count) {
+    int s;
+
+    // Keep each shard's queue indices on their own cache lines
+    shards = aligned_alloc(_Alignof(Shard), (size_t)count * sizeof(Shard));
+    if (!shards) {
+        fprintf(stderr, "Warning: Out of memory starting %d shards; simulating on one thread\n", count);
+        return -1;
+    }
+    memset(shards, 0, (size_t)count * sizeof(Shard));
+    for (s = 0; s < count; s++) {
+        Shard *shard = &shards[s];
+        shard->entries = malloc(SHARD_QUEUE_SIZE * sizeof(TraceEntry));
+        shard->view = cache;
+        memset(&shard->view.stats, 0, sizeof(shard->view.stats));
+        if (!shard->entries || pthread_create(&shard->worker, NULL, shard_worker, shard) != 0) {
+            free(shard->entries);
+            break;
+        }
+    }
+    shard_count = s;
+    if (shard_count < count) {
+        fprintf(stderr, "Warning: Could not start %d shards; simulating on one thread\n", count);
+        stop_shard_engine();
+        return -1;
+    }
+    shard_engine_active = 1;
+    return 0;
+}
+
+// Finish the queued work, stop the workers and add their counters into the cache's
+void stop_shard_engine() {
+    int s;
+
+    for (s = 0; s < shard_count; s++) {
+        publish_entries(&shards[s]);
+        atomic_store_explicit(&shards[s].done, 1, memory_order_release);
+    }
+    for (s = 0; s < shard_count; s++) {
+        CacheStats *stats = &shards[s].view.stats;
+        pthread_join(shards[s].worker, NULL);
+        add_cache_stats(&cache.stats, stats);
+        free(shards[s].entries);
+    }
+    free(shards);
+    shards = NULL;
+    shard_count = 0;
+    shard_engine_active = 0;
+}
+
+// Queue an entry on the shard that owns its set. Clears and prints touch every
+// set, so they wait for all shards to catch up and run on this thread.
+void shard_trace_entry(TraceEntry *entry) {
+    int s;
+
+    switch (entry->operation_code) {
+        case 0: case 1: case 2: case 3: case 4: case 5: case 6: {
+            Shard *shard = &shards[(entry->parsed_addr.index / SHARD_SET_BLOCK) % (unsigned int)shard_count];
+
+            // Queue full: let the worker catch up
+            if (shard->pending - atomic_load_explicit(&shard->tail, memory_order_acquire) >= SHARD_QUEUE_SIZE) {
+                publish_entries(shard);
+                while (shard->pending - atomic_load_explicit(&shard->tail, memory_order_acquire) >= SHARD_QUEUE_SIZE) {
+                    sched_yield();
+                }
+            }
+            shard->entries[shard->pending & (SHARD_QUEUE_SIZE - 1)] = *entry;
+            shard->pending++;
+            if (shard->pending % SHARD_BATCH == 0) {
+                publish_entries(shard);
+            }
+            break;
+        }
+        default:
+            drain_shards();
+            dispatch_trace_entry(&cache, entry);
+            for (s = 0; s < shard_count; s++) {
+                refresh_view(&shards[s]);
+            }
+            break;
+    }
+}
@@ -0,0 +1,162 @@
+#include "cache.h"
+#include <stdio.h>
+#include <string.h>
+
+// Inclusive snoop filter: a set-associative table of the lines some cache on
+// the bus may hold, with a presence bit per cache. A bus request is snooped
+// only by the caches whose bit is set instead of being broadcast.
+//
+// A cache's bit is set when it fills the line and cleared when it evicts the
+// line, clears, or a snoop finds it gone, so a cache holding a line always has
+// its bit set, while a set bit may be stale. When a set
+// of the filter is full its least recently used entry is evicted, and the line
+// is invalidated in every cache still holding it (a back-invalidation).
+typedef struct {
+    unsigned int num_sets;
+    unsigned int offset_bits;
+    uint32_t *lines;        // Line number (Address >> offset_bits) of each entry
+    uint64_t *presence;     // Caches that may hold the line; 0 marks a free entry
+    uint64_t *stamps;       // Last use of each entry, for LRU replacement
+    uint64_t clock;
+} SnoopFilter;
+
+static SnoopFilter filter;
+int snoop_filter_active = 0;
+SnoopFilterStats snoop_filter_stats;
+
+// Slot of the entry tracking `line`, or -1
+static long find_filter_entry(uint32_t line) {
+    size_t first = (size_t)(line & (filter.num_sets - 1)) * SNOOP_FILTER_WAYS;
+    unsigned int w;
+
+    for (w = 0; w < SNOOP_FILTER_WAYS; w++) {
+        if (filter.presence[first + w] != 0 && filter.lines[first + w] == line) {
+            return (long)(first + w);
+        }
+    }
+    return -1;
+}
+
+// Take a free entry of the line's set, or evict the least recently used one
+// and back-invalidate its line. Returns the slot, now tracking `line` with no
+// caches present.
+static size_t allocate_filter_entry(uint32_t line) {
+    size_t first = (size_t)(line & (filter.num_sets - 1)) * SNOOP_FILTER_WAYS;
+    size_t slot = first;
+    unsigned int w;
+
+    for (w = 0; w < SNOOP_FILTER_WAYS; w++) {
+        if (filter.presence[first + w] == 0) {
+            slot = first + w;
+            break;
+        }
+        if (filter.stamps[first + w] < filter.stamps[slot]) {
+            slot = first + w;
+        }
+    }
+
+    if (filter.presence[slot] == 0) {
+        snoop_filter_stats.occupancy++;
+        if (snoop_filter_stats.occupancy > snoop_filter_stats.peak_occupancy) {
+            snoop_filter_stats.peak_occupancy = snoop_filter_stats.occupancy;
+        }
+    } else {
+        // The filter is inclusive: nobody may keep a line it stops tracking
+        uint64_t holders = filter.presence[slot];
+        unsigned int victim = filter.lines[slot] << filter.offset_bits;
+
+        filter.presence[slot] = 0;
+        snoop_filter_stats.back_invalidations++;
+        while (holders) {
+            int i = __builtin_ctzll(holders);
+            holders &= holders - 1;
+            if (recall_line(bus_caches[i], victim) != NOHIT) {
+                snoop_filter_stats.back_invalidated_lines++;
+            }
+        }
+    }
+    filter.lines[slot] = line;
+    return slot;
+}
+
+// The peers of `requester` that may hold the line at `Address`: the caches a
+// bus request for it must be snooped by
+uint64_t snoop_filter_sharers(int requester, unsigned int Address) {
+    long slot = find_filter_entry(Address >> filter.offset_bits);
+    uint64_t sharers = 0;
+    int sent;
+
+    snoop_filter_stats.lookups++;
+    if (slot >= 0) {
+        snoop_filter_stats.hits++;
+        sharers = filter.presence[slot] & ~((uint64_t)1 << requester);
+    }
+    sent = __builtin_popcountll(sharers);
+    snoop_filter_stats.snoops_sent += (uint64_t)sent;
+    snoop_filter_stats.snoops_filtered += (uint64_t)(num_caches - 1 - sent);
+    return sharers;
+}
+
+// Record the outcome of a bus request from `requester`, which now holds the
+// line: shared after a READ, alone after an RWIM or INVALIDATE. Peers in
+// `not_holding` answered the snoop without the line and lose their bit.
+void snoop_filter_update(int requester, int BusOp, unsigned int Address, uint64_t not_holding) {
+    uint32_t line = Address >> filter.offset_bits;
+    long slot = find_filter_entry(line);
+    uint64_t self = (uint64_t)1 << requester;
+
+    snoop_filter_stats.stale_snoops += (uint64_t)__builtin_popcountll(not_holding);
+    if (slot < 0) {
+        slot = (long)allocate_filter_entry(line);
+    }
+    if (BusOp == READ) {
+        filter.presence[slot] = (filter.presence[slot] & ~not_holding) | self;
+    } else {
+        filter.presence[slot] = self;
+    }
+    filter.stamps[slot] = ++filter.clock;
+}
+
+// `holder` evicted the line at `Address`
+void snoop_filter_drop(int holder, unsigned int Address) {
+    long slot = find_filter_entry(Address >> filter.offset_bits);
+
+    if (slot >= 0) {
+        filter.presence[slot] &= ~((uint64_t)1 << holder);
+        if (filter.presence[slot] == 0) {
+            snoop_filter_stats.occupancy--;
+        }
+    }
+}
+
+// Track up to `entries` lines of `line_size` bytes (a power of two of at least
+// SNOOP_FILTER_WAYS). Returns 0 on success.
+int initialize_snoop_filter(unsigned int entries, unsigned int line_size) {
+    memset(&filter, 0, sizeof(filter));
+    memset(&snoop_filter_stats, 0, sizeof(snoop_filter_stats));
+    if (entries < SNOOP_FILTER_WAYS || (entries & (entries - 1)) != 0) {
+        fprintf(stderr, "Error: snoopfilter must be a power of two of at least %d entries.\n", SNOOP_FILTER_WAYS);
+        return -1;
+    }
+    filter.num_sets = entries / SNOOP_FILTER_WAYS;
+    filter.offset_bits = (unsigned int)__builtin_ctz(line_size);
+    filter.lines = calloc(entries, sizeof(uint32_t));
+    filter.presence = calloc(entries, sizeof(uint64_t));
+    filter.stamps = calloc(entries, sizeof(uint64_t));
+    if (!filter.lines || !filter.presence || !filter.stamps) {
+        fprintf(stderr, "Error: Out of memory allocating a %u-entry snoop filter.\n", entries);
+        free_snoop_filter();
+        return -1;
+    }
+    snoop_filter_stats.capacity = entries;
+    snoop_filter_active = 1;
+    return 0;
+}
+
+void free_snoop_filter() {
+    free(filter.lines);
+    free(filter.presence);
+    free(filter.stamps);
+    memset(&filter, 0, sizeof(filter));
+    snoop_filter_active = 0;
+}
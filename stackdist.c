@@ -0,0 +1,396 @@
+#include "cache.h"
+#include <stdio.h>
+#include <string.h>
+
+// Per-set LRU stacks for stack-distance analysis, capped at `depth` lines.
+// Rather than keeping each stack in order, every line remembers the value of
+// its set's access counter when it was last touched, and each set keeps a
+// Fenwick tree over those times with a 1 wherever a line's last access is. A
+// line's stack distance is then the number of 1s after its time, which costs
+// O(log depth) however deep the stack. A hash table maps a set and tag to the
+// line's time.
+//
+// A set's times run up to a window of at most 2 * depth. When the counter
+// reaches the window the set's lines are renumbered 1..n in order, growing the
+// window while more than half of it is in use, so a set costs memory for the
+// lines it has held rather than for `depth` lines.
+typedef struct {
+    uint32_t index;                 // Set and tag of the line
+    uint32_t tag;
+    uint32_t time;                  // Its last access in the set; 0 marks an empty slot
+    uint32_t epoch;                 // Clear it belongs to; older entries are dead
+} StackLine;
+
+typedef struct {
+    uint32_t *tree;                 // Fenwick tree over times 1..window
+    uint32_t *tag_at;               // Tag accessed at each time
+    uint32_t window;                // Times before the next renumbering; 0 until first touched
+    uint32_t clock;                 // Last time handed out
+    uint32_t live;                  // Lines in the stack
+    uint32_t epoch;                 // Lazy clear, as in the cache model
+} SetStack;
+
+typedef struct {
+    unsigned int num_sets;
+    unsigned int depth;             // Deepest stack position tracked (largest associativity reported)
+    unsigned int offset_bits;
+    unsigned int tag_shift;
+    unsigned int index_mask;
+    SetStack *sets;
+    StackLine *lines;               // Open-addressed, linear probing
+    uint32_t line_mask;
+    uint32_t line_count;            // Slots in use, dead ones included
+    uint32_t epoch;
+    int out_of_memory;
+    uint64_t *histogram;            // Accesses at each distance; [depth] is cold or deeper
+    uint64_t accesses;
+} StackDistance;
+
+static StackDistance stack;
+int stack_distance_active = 0;
+
+#define STACK_FIRST_WINDOW 16
+#define STACK_FIRST_LINES 1024
+
+static inline uint32_t hash_stack_line(uint32_t index, uint32_t tag) {
+    return (index * 0x9E3779B1u) ^ (tag * 0x85EBCA77u);
+}
+
+// Slot of the line `tag` of set `index`, or the empty slot it would go in.
+// An entry from before the last clear is as good as empty and is reused.
+static StackLine *find_stack_line(const StackDistance *sd, uint32_t index, uint32_t tag) {
+    uint32_t i = hash_stack_line(index, tag) & sd->line_mask;
+    while (sd->lines[i].time != 0 && (sd->lines[i].index != index || sd->lines[i].tag != tag)) {
+        i = (i + 1) & sd->line_mask;
+    }
+    return &sd->lines[i];
+}
+
+static inline int stack_line_live(const StackDistance *sd, const StackLine *line) {
+    return line->time != 0 && line->epoch == sd->epoch;
+}
+
+// Empty a slot, moving later entries of its probe run back so lookups still find them
+static void delete_stack_line(StackDistance *sd, StackLine *line) {
+    uint32_t hole = (uint32_t)(line - sd->lines);
+    uint32_t i = hole;
+
+    for (;;) {
+        uint32_t home;
+        i = (i + 1) & sd->line_mask;
+        if (sd->lines[i].time == 0) {
+            break;
+        }
+        home = hash_stack_line(sd->lines[i].index, sd->lines[i].tag) & sd->line_mask;
+        // Move the entry unless its home lies cyclically in (hole, i]
+        if (((i - home) & sd->line_mask) >= ((i - hole) & sd->line_mask)) {
+            sd->lines[hole] = sd->lines[i];
+            hole = i;
+        }
+    }
+    sd->lines[hole].time = 0;
+    sd->line_count--;
+}
+
+// Rebuild the table at a size fit for its live entries, dropping dead ones.
+// Returns 0 on success; on failure the table stays as it was.
+static int resize_stack_lines(StackDistance *sd) {
+    StackLine *old = sd->lines;
+    uint32_t old_size = sd->line_mask + 1;
+    uint32_t live = 0, size = STACK_FIRST_LINES;
+    uint32_t i;
+
+    for (i = 0; i < old_size; i++) {
+        live += stack_line_live(sd, &old[i]);
+    }
+    while (size < 4 * (uint64_t)live) {
+        size <<= 1;
+    }
+    sd->lines = calloc(size, sizeof(StackLine));
+    if (!sd->lines) {
+        sd->lines = old;
+        return -1;
+    }
+    sd->line_mask = size - 1;
+    sd->line_count = live;
+    for (i = 0; i < old_size; i++) {
+        if (stack_line_live(sd, &old[i])) {
+            *find_stack_line(sd, old[i].index, old[i].tag) = old[i];
+        }
+    }
+    free(old);
+    return 0;
+}
+
+static inline void fenwick_add(uint32_t *tree, uint32_t window, uint32_t time, int delta) {
+    for (; time <= window; time += time & -time) {
+        tree[time] += (uint32_t)delta;
+    }
+}
+
+// Lines last touched at or before `time`
+static inline uint32_t fenwick_prefix(const uint32_t *tree, uint32_t time) {
+    uint32_t sum = 0;
+    for (; time > 0; time -= time & -time) {
+        sum += tree[time];
+    }
+    return sum;
+}
+
+// Earliest time still holding a line: the bottom of the stack
+static inline uint32_t fenwick_oldest(const uint32_t *tree, uint32_t window) {
+    uint32_t time = 0, step;
+    for (step = 1u << (31 - __builtin_clz(window)); step > 0; step >>= 1) {
+        if (time + step <= window && tree[time + step] == 0) {
+            time += step;
+        }
+    }
+    return time + 1;
+}
+
+// Give the set's lines times 1..live in their current order, moving to a
+// window of `window` times. Returns 0 on success.
+static int renumber_set(StackDistance *sd, uint32_t index, uint32_t window) {
+    SetStack *set = &sd->sets[index];
+    uint32_t *tree = calloc((size_t)window + 1, sizeof(uint32_t));
+    uint32_t *tag_at = malloc(((size_t)window + 1) * sizeof(uint32_t));
+    uint32_t time, next = 0;
+
+    if (!tree || !tag_at) {
+        free(tree);
+        free(tag_at);
+        return -1;
+    }
+    for (time = 1; time <= set->clock; time++) {
+        StackLine *line = find_stack_line(sd, index, set->tag_at[time]);
+        if (stack_line_live(sd, line) && line->time == time) {
+            line->time = ++next;
+            tag_at[next] = set->tag_at[time];
+        }
+    }
+    // Linear-time build of a tree whose first `next` times are set
+    for (time = 1; time <= window; time++) {
+        uint32_t parent = time + (time & -time);
+        tree[time] += (time <= next);
+        if (parent <= window) {
+            tree[parent] += tree[time];
+        }
+    }
+    free(set->tree);
+    free(set->tag_at);
+    set->tree = tree;
+    set->tag_at = tag_at;
+    set->window = window;
+    set->clock = next;
+    return 0;
+}
+
+// Get set `index` ready to hand out a new time: empty it if it dates from
+// before the last clear, renumber it if its window is used up. Returns 0 on success.
+static int prepare_set(StackDistance *sd, uint32_t index) {
+    SetStack *set = &sd->sets[index];
+    uint32_t window = set->window;
+
+    if (set->epoch != sd->epoch) {
+        set->clock = 0;
+        set->live = 0;
+        set->epoch = sd->epoch;
+        if (set->tree) {
+            memset(set->tree, 0, ((size_t)set->window + 1) * sizeof(uint32_t));
+        }
+    }
+    if (window == 0) {
+        window = 2 * sd->depth < STACK_FIRST_WINDOW ? 2 * sd->depth : STACK_FIRST_WINDOW;
+    } else if (set->clock < window) {
+        return 0;
+    } else if (2 * set->live > window && window < 2 * sd->depth) {
+        window = window * 2 < 2 * sd->depth ? window * 2 : 2 * sd->depth;
+    }
+    return renumber_set(sd, index, window);
+}
+
+static void report_stack_memory() {
+    if (!stack.out_of_memory) {
+        fprintf(stderr, "Error: Out of memory in the stack-distance analysis; results are incomplete.\n");
+        stack.out_of_memory = 1;
+    }
+}
+
+// Record an access to `tag` in set `index` and return its stack distance
+// (0 for the most recently used line), or depth if it is cold or deeper
+static unsigned int touch_stack(StackDistance *sd, unsigned int index, uint32_t tag) {
+    SetStack *set = &sd->sets[index];
+    unsigned int distance = sd->depth;
+    StackLine *line;
+
+    if (prepare_set(sd, index) != 0) {
+        report_stack_memory();
+        return distance;
+    }
+    line = find_stack_line(sd, index, tag);
+    if (stack_line_live(sd, line)) {
+        distance = set->live - fenwick_prefix(set->tree, line->time);
+        fenwick_add(set->tree, set->window, line->time, -1);
+        set->live--;
+    } else {
+        if (set->live == sd->depth) {
+            // Push out the line at the bottom of the stack
+            uint32_t oldest = fenwick_oldest(set->tree, set->window);
+            fenwick_add(set->tree, set->window, oldest, -1);
+            set->live--;
+            delete_stack_line(sd, find_stack_line(sd, index, set->tag_at[oldest]));
+        }
+        if (2 * (sd->line_count + 1) > sd->line_mask + 1 && resize_stack_lines(sd) != 0) {
+            report_stack_memory();
+            return distance;
+        }
+        line = find_stack_line(sd, index, tag);
+        if (line->time == 0) {
+            sd->line_count++;
+        }
+        line->index = index;
+        line->tag = tag;
+        line->epoch = sd->epoch;
+    }
+    line->time = ++set->clock;
+    set->tag_at[line->time] = tag;
+    fenwick_add(set->tree, set->window, line->time, 1);
+    set->live++;
+    return distance;
+}
+
+// A snooped invalidation takes the line out of every cache size at once, so it
+// is dropped from the stack and the lines below it move up. This is an
+// approximation: a real cache of a given size would keep the hole instead.
+static void remove_from_stack(StackDistance *sd, unsigned int index, uint32_t tag) {
+    SetStack *set = &sd->sets[index];
+    StackLine *line = find_stack_line(sd, index, tag);
+
+    if (stack_line_live(sd, line)) {
+        fenwick_add(set->tree, set->window, line->time, -1);
+        set->live--;
+        delete_stack_line(sd, line);
+    }
+}
+
+// Feed one trace entry to the analysis. Reads, writes and instruction fetches
+// are accesses; snooped RWIMs and invalidates remove the line and a clear
+// empties every stack. Everything else leaves the stacks alone.
+void stack_distance_entry(const TraceEntry *entry) {
+    unsigned int index = (entry->address >> stack.offset_bits) & stack.index_mask;
+    uint32_t tag = entry->address >> stack.tag_shift;
+
+    switch (entry->operation_code) {
+        case 0: case 1: case 2:
+            stack.histogram[touch_stack(&stack, index, tag)]++;
+            stack.accesses++;
+            break;
+        case 5: case 6:
+            remove_from_stack(&stack, index, tag);
+            break;
+        case 8:
+            stack.epoch++;
+            if (stack.epoch == 0) {
+                unsigned int set;
+                memset(stack.lines, 0, ((size_t)stack.line_mask + 1) * sizeof(StackLine));
+                stack.line_count = 0;
+                for (set = 0; set < stack.num_sets; set++) {
+                    stack.sets[set].epoch = UINT32_MAX;
+                }
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static void free_stack_distance() {
+    unsigned int set;
+
+    for (set = 0; stack.sets && set < stack.num_sets; set++) {
+        free(stack.sets[set].tree);
+        free(stack.sets[set].tag_at);
+    }
+    free(stack.sets);
+    free(stack.lines);
+    free(stack.histogram);
+    memset(&stack, 0, sizeof(stack));
+}
+
+// One row per associativity 1..depth: an LRU cache of that many ways (and the
+// same sets and line size) hits every access whose distance is below it
+static int write_stack_distance_csv(const char *csv_filename, unsigned int line_size) {
+    FILE *csv = fopen(csv_filename, "w");
+    uint64_t hits = 0;
+    unsigned int ways;
+
+    if (!csv) {
+        fprintf(stderr, "Error: Could not create file: %s\n", csv_filename);
+        return -1;
+    }
+    fprintf(csv, "sets,ways,linesize,policy,size_bytes,accesses,hits,misses,hit_ratio\n");
+    for (ways = 1; ways <= stack.depth; ways++) {
+        hits += stack.histogram[ways - 1];
+        fprintf(csv, "%u,%u,%u,lru,%llu,%llu,%llu,%llu,%.4f\n",
+                stack.num_sets, ways, line_size,
+                (unsigned long long)stack.num_sets * ways * line_size,
+                (unsigned long long)stack.accesses, (unsigned long long)hits,
+                (unsigned long long)(stack.accesses - hits),
+                stack.accesses ? (double)hits / stack.accesses : 0.0);
+    }
+    if (fclose(csv) != 0) {
+        fprintf(stderr, "Error: Could not write file: %s\n", csv_filename);
+        return -1;
+    }
+    return 0;
+}
+
+// Compute LRU hit ratios for every associativity from 1 to `depth` at the given
+// set count and line size in one pass over the trace, and write them to
+// `csv_filename`. Nothing is logged. Returns 0 on success.
+int run_stack_distance(const char *trace_filename, const char *csv_filename,
+                       unsigned int sets, unsigned int line_size, unsigned int depth) {
+    unsigned int index_bits;
+    int status;
+
+    if (sets == 0 || (sets & (sets - 1)) != 0 || line_size == 0 || (line_size & (line_size - 1)) != 0) {
+        fprintf(stderr, "Error: sets and linesize must be powers of two.\n");
+        return -1;
+    }
+    memset(&stack, 0, sizeof(stack));
+    index_bits = (unsigned int)__builtin_ctz(sets);
+    stack.num_sets = sets;
+    stack.depth = depth;
+    stack.offset_bits = (unsigned int)__builtin_ctz(line_size);
+    stack.tag_shift = stack.offset_bits + index_bits;
+    stack.index_mask = sets - 1;
+    if (stack.tag_shift >= 32) {
+        fprintf(stderr, "Error: sets * linesize must be below 4 GB (32-bit addresses).\n");
+        return -1;
+    }
+
+    stack.sets = calloc(sets, sizeof(SetStack));
+    stack.lines = calloc(STACK_FIRST_LINES, sizeof(StackLine));
+    stack.line_mask = STACK_FIRST_LINES - 1;
+    stack.histogram = calloc((size_t)depth + 1, sizeof(uint64_t));
+    if (!stack.sets || !stack.lines || !stack.histogram) {
+        fprintf(stderr, "Error: Out of memory allocating %u stacks of depth %u.\n", sets, depth);
+        free_stack_distance();
+        return -1;
+    }
+
+    // The readers hand every entry to stack_distance_entry()
+    log_level = LOG_OFF;
+    shard_threads = 1;
+    stack_distance_active = 1;
+    read_trace_file(trace_filename);
+    stack_distance_active = 0;
+
+    status = write_stack_distance_csv(csv_filename, line_size);
+    if (status == 0) {
+        printf("Stack distance: %llu accesses, %u sets, 1 to %u ways -> %s\n",
+               (unsigned long long)stack.accesses, sets, depth, csv_filename);
+    }
+    free_stack_distance();
+    return status;
+}
@@ -0,0 +1,315 @@
+#include "cache.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+// One slot of the batch ring: trace records every sweep thread runs through
+// all of its configurations
+typedef struct {
+    TraceBinRecord *records;
+    size_t count;
+    int pending;            // Sweep threads still working on this batch
+} SweepBatch;
+
+typedef struct {
+    Cache *configs;
+    int config_count;
+    int threads;
+    SweepBatch slots[SWEEP_BATCHES];
+    size_t published;       // Batches handed to the sweep threads
+    size_t filled;          // Records in the batch being filled (slot published % SWEEP_BATCHES)
+    size_t entries;         // Trace records seen
+    int done;               // The trace has ended; no more batches
+    pthread_mutex_t lock;
+    pthread_cond_t batch_ready;
+    pthread_cond_t slot_free;
+} Sweep;
+
+typedef struct {
+    Sweep *sweep;
+    int first;              // Runs configs[first], configs[first + threads], ...
+} SweepWorker;
+
+static Sweep sweep;
+int sweep_active = 0;
+
+// Parse "<sets>x<ways>[x<linesize>][:<policy>]"; `policy` is left alone when
+// the spec does not name one. Returns 0 on success.
+static int parse_sweep_spec(const char *spec, unsigned int *sets, unsigned int *ways, unsigned int *line_size,
+                            ReplacementPolicy *policy) {
+    unsigned long n[3] = {0, 0, LINE_SIZE};
+    const char *p = spec;
+    int fields = 0;
+
+    while (fields < 3) {
+        char *end;
+        n[fields++] = strtoul(p, &end, 0);
+        if (end == p || n[fields - 1] == 0 || n[fields - 1] > (1UL << 26)) {
+            return -1;
+        }
+        p = end;
+        if (*p != 'x') {
+            break;
+        }
+        p++;
+    }
+    if (*p == ':') {
+        int named = parse_replacement_policy(p + 1);
+        if (named < 0) {
+            return -1;
+        }
+        *policy = (ReplacementPolicy)named;
+    } else if (*p != '\0') {
+        return -1;
+    }
+    if (fields < 2) {
+        return -1;
+    }
+    *sets = (unsigned int)n[0];
+    *ways = (unsigned int)n[1];
+    *line_size = (unsigned int)n[2];
+    return 0;
+}
+
+// Run one batch through one configuration
+static void run_sweep_batch(Cache *c, const TraceBinRecord *record, size_t count) {
+    const TraceBinRecord *last = record + count;
+    TraceEntry entry;
+
+    memset(&entry, 0, sizeof(entry));
+    for (; record < last; record++) {
+        entry.operation_code = record->operation_code;
+        entry.address = record->address;
+        entry.parsed_addr = decompose_cache_address(c, record->address);
+        dispatch_trace_entry(c, &entry);
+    }
+}
+
+// Sweep thread: every batch, in order, through each of its configurations
+static void *sweep_thread(void *arg) {
+    SweepWorker *worker = arg;
+    Sweep *s = worker->sweep;
+    size_t b;
+
+    for (b = 0;; b++) {
+        SweepBatch *batch = &s->slots[b % SWEEP_BATCHES];
+        int k;
+
+        pthread_mutex_lock(&s->lock);
+        while (b >= s->published && !s->done) {
+            pthread_cond_wait(&s->batch_ready, &s->lock);
+        }
+        if (b >= s->published) {
+            pthread_mutex_unlock(&s->lock);
+            break;
+        }
+        pthread_mutex_unlock(&s->lock);
+
+        for (k = worker->first; k < s->config_count; k += s->threads) {
+            run_sweep_batch(&s->configs[k], batch->records, batch->count);
+        }
+
+        pthread_mutex_lock(&s->lock);
+        if (--batch->pending == 0) {
+            pthread_cond_broadcast(&s->slot_free);
+        }
+        pthread_mutex_unlock(&s->lock);
+    }
+    return NULL;
+}
+
+// Hand the batch being filled to the sweep threads
+static void publish_sweep_batch() {
+    SweepBatch *batch = &sweep.slots[sweep.published % SWEEP_BATCHES];
+
+    pthread_mutex_lock(&sweep.lock);
+    batch->count = sweep.filled;
+    batch->pending = sweep.threads;
+    sweep.published++;
+    sweep.filled = 0;
+    pthread_cond_broadcast(&sweep.batch_ready);
+    pthread_mutex_unlock(&sweep.lock);
+}
+
+// Append a decoded entry to the current batch. Only the operation and address
+// are kept; every configuration splits the address its own way.
+void sweep_trace_entry(const TraceEntry *entry) {
+    SweepBatch *batch = &sweep.slots[sweep.published % SWEEP_BATCHES];
+    TraceBinRecord *record;
+
+    if (sweep.filled == 0) {
+        // Starting a batch: wait until every thread is done with the slot's last one
+        pthread_mutex_lock(&sweep.lock);
+        while (batch->pending > 0) {
+            pthread_cond_wait(&sweep.slot_free, &sweep.lock);
+        }
+        pthread_mutex_unlock(&sweep.lock);
+    }
+    record = &batch->records[sweep.filled++];
+    record->address = entry->address;
+    // Codes that do not fit a byte are unknown to the handlers either way
+    record->operation_code = (entry->operation_code < 0 || entry->operation_code > 255) ?
+                             255 : (uint8_t)entry->operation_code;
+    sweep.entries++;
+    if (sweep.filled == SWEEP_BATCH_SIZE) {
+        publish_sweep_batch();
+    }
+}
+
+// Write one CSV row per configuration
+static int write_sweep_csv(const char *csv_filename) {
+    FILE *csv = fopen(csv_filename, "w");
+    int k;
+
+    if (!csv) {
+        fprintf(stderr, "Error: Could not create file: %s\n", csv_filename);
+        return -1;
+    }
+    fprintf(csv, "sets,ways,linesize,policy,size_bytes,reads,writes,hits,misses,hit_ratio\n");
+    for (k = 0; k < sweep.config_count; k++) {
+        const Cache *c = &sweep.configs[k];
+        const CacheStats *stats = &c->stats;
+        uint64_t accesses = stats->num_cache_reads + stats->num_cache_writes;
+        fprintf(csv, "%u,%u,%u,%s,%llu,%llu,%llu,%llu,%llu,%.4f\n",
+                c->num_sets, c->num_ways, c->line_size, replacement_policy_name(c->policy),
+                (unsigned long long)c->num_sets * c->num_ways * c->line_size,
+                (unsigned long long)stats->num_cache_reads, (unsigned long long)stats->num_cache_writes,
+                (unsigned long long)stats->num_cache_hits, (unsigned long long)stats->num_cache_misses,
+                accesses ? (double)stats->num_cache_hits / accesses : 0.0);
+    }
+    if (fclose(csv) != 0) {
+        fprintf(stderr, "Error: Could not write file: %s\n", csv_filename);
+        return -1;
+    }
+    return 0;
+}
+
+static void free_sweep() {
+    int k;
+    for (k = 0; k < sweep.config_count; k++) {
+        free_cache(&sweep.configs[k]);
+    }
+    for (k = 0; k < SWEEP_BATCHES; k++) {
+        free(sweep.slots[k].records);
+    }
+    free(sweep.configs);
+    pthread_cond_destroy(&sweep.slot_free);
+    pthread_cond_destroy(&sweep.batch_ready);
+    pthread_mutex_destroy(&sweep.lock);
+}
+
+// Simulate every configuration in `specs` from a single read of the trace and
+// write their statistics to `csv_filename`. Configurations that name no policy
+// use `policy`. The configurations are spread over `thread_count` threads, or
+// one per CPU if it is 0. Nothing is logged. Returns 0 on success.
+int run_sweep(const char *trace_filename, const char *csv_filename, char **specs, int spec_count,
+              ReplacementPolicy policy, int thread_count) {
+    SweepWorker *workers;
+    pthread_t *threads;
+    int started = 0;
+    int status = 0;
+    int k;
+
+    if (spec_count < 1) {
+        fprintf(stderr, "Error: sweep needs at least one <sets>x<ways>[x<linesize>][:<policy>] configuration.\n");
+        return -1;
+    }
+
+    memset(&sweep, 0, sizeof(sweep));
+    pthread_mutex_init(&sweep.lock, NULL);
+    pthread_cond_init(&sweep.batch_ready, NULL);
+    pthread_cond_init(&sweep.slot_free, NULL);
+    sweep.configs = calloc((size_t)spec_count, sizeof(Cache));
+    if (!sweep.configs) {
+        fprintf(stderr, "Error: Out of memory allocating %d configurations.\n", spec_count);
+        free_sweep();
+        return -1;
+    }
+    for (k = 0; k < spec_count; k++) {
+        unsigned int sets, ways, line_size;
+        ReplacementPolicy config_policy = policy;
+        if (parse_sweep_spec(specs[k], &sets, &ways, &line_size, &config_policy) != 0) {
+            fprintf(stderr, "Error: Bad sweep configuration '%s'; expected <sets>x<ways>[x<linesize>][:<policy>].\n",
+                    specs[k]);
+            free_sweep();
+            return -1;
+        }
+        if (initialize_cache(&sweep.configs[k], sets, ways, line_size, config_policy) != 0) {
+            fprintf(stderr, "Error: in sweep configuration '%s'.\n", specs[k]);
+            free_sweep();
+            return -1;
+        }
+        sweep.config_count++;
+    }
+    for (k = 0; k < SWEEP_BATCHES; k++) {
+        sweep.slots[k].records = malloc(SWEEP_BATCH_SIZE * sizeof(TraceBinRecord));
+        if (!sweep.slots[k].records) {
+            fprintf(stderr, "Error: Out of memory allocating the sweep batches.\n");
+            free_sweep();
+            return -1;
+        }
+    }
+
+    sweep.threads = thread_count > 0 ? thread_count : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (sweep.threads < 1) {
+        sweep.threads = 1;
+    }
+    if (sweep.threads > sweep.config_count) {
+        sweep.threads = sweep.config_count;
+    }
+    workers = malloc((size_t)sweep.threads * sizeof(SweepWorker));
+    threads = malloc((size_t)sweep.threads * sizeof(pthread_t));
+    if (!workers || !threads) {
+        fprintf(stderr, "Error: Out of memory starting the sweep threads.\n");
+        free(workers);
+        free(threads);
+        free_sweep();
+        return -1;
+    }
+    for (k = 0; k < sweep.threads; k++) {
+        workers[k].sweep = &sweep;
+        workers[k].first = k;
+        if (pthread_create(&threads[k], NULL, sweep_thread, &workers[k]) != 0) {
+            break;
+        }
+        started++;
+    }
+    if (started < sweep.threads) {
+        // Let the threads that did start see an empty trace and leave
+        fprintf(stderr, "Error: Could not start %d sweep threads.\n", sweep.threads);
+        status = -1;
+    } else {
+        // The readers hand every entry to sweep_trace_entry(); with logging
+        // off the model's own cache only decomposes addresses for them
+        log_level = LOG_OFF;
+        shard_threads = 1;
+        parser_threads = 1; // The sweep threads have the cores
+        sweep_active = 1;
+        read_trace_file(trace_filename);
+        sweep_active = 0;
+        if (sweep.filled > 0) {
+            publish_sweep_batch();
+        }
+    }
+
+    pthread_mutex_lock(&sweep.lock);
+    sweep.done = 1;
+    pthread_cond_broadcast(&sweep.batch_ready);
+    pthread_mutex_unlock(&sweep.lock);
+    for (k = 0; k < started; k++) {
+        pthread_join(threads[k], NULL);
+    }
+
+    if (status == 0) {
+        status = write_sweep_csv(csv_filename);
+    }
+    if (status == 0) {
+        printf("Sweep: %zu trace records through %d configurations on %d threads -> %s\n",
+               sweep.entries, sweep.config_count, sweep.threads, csv_filename);
+    }
+    free(workers);
+    free(threads);
+    free_sweep();
+    return status;
+}
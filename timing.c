@@ -0,0 +1,366 @@
+#include "cache.h"
+#include <stdio.h>
+#include <string.h>
+
+// Timing layer. Every cache on the bus has a clock and issues its demand
+// accesses one at a time: an access starts when the cache's previous one has
+// finished. An access pays the hit latency for the lookup, then waits for each
+// bus operation it puts on the bus in turn. The bus is shared: the model keeps
+// the stretches of cycles it is held, and an operation takes the first idle
+// stretch long enough for it from the cycle it is ready. Operations are still
+// granted in trace order, but one whose cache's clock lags the others can use
+// the gaps they left rather than queue behind them; a grant already made is
+// never moved for it, though.
+//
+// Operations nobody waits for (write-backs answering a snoop, prefetches and
+// the write-backs of a clear) still hold the bus, from the moment the access
+// in progress reached them.
+//
+// With mshrs= the caches do not block. A cache issues an access every
+// issue_interval cycles (or at its t= cycle, if later), and each miss takes a
+// miss status holding register until its data arrives. The MSHR file is an
+// event queue of those arrivals, ordered by cycle; the events up to an
+// access's issue cycle retire before it looks at the file. An access to a
+// line still on its way merges into its MSHR and completes with it, and a
+// miss that finds every MSHR taken stalls the cache until the earliest one
+// retires. The cache's lines and states still change in trace order; only
+// the timing overlaps.
+
+// Cycles [start, end) the bus is held
+typedef struct {
+    uint64_t start;
+    uint64_t end;
+} BusInterval;
+
+// One outstanding miss: the line and the cycle its data arrives
+typedef struct {
+    uint64_t ready;
+    uint32_t line;
+} MshrEvent;
+
+struct MshrFile {
+    MshrEvent *events;      // Min-heap on `ready`
+    unsigned int count;
+    uint64_t last;          // Cycle the occupancy counters have been brought up to
+};
+
+TimingConfig timing_config = {
+    TIMING_HIT_LATENCY, TIMING_MEMORY_LATENCY, TIMING_BUS_ARBITRATION,
+    {0, TIMING_BUS_READ, TIMING_BUS_WRITE, TIMING_BUS_INVALIDATE, TIMING_BUS_RWIM},
+    TIMING_WRITEBACK, TIMING_SNOOP_DELAY, TIMING_MSHRS, TIMING_ISSUE_INTERVAL
+};
+int timing_active = 0;
+TimingStats timing_stats;
+
+static Cache *timed_cache;      // Cache whose demand access is being timed, or NULL
+static uint64_t merged_ready;   // Arrival of the MSHR that access merged into, 0 if none
+static int needs_mshr;          // That access misses and has taken an MSHR
+static uint32_t access_line;    // Line number of that access
+static uint64_t timing_now;     // Where that access has got to: background work starts here
+static BusInterval *bus_busy;   // Held stretches in cycle order, apart and none before bus_horizon
+static unsigned int bus_busy_count;
+static uint64_t bus_horizon;    // The bus counts as held before this cycle
+
+static void note_elapsed(uint64_t cycle) {
+    if (cycle > timing_stats.elapsed) {
+        timing_stats.elapsed = cycle;
+    }
+}
+
+// Count `file`'s outstanding misses up to `cycle`
+static void integrate_mshrs(MshrFile *file, uint64_t cycle) {
+    if (cycle > file->last) {
+        timing_stats.mshr_occupancy_cycles += file->count * (cycle - file->last);
+        timing_stats.mshr_busy_cycles += file->count ? cycle - file->last : 0;
+        file->last = cycle;
+    }
+}
+
+// Take the earliest event off the heap
+static void pop_mshr(MshrFile *file) {
+    MshrEvent moved = file->events[--file->count];
+    unsigned int i = 0;
+
+    for (;;) {
+        unsigned int child = 2 * i + 1;
+        if (child >= file->count) {
+            break;
+        }
+        if (child + 1 < file->count && file->events[child + 1].ready < file->events[child].ready) {
+            child++;
+        }
+        if (moved.ready <= file->events[child].ready) {
+            break;
+        }
+        file->events[i] = file->events[child];
+        i = child;
+    }
+    if (file->count > 0) {
+        file->events[i] = moved;
+    }
+}
+
+static void push_mshr(MshrFile *file, uint32_t line, uint64_t ready) {
+    unsigned int i = file->count++;
+
+    while (i > 0 && file->events[(i - 1) / 2].ready > ready) {
+        file->events[i] = file->events[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    file->events[i].ready = ready;
+    file->events[i].line = line;
+    if (file->count > timing_stats.mshr_peak) {
+        timing_stats.mshr_peak = file->count;
+    }
+}
+
+// Retire every miss whose data has arrived by `cycle`
+static void retire_mshrs(MshrFile *file, uint64_t cycle) {
+    while (file->count > 0 && file->events[0].ready <= cycle) {
+        integrate_mshrs(file, file->events[0].ready);
+        pop_mshr(file);
+    }
+    integrate_mshrs(file, cycle);
+}
+
+// Index of the first held stretch that ends after `cycle`
+static unsigned int find_bus_interval(uint64_t cycle) {
+    unsigned int lo = 0, hi = bus_busy_count;
+
+    while (lo < hi) {
+        unsigned int mid = (lo + hi) / 2;
+        if (bus_busy[mid].end <= cycle) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Hold the bus for `hold` cycles from the first cycle at or after `ready`
+// that leaves it free that long. Returns that cycle.
+static uint64_t grant_bus(uint64_t ready, unsigned int hold) {
+    uint64_t start = ready > bus_horizon ? ready : bus_horizon;
+    unsigned int i;
+
+    for (i = find_bus_interval(start); i < bus_busy_count && bus_busy[i].start < start + hold; i++) {
+        start = bus_busy[i].end;
+    }
+
+    // The new stretch goes between i - 1 and i, joined to whichever it touches
+    if (i > 0 && bus_busy[i - 1].end == start) {
+        bus_busy[i - 1].end = start + hold;
+        if (i < bus_busy_count && bus_busy[i].start == start + hold) {
+            bus_busy[i - 1].end = bus_busy[i].end;
+            memmove(&bus_busy[i], &bus_busy[i + 1], (bus_busy_count - i - 1) * sizeof(BusInterval));
+            bus_busy_count--;
+        }
+    } else if (i < bus_busy_count && bus_busy[i].start == start + hold) {
+        bus_busy[i].start = start;
+    } else {
+        memmove(&bus_busy[i + 1], &bus_busy[i], (bus_busy_count - i) * sizeof(BusInterval));
+        bus_busy[i].start = start;
+        bus_busy[i].end = start + hold;
+        bus_busy_count++;
+        if (bus_busy_count > TIMING_BUS_INTERVALS) {
+            // Out of room: forget the oldest stretch and the gaps before it
+            bus_horizon = bus_busy[0].end;
+            memmove(&bus_busy[0], &bus_busy[1], (bus_busy_count - 1) * sizeof(BusInterval));
+            bus_busy_count--;
+        }
+    }
+    return start;
+}
+
+// Forget the stretches that end before any operation can be ready: before
+// every cache's clock and the point background work starts from
+static void prune_bus_intervals() {
+    uint64_t floor = timing_now;
+    unsigned int drop;
+    int i;
+
+    for (i = 0; i < num_caches; i++) {
+        if (bus_caches[i]->clock < floor) {
+            floor = bus_caches[i]->clock;
+        }
+    }
+    drop = find_bus_interval(floor);
+    // Only once half the list can go, so the moves cost O(1) per stretch
+    if (drop > 0 && 2 * drop >= bus_busy_count) {
+        memmove(&bus_busy[0], &bus_busy[drop], (bus_busy_count - drop) * sizeof(BusInterval));
+        bus_busy_count -= drop;
+    }
+}
+
+// Cache `c` issues the demand access `entry`. A non-blocking cache first
+// retires what has arrived, merges the access into an outstanding miss for
+// its line, or finds it an MSHR, stalling while none is free. Returns the
+// cycle the access issued.
+uint64_t timing_begin_access(Cache *c, const TraceEntry *entry) {
+    uint64_t start = entry->time > c->clock ? entry->time : c->clock;
+    MshrFile *file = c->mshr_file;
+
+    merged_ready = 0;
+    needs_mshr = 0;
+    prune_bus_intervals();
+    if (file) {
+        unsigned int i;
+
+        access_line = entry->address >> c->offset_bits;
+        retire_mshrs(file, start);
+        for (i = 0; i < file->count; i++) {
+            if (file->events[i].line == access_line) {
+                merged_ready = file->events[i].ready;
+                break;
+            }
+        }
+        if (!merged_ready && !cache_holds_line(c, entry)) {
+            needs_mshr = 1;
+            if (file->count == timing_config.mshrs) {
+                uint64_t freed = file->events[0].ready;
+                timing_stats.mshr_full_stalls++;
+                timing_stats.mshr_stall_cycles += freed - start;
+                retire_mshrs(file, freed);
+                start = freed;
+            }
+        }
+    }
+
+    timed_cache = c;
+    c->clock = start;
+    c->clock += timing_config.hit_latency;
+    timing_now = c->clock;
+    return start;
+}
+
+// The demand access `c` issued at `start` has finished. `operation_code` is
+// its trace operation: 0 read, 1 write, 2 instruction fetch.
+void timing_end_access(Cache *c, int operation_code, uint64_t start) {
+    uint64_t done = c->clock > merged_ready ? c->clock : merged_ready;
+
+    timing_stats.accesses[operation_code]++;
+    timing_stats.access_cycles[operation_code] += done - start;
+    timed_cache = NULL;
+    timing_now = c->clock;
+    note_elapsed(done);
+    if (!c->mshr_file) {
+        return; // Blocking: the next access waits for this one
+    }
+
+    timing_stats.mshr_merges += (merged_ready != 0);
+    if (needs_mshr) {
+        timing_stats.mshr_misses++;
+        push_mshr(c->mshr_file, access_line, done);
+    }
+    c->clock = start + timing_config.issue_interval;
+}
+
+// Stop or resume timing the access in progress, so what happens in between
+// is background work. Returns the cache that was being timed.
+Cache *timing_detach(Cache *resume) {
+    Cache *was = timed_cache;
+    timed_cache = resume;
+    return was;
+}
+
+// Bus operation `BusOp` for `Address` from `c`, whose snoop came back
+// `SnoopResult`. It is granted arbitration plus its occupancy at the first
+// idle stretch of the bus long enough for them. If it belongs to the access being timed, the access then waits for the
+// snoop responses and for the data: from memory, or from the peer that
+// answered HITM. A write-back costs the access timing_config.writeback more.
+// With the DRAM backend, memory reads take as long as DRAM says, and every
+// read and write-back memory sees occupies its bank whoever waits for it.
+void timing_bus_operation(Cache *c, int BusOp, unsigned int Address, int SnoopResult) {
+    int critical = (c == timed_cache);
+    uint64_t ready = critical ? c->clock : timing_now;
+    unsigned int hold = timing_config.bus_arbitration + timing_config.bus_occupancy[BusOp];
+    uint64_t start = grant_bus(ready, hold);
+    uint64_t bus_free = start + hold;   // Cycle this operation lets go of the bus
+
+    timing_stats.bus_operations[BusOp]++;
+    timing_stats.bus_queue_cycles[BusOp] += start - ready;
+    timing_stats.bus_busy_cycles += hold;
+    note_elapsed(bus_free);
+
+    if (BusOp == WRITE) {
+        if (dram_active) {
+            note_elapsed(dram_access(Address, 1, bus_free));
+        }
+        if (critical) {
+            c->clock = bus_free + timing_config.writeback;
+        }
+    } else if (BusOp == READ || BusOp == RWIM) {
+        uint64_t data = bus_free + timing_config.snoop_delay;
+        if (SnoopResult != HITM) {
+            data = dram_active ? dram_access(Address, 0, data) : data + timing_config.memory_latency;
+        }
+        note_elapsed(data);
+        if (critical) {
+            c->clock = data;
+        }
+    } else if (critical) {
+        c->clock = bus_free + timing_config.snoop_delay;
+    }
+    if (critical) {
+        timing_now = c->clock;
+    }
+}
+
+// Start every clock and the bus at cycle 0, give each cache its MSHRs if
+// mshrs= asked for them, and clear the statistics. Returns 0 on success.
+int initialize_timing() {
+    int i;
+
+    memset(&timing_stats, 0, sizeof(timing_stats));
+    timed_cache = NULL;
+    timing_now = 0;
+    bus_busy_count = 0;
+    bus_horizon = 0;
+    bus_busy = malloc((TIMING_BUS_INTERVALS + 1) * sizeof(BusInterval));
+    if (!bus_busy) {
+        fprintf(stderr, "Error: Out of memory allocating the bus timeline.\n");
+        return -1;
+    }
+    for (i = 0; i < num_caches; i++) {
+        Cache *c = bus_caches[i];
+        c->clock = 0;
+        if (timing_config.mshrs > 0) {
+            c->mshr_file = calloc(1, sizeof(MshrFile));
+            if (!c->mshr_file || !(c->mshr_file->events = malloc(timing_config.mshrs * sizeof(MshrEvent)))) {
+                fprintf(stderr, "Error: Out of memory allocating %u MSHRs.\n", timing_config.mshrs);
+                free_timing();
+                return -1;
+            }
+        }
+    }
+    timing_active = 1;
+    return 0;
+}
+
+// Retire every miss still outstanding at the end of the trace
+void finish_timing() {
+    int i;
+    for (i = 0; i < num_caches; i++) {
+        MshrFile *file = bus_caches[i]->mshr_file;
+        while (file && file->count > 0) {
+            retire_mshrs(file, file->events[0].ready);
+        }
+    }
+}
+
+void free_timing() {
+    int i;
+
+    free(bus_busy);
+    bus_busy = NULL;
+    for (i = 0; i < num_caches; i++) {
+        Cache *c = bus_caches[i];
+        if (c->mshr_file) {
+            free(c->mshr_file->events);
+            free(c->mshr_file);
+            c->mshr_file = NULL;
+        }
+    }
+    timing_active = 0;
+}
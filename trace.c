@@ -1,6 +1,13 @@
 #include "cache.h"
 #include <stdio.h>
+#include <ctype.h>
+#include <stdarg.h>
 #include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 // Function to get operation name from operation code
@@ -19,42 +26,175 @@ const char *get_operation_name(int code) {
     }
 }
 
-// Function to parse a trace line
-int parse_trace_line(const char *line, TraceEntry *entry) {
-    int items_parsed;
-    unsigned int address;
-    int operation_code;
-    char extra_input[256]; // To detect extra content in the line
+static inline int is_trace_space(unsigned char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
 
-    // Reset the TraceEntry structure
-    memset(entry, 0, sizeof(TraceEntry));
+static inline int hex_digit_value(unsigned char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c |= 0x20; // Fold to lower case
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
 
-    // Check for empty or whitespace-only lines
-    const char *current = line;
-    while (isspace(*current)) {
-        current++;
+// Tokenize "<opcode> <hex address> [name=value ...]" straight out of the input buffer.
+// The opcode and address are accepted exactly as sscanf("%d %x %s") used to accept
+// them, and the result is the number of items it would have converted: 0 (no opcode),
+// 1 (no address), 2 (valid line) or 3 (trailing garbage, which now includes an
+// unknown or malformed name=value field). Blank and whitespace-only lines return
+// TRACE_LINE_EMPTY. Fields the line does not give are set to their defaults.
+int scan_trace_fields(const char *p, const char *end, int *operation_code, unsigned int *address,
+                      TraceExtras *extras) {
+    unsigned int value;
+    int negative;
+    int digit;
+
+    while (p < end && is_trace_space(*p)) {
+        p++;
     }
-    if (*current == '\0' || *current == '\n') {
-        fprintf(stderr, "Error: Line contains only whitespace or is empty: '%s'\n", line);
-        fprintf(output_file, "Error: Line contains only whitespace or is empty: '%s'\n", line);
-        return -1; // Error for empty or whitespace-only lines
+    if (p == end || *p == '\0') {
+        return TRACE_LINE_EMPTY;
     }
 
-    // Try to parse the line with operation code and address
-    items_parsed = sscanf(line, "%d %x %s", &operation_code, &address, extra_input);
+    // Operation code: optional sign followed by decimal digits
+    negative = 0;
+    if (*p == '+' || *p == '-') {
+        negative = (*p == '-');
+        p++;
+    }
+    if (p == end || (unsigned char)(*p - '0') > 9) {
+        return 0;
+    }
+    value = 0;
+    do {
+        value = value * 10 + (unsigned int)(*p - '0');
+        p++;
+    } while (p < end && (unsigned char)(*p - '0') <= 9);
+    *operation_code = negative ? -(int)value : (int)value;
 
-    // Validate the number of items parsed
-    if (items_parsed == 0) {
-        fprintf(stderr, "Invalid format in line (missing operation code and address): '%s'\n", line);
-        fprintf(output_file, "Invalid format in line (missing operation code and address): '%s'\n", line);
-        return -1;
-    } else if (items_parsed == 1) {
-        fprintf(stderr, "Invalid format in line (missing address): '%s'\n", line);
-        fprintf(output_file, "Invalid format in line (missing address): '%s'\n", line);
-        return -1;
-    } else if (items_parsed > 2) {
-        fprintf(stderr, "Invalid format in line (too many items): '%s'\n", line);
-        fprintf(output_file, "Invalid format in line (too many items): '%s'\n", line);
+    while (p < end && is_trace_space(*p)) {
+        p++;
+    }
+
+    // Address: optional sign, optional 0x prefix, hex digits
+    negative = 0;
+    if (p < end && (*p == '+' || *p == '-')) {
+        negative = (*p == '-');
+        p++;
+    }
+    if (end - p > 2 && p[0] == '0' && (p[1] | 0x20) == 'x' && hex_digit_value(p[2]) >= 0) {
+        p += 2;
+    }
+    if (p == end || (digit = hex_digit_value(*p)) < 0) {
+        return 1;
+    }
+    value = 0;
+    do {
+        value = (value << 4) | (unsigned int)digit;
+        p++;
+    } while (p < end && (digit = hex_digit_value(*p)) >= 0);
+    *address = negative ? 0u - value : value;
+
+    // Optional fields; anything else after the address is an error
+    extras->cpu = 0;
+    extras->pc = 0;
+    extras->time = 0;
+    for (;;) {
+        while (p < end && is_trace_space(*p)) {
+            p++;
+        }
+        if (p == end || *p == '\0') {
+            return 2;
+        }
+        if (end - p > 4 && memcmp(p, "cpu=", 4) == 0 && (unsigned char)(p[4] - '0') <= 9) {
+            // cpu=N: decimal cache number below MAX_CACHES
+            p += 4;
+            value = 0;
+            do {
+                value = value * 10 + (unsigned int)(*p - '0');
+                p++;
+            } while (p < end && (unsigned char)(*p - '0') <= 9 && value < MAX_CACHES);
+            if (value >= MAX_CACHES) {
+                return 3;
+            }
+            extras->cpu = value;
+        } else if (end - p > 3 && memcmp(p, "pc=", 3) == 0) {
+            // pc=X: hex address of the instruction making the access
+            p += 3;
+            if (end - p > 2 && p[0] == '0' && (p[1] | 0x20) == 'x') {
+                p += 2;
+            }
+            if (p == end || (digit = hex_digit_value(*p)) < 0) {
+                return 3;
+            }
+            value = 0;
+            do {
+                value = (value << 4) | (unsigned int)digit;
+                p++;
+            } while (p < end && (digit = hex_digit_value(*p)) >= 0);
+            extras->pc = value;
+        } else if (end - p > 2 && memcmp(p, "t=", 2) == 0 && (unsigned char)(p[2] - '0') <= 9) {
+            // t=N: decimal cycle the access issues at, at the earliest
+            uint64_t cycle = 0;
+            p += 2;
+            do {
+                cycle = cycle * 10 + (uint64_t)(*p - '0');
+                p++;
+            } while (p < end && (unsigned char)(*p - '0') <= 9);
+            extras->time = cycle;
+        } else {
+            return 3;
+        }
+        if (p < end && !is_trace_space(*p) && *p != '\0') {
+            return 3;
+        }
+    }
+}
+
+// Report a line that scan_trace_fields() rejected. The raw line text is echoed
+// with its line terminator, exactly as the sscanf-based parser used to print it.
+void report_trace_line_error(int items_parsed, const char *line, size_t length) {
+    int width = (int)length;
+
+    switch (items_parsed) {
+        case TRACE_LINE_EMPTY:
+            fprintf(stderr, "Error: Line contains only whitespace or is empty: '%.*s'\n", width, line);
+            log_text("Error: Line contains only whitespace or is empty: '%.*s'\n", width, line);
+            break;
+        case 0:
+            fprintf(stderr, "Invalid format in line (missing operation code and address): '%.*s'\n", width, line);
+            log_text("Invalid format in line (missing operation code and address): '%.*s'\n", width, line);
+            break;
+        case 1:
+            fprintf(stderr, "Invalid format in line (missing address): '%.*s'\n", width, line);
+            log_text("Invalid format in line (missing address): '%.*s'\n", width, line);
+            break;
+        default:
+            fprintf(stderr, "Invalid format in line (too many items): '%.*s'\n", width, line);
+            log_text("Invalid format in line (too many items): '%.*s'\n", width, line);
+            break;
+    }
+}
+
+// Report the line number of a line that failed to parse
+void report_trace_parse_failure(uint64_t line_number, const char *line, size_t length) {
+    fprintf(stderr, "Error parsing line %llu: %.*s\n", (unsigned long long)line_number, (int)length, line);
+    log_text("Error parsing line %llu: %.*s\n", (unsigned long long)line_number, (int)length, line);
+}
+
+// Parse one trace line of the given length (the line need not be NUL terminated)
+static int parse_trace_record(const char *line, size_t length, TraceEntry *entry) {
+    int operation_code = 0;
+    unsigned int address = 0;
+    TraceExtras extras;
+    int items_parsed = scan_trace_fields(line, line + length, &operation_code, &address, &extras);
+
+    if (items_parsed != 2) {
+        report_trace_line_error(items_parsed, line, length);
         return -1;
     }
 
@@ -62,33 +202,225 @@ int parse_trace_line(const char *line, TraceEntry *entry) {
     entry->operation_code = operation_code;
     entry->address = address;
     entry->parsed_addr = decompose_address(address);
-
+    entry->cpu = extras.cpu;
+    entry->pc = extras.pc;
+    entry->time = extras.time;
     return 0; // Success
 }
 
+// Function to parse a trace line
+int parse_trace_line(const char *line, TraceEntry *entry) {
+    return parse_trace_record(line, strlen(line), entry);
+}
+
+// One line of the extra statistics sections, to the log and the console
+static void print_stats_line(const char *format, ...) {
+    char line[256];
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    log_text("%s", line);
+    fputs(line, stdout);
+}
+
+// Bus traffic of a multi-cache run: totals, then each cache
+static void print_coherence_statistics(const CacheStats *total) {
+    int i;
+
+    print_stats_line("Coherence Statistics (%d caches):\n", num_caches);
+    print_stats_line("Bus reads: %llu, RWIMs: %llu, invalidates: %llu, write-backs: %llu\n",
+                         (unsigned long long)total->num_bus_reads, (unsigned long long)total->num_bus_rwims,
+                         (unsigned long long)total->num_bus_invalidates, (unsigned long long)total->num_bus_writes);
+    print_stats_line("Snoop results: %llu HIT, %llu HITM\n",
+                         (unsigned long long)total->num_snoop_hits, (unsigned long long)total->num_snoop_hitms);
+    if (snoop_filter_active) {
+        const SnoopFilterStats *filter = &snoop_filter_stats;
+        print_stats_line("Snoop filter: %llu of %llu entries in use (peak %llu), hit rate %.2f%% of %llu lookups\n",
+                             (unsigned long long)filter->occupancy, (unsigned long long)filter->capacity,
+                             (unsigned long long)filter->peak_occupancy,
+                             filter->lookups ? 100.0 * filter->hits / filter->lookups : 0.0,
+                             (unsigned long long)filter->lookups);
+        print_stats_line("Snoops sent: %llu (%llu stale), filtered out: %llu\n",
+                             (unsigned long long)filter->snoops_sent, (unsigned long long)filter->stale_snoops,
+                             (unsigned long long)filter->snoops_filtered);
+        print_stats_line("Back-invalidations: %llu entries, %llu cache lines\n",
+                             (unsigned long long)filter->back_invalidations,
+                             (unsigned long long)filter->back_invalidated_lines);
+    }
+    for (i = 0; i < num_caches; i++) {
+        const CacheStats *stats = &bus_caches[i]->stats;
+        print_stats_line("Cache %d: reads %llu, writes %llu, hits %llu, misses %llu, "
+                             "bus reads %llu, RWIMs %llu, invalidates %llu, write-backs %llu\n",
+                             i, (unsigned long long)stats->num_cache_reads, (unsigned long long)stats->num_cache_writes,
+                             (unsigned long long)stats->num_cache_hits, (unsigned long long)stats->num_cache_misses,
+                             (unsigned long long)stats->num_bus_reads, (unsigned long long)stats->num_bus_rwims,
+                             (unsigned long long)stats->num_bus_invalidates, (unsigned long long)stats->num_bus_writes);
+    }
+}
+
+// Bypasses and how well the reuse predictor did
+static void print_reuse_statistics(const CacheStats *total) {
+    uint64_t resolved = total->num_reuse_correct + total->num_reuse_wrong;
+
+    print_stats_line("Reuse Prediction (%s):\n", cache.reuse_signature == REUSE_PC ? "pc" : "region");
+    print_stats_line("Bypassed read misses: %llu of %llu misses, %llu of them missed on again soon after\n",
+                     (unsigned long long)total->num_bypasses, (unsigned long long)total->num_cache_misses,
+                     (unsigned long long)total->num_bypass_rereferences);
+    print_stats_line("Predictor accuracy: %.2f%% of %llu resolved predictions\n",
+                     resolved ? 100.0 * total->num_reuse_correct / resolved : 0.0, (unsigned long long)resolved);
+    if (total->num_reuse_no_pc) {
+        // Binary traces never carry pc=, and text traces may leave it out
+        print_stats_line("No pc= on %llu misses: predicted by region signatures instead\n",
+                         (unsigned long long)total->num_reuse_no_pc);
+    }
+}
+
+// What the prefetcher did and how much of the demand miss latency it hid. A
+// useful prefetch turned a miss into a hit; a late one only hid part of it.
+static void print_prefetch_statistics(const CacheStats *total) {
+    uint64_t would_miss = total->num_cache_misses + total->num_prefetch_useful;
+
+    print_stats_line("Prefetching (%s, degree %u):\n", prefetcher_name(cache.prefetch_kind), cache.prefetch_degree);
+    print_stats_line("Prefetches: %llu filled, %llu found the line present\n",
+                     (unsigned long long)total->num_prefetches, (unsigned long long)total->num_prefetch_hits);
+    print_stats_line("Useful: %llu (%llu late), unused: %llu, polluting: %llu\n",
+                     (unsigned long long)total->num_prefetch_useful, (unsigned long long)total->num_prefetch_late,
+                     (unsigned long long)total->num_prefetch_unused, (unsigned long long)total->num_prefetch_polluting);
+    print_stats_line("Demand hits: %llu on prefetched lines, %llu on other lines\n",
+                     (unsigned long long)total->num_prefetch_useful,
+                     (unsigned long long)(total->num_cache_hits - total->num_prefetch_useful));
+    print_stats_line("Accuracy: %.2f%% of prefetches used, coverage: %.2f%% of misses hidden (%.2f%% in time)\n",
+                     total->num_prefetches ? 100.0 * total->num_prefetch_useful / total->num_prefetches : 0.0,
+                     would_miss ? 100.0 * total->num_prefetch_useful / would_miss : 0.0,
+                     would_miss ? 100.0 * (total->num_prefetch_useful - total->num_prefetch_late) / would_miss : 0.0);
+}
+
+// Demand misses by class. Conflict misses crowded into a few sets point at
+// the index function; spread over most sets, at too few ways.
+static void print_miss_class_statistics(const CacheStats *total) {
+    uint64_t misses = 0;
+    unsigned int sets = 0, with_conflicts = 0;
+    uint64_t worst = 0;
+    int i;
+
+    for (i = 0; i < MISS_CLASSES; i++) {
+        misses += total->num_class_misses[i];
+    }
+    for (i = 0; i < num_caches; i++) {
+        uint64_t cache_worst;
+        with_conflicts += conflict_miss_sets(bus_caches[i], &cache_worst);
+        sets += bus_caches[i]->num_sets;
+        if (cache_worst > worst) {
+            worst = cache_worst;
+        }
+    }
+
+    print_stats_line("Miss Classification (3C):\n");
+    for (i = 0; i < MISS_CLASSES; i++) {
+        print_stats_line("%c%s misses: %llu (%.2f%%)\n", toupper(miss_class_name(i)[0]), miss_class_name(i) + 1,
+                         (unsigned long long)total->num_class_misses[i],
+                         misses ? 100.0 * total->num_class_misses[i] / misses : 0.0);
+    }
+    print_stats_line("Conflict misses in %u of %u sets (%.2f%%), at most %llu in one set\n",
+                     with_conflicts, sets, sets ? 100.0 * with_conflicts / sets : 0.0, (unsigned long long)worst);
+}
+
+// Average memory access time, overall and by operation, and how busy and
+// contended the bus was
+static void print_timing_statistics() {
+    static const char *bus_names[] = {NULL, "READ", "WRITE", "INVALIDATE", "RWIM"};
+    const TimingStats *t = &timing_stats;
+    uint64_t accesses = t->accesses[0] + t->accesses[1] + t->accesses[2];
+    uint64_t cycles = t->access_cycles[0] + t->access_cycles[1] + t->access_cycles[2];
+    int op;
+
+    finish_timing();
+    print_stats_line("Timing:\n");
+    print_stats_line("AMAT: %.2f cycles over %llu accesses (reads %.2f, writes %.2f, fetches %.2f)\n",
+                     accesses ? (double)cycles / accesses : 0.0, (unsigned long long)accesses,
+                     t->accesses[0] ? (double)t->access_cycles[0] / t->accesses[0] : 0.0,
+                     t->accesses[1] ? (double)t->access_cycles[1] / t->accesses[1] : 0.0,
+                     t->accesses[2] ? (double)t->access_cycles[2] / t->accesses[2] : 0.0);
+    print_stats_line("Elapsed: %llu cycles, bus busy %llu cycles (%.2f%% utilization)\n",
+                     (unsigned long long)t->elapsed, (unsigned long long)t->bus_busy_cycles,
+                     t->elapsed ? 100.0 * t->bus_busy_cycles / t->elapsed : 0.0);
+    for (op = READ; op <= RWIM; op++) {
+        print_stats_line("Bus %s: %llu operations, queueing delay %.2f cycles on average (%llu total)\n",
+                         bus_names[op], (unsigned long long)t->bus_operations[op],
+                         t->bus_operations[op] ? (double)t->bus_queue_cycles[op] / t->bus_operations[op] : 0.0,
+                         (unsigned long long)t->bus_queue_cycles[op]);
+    }
+    if (timing_config.mshrs > 0) {
+        // Memory-level parallelism: misses outstanding on average while any are
+        print_stats_line("MSHRs (%u per cache): %llu misses, %llu merged secondary misses\n", timing_config.mshrs,
+                         (unsigned long long)t->mshr_misses, (unsigned long long)t->mshr_merges);
+        print_stats_line("MLP: %.2f, occupancy %.2f on average (peak %llu)\n",
+                         t->mshr_busy_cycles ? (double)t->mshr_occupancy_cycles / t->mshr_busy_cycles : 0.0,
+                         t->elapsed ? (double)t->mshr_occupancy_cycles / ((double)t->elapsed * num_caches) : 0.0,
+                         (unsigned long long)t->mshr_peak);
+        print_stats_line("MSHRs full: %llu misses stalled for %llu cycles\n",
+                         (unsigned long long)t->mshr_full_stalls, (unsigned long long)t->mshr_stall_cycles);
+    }
+}
+
+// Row buffer locality and bank contention in the DRAM backend
+static void print_dram_statistics() {
+    const DramStats *d = &dram_stats;
+    uint64_t accesses = d->reads + d->writes;
+
+    print_stats_line("DRAM (%u channels x %u banks, %u-byte rows, %s page):\n",
+                     dram_config.channels, dram_config.banks, dram_config.row_size,
+                     dram_config.open_page ? "open" : "closed");
+    print_stats_line("Reads: %llu (%.2f cycles on average), write-backs: %llu\n",
+                     (unsigned long long)d->reads, d->reads ? (double)d->read_cycles / d->reads : 0.0,
+                     (unsigned long long)d->writes);
+    print_stats_line("Row hits: %llu (%.2f%% hit rate), empty: %llu, conflicts: %llu\n",
+                     (unsigned long long)d->row_hits, accesses ? 100.0 * d->row_hits / accesses : 0.0,
+                     (unsigned long long)d->row_empty, (unsigned long long)d->row_conflicts);
+    print_stats_line("Bank busy: %llu accesses waited, %.2f cycles on average\n",
+                     (unsigned long long)d->bank_busy,
+                     d->bank_busy ? (double)d->bank_wait_cycles / d->bank_busy : 0.0);
+}
+
 void print_cache_statistics() {
-    float total_accesses = num_cache_reads + num_cache_writes;
-    float hit_ratio = (float)num_cache_hits / total_accesses * 100;
-    float miss_ratio = (float)num_cache_misses / total_accesses * 100;
-
-    fprintf(output_file, "Cache Statistics:\n");
-    fprintf(output_file, "Number of cache reads: %d\n", num_cache_reads);
-    fprintf(output_file, "Number of cache writes: %d\n", num_cache_writes);
-    fprintf(output_file, "Number of cache hits: %d\n", num_cache_hits);
-    fprintf(output_file, "Number of cache misses: %d\n", num_cache_misses);
+    CacheStats totals;
+    const CacheStats *stats = &totals;
+    int i;
+
+    // With several caches on the bus the totals cover all of them
+    memset(&totals, 0, sizeof(totals));
+    for (i = 0; i < num_caches; i++) {
+        add_cache_stats(&totals, &bus_caches[i]->stats);
+    }
+
+    float total_accesses = stats->num_cache_reads + stats->num_cache_writes;
+    float hit_ratio = (float)stats->num_cache_hits / total_accesses * 100;
+    float miss_ratio = (float)stats->num_cache_misses / total_accesses * 100;
+
+    if (!LOG_ENABLED(LOG_STATS)) {
+        return;
+    }
+
+    log_text("Cache Statistics:\n");
+    log_text("Number of cache reads: %llu\n", (unsigned long long)stats->num_cache_reads);
+    log_text("Number of cache writes: %llu\n", (unsigned long long)stats->num_cache_writes);
+    log_text("Number of cache hits: %llu\n", (unsigned long long)stats->num_cache_hits);
+    log_text("Number of cache misses: %llu\n", (unsigned long long)stats->num_cache_misses);
     // Check conditions for hit ratio and miss ratio
     if (hit_ratio <= 100.0f) {
-        fprintf(output_file, "Cache hit ratio: %.2f%%\n", hit_ratio);
+        log_text("Cache hit ratio: %.2f%%\n", hit_ratio);
     } else {
-        fprintf(output_file, "Error: Hit ratio exceeds 100%%.\n");
+        log_text("Error: Hit ratio exceeds 100%%.\n");
     }
 
 
      printf("Cache Statistics:\n");
-     printf("Number of cache reads: %d\n", num_cache_reads);
-     printf("Number of cache writes: %d\n", num_cache_writes);
-     printf("Number of cache hits: %d\n", num_cache_hits);
-     printf("Number of cache misses: %d\n", num_cache_misses);
+     printf("Number of cache reads: %llu\n", (unsigned long long)stats->num_cache_reads);
+     printf("Number of cache writes: %llu\n", (unsigned long long)stats->num_cache_writes);
+     printf("Number of cache hits: %llu\n", (unsigned long long)stats->num_cache_hits);
+     printf("Number of cache misses: %llu\n", (unsigned long long)stats->num_cache_misses);
 
         // Check conditions for hit ratio and miss ratio
      if (hit_ratio <= 100.0f) {
@@ -96,60 +428,342 @@ void print_cache_statistics() {
      } else {
          printf("Error: Hit ratio exceeds 100%%.\n");
      }
-    
+
+    if (cache.reuse_counters) {
+        print_reuse_statistics(stats);
+    }
+    if (cache.prefetcher) {
+        print_prefetch_statistics(stats);
+    }
+    if (cache.miss_classifier) {
+        print_miss_class_statistics(stats);
+    }
+    if (num_caches > 1) {
+        print_coherence_statistics(stats);
+    }
+    if (timing_active) {
+        print_timing_statistics();
+    }
+    if (dram_active) {
+        print_dram_statistics();
+    }
 }
 
 
 // Dispatch to operation handlers
-void handle_trace_entry(TraceEntry *entry) {
+void dispatch_trace_entry(Cache *c, TraceEntry *entry) {
+    // Demand accesses are timed from issue to completion
+    int timed = timing_active && entry->operation_code >= 0 && entry->operation_code <= 2;
+    uint64_t start = timed ? timing_begin_access(c, entry) : 0;
+
     switch (entry->operation_code) {
-        case 0: handle_read_operation(entry); num_cache_reads++; break;
-        case 1: handle_write_operation(entry); num_cache_writes++; break;
-        case 2: handle_instruction_cache_read(entry); num_cache_reads++; break;
-        case 3: handle_snooped_read_request(entry); break;
-        case 4: handle_snooped_write_request(entry); break;
-        case 5: handle_snooped_rwim_request(entry); break;
-        case 6: handle_snooped_invalidate_command(entry); break;
-        case 8: handle_clear_cache_request(); break;
-        case 9: handle_print_cache_state_request(); break;
+        case 0: handle_read_operation(c, entry); c->stats.num_cache_reads++; break;
+        case 1: handle_write_operation(c, entry); c->stats.num_cache_writes++; break;
+        case 2: handle_instruction_cache_read(c, entry); c->stats.num_cache_reads++; break;
+        case 3: handle_snooped_read_request(c, entry); break;
+        case 4: handle_snooped_write_request(c, entry); break;
+        case 5: handle_snooped_rwim_request(c, entry); break;
+        case 6: handle_snooped_invalidate_command(c, entry); break;
+        case 8: handle_clear_cache_request(c); break;
+        case 9: handle_print_cache_state_request(c); break;
         default:
-            if (Mode == 1) {
+            if (LOG_ENABLED(LOG_TRANSACTIONS) && Mode == 1) {
                 printf("Unknown operation code: %d\n", entry->operation_code);
             }
             break;
     }
+    if (timed) {
+        timing_end_access(c, entry->operation_code, start);
+    }
 }
 
-void read_trace_file(const char *filename) {
-    FILE *file = fopen(filename, "r");
-    if (!file) {
-        fprintf(stderr, "Error: Could not open file: %s\n", filename);
-        fprintf(output_file, "Error: Could not open file: %s\n", filename);
-        return;
+// Entry point for every reader: run the entry here, hand it to the shard
+// that owns its set when the sharded engine is running, queue it for every
+// configuration of a sweep, or feed it to the stack-distance analysis
+void handle_trace_entry(TraceEntry *entry) {
+    if (shard_engine_active) {
+        shard_trace_entry(entry);
+    } else if (sweep_active) {
+        sweep_trace_entry(entry);
+    } else if (stack_distance_active) {
+        stack_distance_entry(entry);
+    } else if (entry->cpu < (unsigned int)num_caches) {
+        dispatch_trace_entry(bus_caches[entry->cpu], entry);
+        if (interval_active) {
+            interval_trace_entry(entry->operation_code);
+        }
+    } else {
+        fprintf(stderr, "Error: Trace record for cpu=%u, but only %d caches (caches=); record skipped.\n",
+                entry->cpu, num_caches);
+        log_text("Error: Trace record for cpu=%u, but only %d caches (caches=); record skipped.\n",
+                 entry->cpu, num_caches);
     }
+}
 
-    char line[256];
-    int line_number = 0;
+// Parse and dispatch every line of an in-memory trace image
+static void process_trace_buffer(const char *data, size_t size, uint64_t *line_number) {
+    const char *p = data;
+    const char *end = data + size;
     TraceEntry entry;
 
-    fprintf(output_file, "Processing trace file: %s\n", filename);
+    while (p < end) {
+        const char *newline = memchr(p, '\n', (size_t)(end - p));
+        const char *next = newline ? newline + 1 : end;
+        size_t length = (size_t)(next - p);
 
-    while (fgets(line, sizeof(line), file)) {
-        line_number++;
-        if (parse_trace_line(line, &entry) == 0) {
+        (*line_number)++;
+        if (parse_trace_record(p, length, &entry) == 0) {
             handle_trace_entry(&entry); // Dispatch to operation handlers
         } else {
-            fprintf(stderr, "Error parsing line %d: %s\n", line_number, line);
-            fprintf(output_file, "Error parsing line %d: %s\n", line_number, line);
+            report_trace_parse_failure(*line_number, p, length);
         }
+        p = next;
     }
+}
 
-    fclose(file);
+// Read once into the buffer, retrying on signals. Returns bytes read, 0 at EOF, -1 on error.
+ssize_t read_trace_chunk(int fd, char *buffer, size_t size) {
+    ssize_t n;
+    do {
+        n = read(fd, buffer, size);
+    } while (n < 0 && errno == EINTR);
+    return n;
+}
+
+// Stream a trace from a descriptor that cannot be mapped (stdin, pipes, FIFOs).
+// Data is read in large blocks and only complete lines are parsed; a partial
+// line at the end of a block is carried into the next one, so no seeking is needed.
+// Binary traces are recognized by their magic and replayed the same way.
+static void process_trace_stream(int fd, uint64_t *line_number) {
+    size_t capacity = TRACE_STREAM_BUFFER_SIZE;
+    char *buffer = malloc(capacity);
+    size_t filled = 0;
+    int sniffed = 0;
+    int eof = 0;
+
+    if (!buffer) {
+        fprintf(stderr, "Error: Out of memory allocating the trace stream buffer\n");
+        log_text("Error: Out of memory allocating the trace stream buffer\n");
+        return;
+    }
+
+    while (!eof) {
+        ssize_t n = read_trace_chunk(fd, buffer + filled, capacity - filled);
+        if (n < 0) {
+            fprintf(stderr, "Error: Read failed after line %llu\n", (unsigned long long)*line_number);
+            log_text("Error: Read failed after line %llu\n", (unsigned long long)*line_number);
+            break;
+        }
+        eof = (n == 0);
+        filled += (size_t)n;
+
+        // Decide text or binary once enough bytes for the magic have arrived
+        if (!sniffed && (filled >= sizeof(TRACE_BIN_MAGIC) - 1 || eof)) {
+            sniffed = 1;
+            if (filled >= sizeof(TRACE_BIN_MAGIC) - 1 &&
+                memcmp(buffer, TRACE_BIN_MAGIC, sizeof(TRACE_BIN_MAGIC) - 1) == 0) {
+                process_binary_trace_stream(fd, buffer, filled, capacity);
+                free(buffer);
+                return;
+            }
+        }
+        if (!sniffed) {
+            continue;
+        }
+
+        // Hand every complete line to the parser and keep the tail
+        size_t complete = filled;
+        if (!eof) {
+            while (complete > 0 && buffer[complete - 1] != '\n') {
+                complete--;
+            }
+        }
+        if (complete > 0) {
+            process_trace_buffer(buffer, complete, line_number);
+            memmove(buffer, buffer + complete, filled - complete);
+            filled -= complete;
+        }
+
+        // A single line longer than the buffer: grow it
+        if (filled == capacity) {
+            char *grown = realloc(buffer, capacity * 2);
+            if (!grown) {
+                fprintf(stderr, "Error: Line %llu is too long\n", (unsigned long long)*line_number + 1);
+                log_text("Error: Line %llu is too long\n", (unsigned long long)*line_number + 1);
+                break;
+            }
+            buffer = grown;
+            capacity *= 2;
+        }
+    }
+    free(buffer);
+}
+
+// Run a text or binary trace, from a file or "-" for standard input
+void read_trace_file(const char *filename) {
+    // "-" reads the trace from standard input
+    int fd = (strcmp(filename, "-") == 0) ? STDIN_FILENO : open(filename, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Could not open file: %s\n", filename);
+        log_text("Error: Could not open file: %s\n", filename);
+        return;
+    }
+
+    uint64_t line_number = 0;
+    struct stat st;
+    void *map = MAP_FAILED;
+
+    log_text("Processing trace file: %s\n", filename);
+
+    // Map regular files and scan them in place
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+
+    if (shard_threads > 1) {
+        start_shard_engine(shard_threads);
+    }
+
+    if (map != MAP_FAILED) {
+        madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+        // Binary traces are recognized by their magic and replayed without
+        // parsing; large text traces are split across parser threads
+        if ((size_t)st.st_size >= sizeof(TRACE_BIN_MAGIC) - 1 &&
+            memcmp(map, TRACE_BIN_MAGIC, sizeof(TRACE_BIN_MAGIC) - 1) == 0) {
+            process_binary_trace_buffer(map, (size_t)st.st_size, filename);
+        } else if (parser_threads < 2 || (size_t)st.st_size < 2 * TRACE_CHUNK_SIZE ||
+            process_trace_buffer_parallel(map, (size_t)st.st_size, parser_threads, &line_number) != 0) {
+            process_trace_buffer(map, (size_t)st.st_size, &line_number);
+        }
+        munmap(map, (size_t)st.st_size);
+    } else {
+        // Pipes, empty files and anything mmap refuses are streamed
+        process_trace_stream(fd, &line_number);
+    }
+    close(fd);
+    stop_shard_engine();
 
-    fprintf(output_file, "Finished processing trace file.\n");
-    if (Mode == 1) {
+    log_text("Finished processing trace file.\n");
+    if (LOG_ENABLED(LOG_STATS) && Mode == 1) {
         printf("Finished processing trace file.\n");
     }
     print_cache_statistics();
 }
 
+static double elapsed_seconds(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Parse-only pass using the original fgets + sscanf text path
+static double bench_stdio_reader(const char *filename, unsigned long *lines, unsigned long long *checksum) {
+    FILE *file = fopen(filename, "r");
+    char line[256];
+    char extra_input[256];
+    struct timespec start;
+
+    *lines = 0;
+    *checksum = 0;
+    if (!file) {
+        return -1.0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (fgets(line, sizeof(line), file)) {
+        TraceEntry entry;
+        int operation_code;
+        unsigned int address;
+
+        memset(&entry, 0, sizeof(TraceEntry));
+        (*lines)++;
+        if (sscanf(line, "%d %x %s", &operation_code, &address, extra_input) == 2) {
+            entry.operation_code = operation_code;
+            entry.address = address;
+            entry.parsed_addr = decompose_address(address);
+            *checksum += (unsigned long long)entry.operation_code * 31 + entry.address;
+        }
+    }
+    fclose(file);
+    return elapsed_seconds(&start);
+}
+
+// Parse-only pass using the memory-mapped reader and scan_trace_fields()
+static double bench_mmap_reader(const char *filename, unsigned long *lines, unsigned long long *checksum) {
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    struct timespec start;
+
+    *lines = 0;
+    *checksum = 0;
+    if (fd < 0) {
+        return -1.0;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return 0.0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    const char *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return -1.0;
+    }
+    madvise((void *)data, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    const char *p = data;
+    const char *end = data + st.st_size;
+    while (p < end) {
+        const char *newline = memchr(p, '\n', (size_t)(end - p));
+        const char *next = newline ? newline + 1 : end;
+        TraceEntry entry;
+        TraceExtras extras;
+
+        (*lines)++;
+        if (scan_trace_fields(p, next, &entry.operation_code, &entry.address, &extras) == 2) {
+            entry.parsed_addr = decompose_address(entry.address);
+            *checksum += (unsigned long long)entry.operation_code * 31 + entry.address;
+        }
+        p = next;
+    }
+    double seconds = elapsed_seconds(&start);
+    munmap((void *)data, (size_t)st.st_size);
+    return seconds;
+}
+
+// Compare the stdio/sscanf text path against the mmap tokenizer (parse only, no simulation)
+void benchmark_trace_readers(const char *filename) {
+    unsigned long stdio_lines = 0, mmap_lines = 0;
+    unsigned long long stdio_sum = 0, mmap_sum = 0;
+    double stdio_best = -1.0, mmap_best = -1.0;
+    int round;
+
+    for (round = 0; round < TRACE_BENCH_ROUNDS; round++) {
+        double t = bench_stdio_reader(filename, &stdio_lines, &stdio_sum);
+        if (t < 0) {
+            fprintf(stderr, "Error: Could not open file: %s\n", filename);
+            return;
+        }
+        if (stdio_best < 0 || t < stdio_best) {
+            stdio_best = t;
+        }
+        t = bench_mmap_reader(filename, &mmap_lines, &mmap_sum);
+        if (t < 0) {
+            fprintf(stderr, "Error: Could not map file: %s\n", filename);
+            return;
+        }
+        if (mmap_best < 0 || t < mmap_best) {
+            mmap_best = t;
+        }
+    }
+
+    printf("Trace reader benchmark: %s (best of %d)\n", filename, TRACE_BENCH_ROUNDS);
+    printf("  fgets + sscanf : %lu lines in %.6f s (%.1f Mlines/s)\n",
+           stdio_lines, stdio_best, stdio_best > 0 ? stdio_lines / stdio_best / 1e6 : 0.0);
+    printf("  mmap + scanner : %lu lines in %.6f s (%.1f Mlines/s)\n",
+           mmap_lines, mmap_best, mmap_best > 0 ? mmap_lines / mmap_best / 1e6 : 0.0);
+    if (mmap_best > 0) {
+        printf("  Speedup        : %.2fx\n", stdio_best / mmap_best);
+    }
+    printf("  Parsed entries %s\n",
+           (stdio_sum == mmap_sum) ? "match" : "DIFFER (fgets splits lines longer than 255 bytes)");
+}
@@ -0,0 +1,230 @@
+#include "cache.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Check a mapped or read-in header against what this build writes
+static int valid_binary_header(const TraceBinHeader *header) {
+    return memcmp(header->magic, TRACE_BIN_MAGIC, sizeof(header->magic)) == 0 &&
+           header->version == TRACE_BIN_VERSION &&
+           header->record_size == sizeof(TraceBinRecord) &&
+           header->byte_order == TRACE_BIN_BYTE_ORDER;
+}
+
+// Feed a run of records to the handlers. `address` carries the running
+// address across calls for delta-encoded traces.
+static void dispatch_binary_records(const TraceBinRecord *record, size_t count, uint32_t flags,
+                                    unsigned int *address) {
+    const TraceBinRecord *last = record + count;
+    TraceEntry entry;
+
+    memset(&entry, 0, sizeof(entry));
+    if (flags & TRACE_BIN_DELTA) {
+        unsigned int current = *address;
+        for (; record < last; record++) {
+            current += record->address;
+            entry.operation_code = record->operation_code;
+            entry.address = current;
+            entry.parsed_addr = decompose_address(current);
+            entry.cpu = record->cpu;
+            handle_trace_entry(&entry);
+        }
+        *address = current;
+    } else {
+        for (; record < last; record++) {
+            entry.operation_code = record->operation_code;
+            entry.address = record->address;
+            entry.parsed_addr = decompose_address(record->address);
+            entry.cpu = record->cpu;
+            handle_trace_entry(&entry);
+        }
+    }
+}
+
+// Replay a binary trace mapped in memory by the text reader, which spotted the
+// magic; no parsing is involved
+void process_binary_trace_buffer(const unsigned char *data, size_t size, const char *filename) {
+    const TraceBinHeader *header = (const TraceBinHeader *)data;
+
+    if (size < sizeof(TraceBinHeader)) {
+        fprintf(stderr, "Error: Truncated binary trace file: %s\n", filename);
+        log_text("Error: Truncated binary trace file: %s\n", filename);
+        return;
+    }
+    if (!valid_binary_header(header)) {
+        fprintf(stderr, "Error: Unsupported binary trace format: %s\n", filename);
+        log_text("Error: Unsupported binary trace format: %s\n", filename);
+        return;
+    }
+
+    size_t payload = size - sizeof(TraceBinHeader);
+    size_t count = payload / sizeof(TraceBinRecord);
+    if (payload % sizeof(TraceBinRecord) != 0) {
+        fprintf(stderr, "Warning: Ignoring partial record at end of %s\n", filename);
+    }
+
+    unsigned int address = 0;
+    dispatch_binary_records((const TraceBinRecord *)(data + sizeof(TraceBinHeader)), count,
+                            header->flags, &address);
+}
+
+// Replay a binary trace arriving on a pipe. `buffer` already holds the first
+// `filled` bytes read by the text stream reader, which spotted the magic.
+void process_binary_trace_stream(int fd, char *buffer, size_t filled, size_t capacity) {
+    TraceBinHeader header;
+    unsigned int address = 0;
+    int eof = 0;
+
+    // Make sure the whole header has arrived
+    while (filled < sizeof(TraceBinHeader) && !eof) {
+        ssize_t n = read_trace_chunk(fd, buffer + filled, capacity - filled);
+        if (n < 0) {
+            break;
+        }
+        eof = (n == 0);
+        filled += (size_t)n;
+    }
+    if (filled < sizeof(TraceBinHeader)) {
+        fprintf(stderr, "Error: Truncated binary trace header on input stream\n");
+        log_text("Error: Truncated binary trace header on input stream\n");
+        return;
+    }
+    memcpy(&header, buffer, sizeof(header));
+    if (!valid_binary_header(&header)) {
+        fprintf(stderr, "Error: Unsupported binary trace format on input stream\n");
+        log_text("Error: Unsupported binary trace format on input stream\n");
+        return;
+    }
+    filled -= sizeof(TraceBinHeader);
+    memmove(buffer, buffer + sizeof(TraceBinHeader), filled);
+
+    for (;;) {
+        // Dispatch every whole record and keep a partial one for the next read
+        size_t count = filled / sizeof(TraceBinRecord);
+        size_t used = count * sizeof(TraceBinRecord);
+        dispatch_binary_records((const TraceBinRecord *)buffer, count, header.flags, &address);
+        memmove(buffer, buffer + used, filled - used);
+        filled -= used;
+        if (eof) {
+            break;
+        }
+
+        ssize_t n = read_trace_chunk(fd, buffer + filled, capacity - filled);
+        if (n < 0) {
+            fprintf(stderr, "Error: Read failed on binary trace stream\n");
+            log_text("Error: Read failed on binary trace stream\n");
+            return;
+        }
+        eof = (n == 0);
+        filled += (size_t)n;
+    }
+    if (filled != 0) {
+        fprintf(stderr, "Warning: Ignoring partial record at end of input stream\n");
+    }
+}
+
+// Convert a text trace into the binary format. Lines that would fail to parse
+// are reported and dropped, and so are pc= and t=, which records do not carry;
+// a warning says how many were lost. Returns 0 on success, -1 on failure.
+int convert_trace_file(const char *text_filename, const char *binary_filename, int delta) {
+    int fd = open(text_filename, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Could not open file: %s\n", text_filename);
+        return -1;
+    }
+
+    struct stat st;
+    const char *data = NULL;
+    if (fstat(fd, &st) != 0) {
+        fprintf(stderr, "Error: Could not stat file: %s\n", text_filename);
+        close(fd);
+        return -1;
+    }
+    if (st.st_size > 0) {
+        data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            fprintf(stderr, "Error: Could not map file: %s\n", text_filename);
+            close(fd);
+            return -1;
+        }
+        madvise((void *)data, (size_t)st.st_size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    FILE *out = fopen(binary_filename, "wb");
+    if (!out) {
+        fprintf(stderr, "Error: Could not create file: %s\n", binary_filename);
+        if (data) {
+            munmap((void *)data, (size_t)st.st_size);
+        }
+        return -1;
+    }
+
+    TraceBinHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_BIN_MAGIC, sizeof(header.magic));
+    header.version = TRACE_BIN_VERSION;
+    header.record_size = sizeof(TraceBinRecord);
+    header.flags = delta ? TRACE_BIN_DELTA : 0;
+    header.byte_order = TRACE_BIN_BYTE_ORDER;
+    fwrite(&header, sizeof(header), 1, out);
+
+    const char *p = data;
+    const char *end = data ? data + st.st_size : NULL;
+    unsigned int previous = 0;
+    uint64_t line_number = 0;
+    uint64_t written = 0;
+    uint64_t skipped = 0;
+    uint64_t dropped_pcs = 0, dropped_times = 0;
+
+    while (p < end) {
+        const char *newline = memchr(p, '\n', (size_t)(end - p));
+        const char *next = newline ? newline + 1 : end;
+        int operation_code = 0;
+        unsigned int address = 0;
+        TraceExtras extras;
+
+        line_number++;
+        if (scan_trace_fields(p, next, &operation_code, &address, &extras) != 2 ||
+            operation_code < 0 || operation_code > 255) {
+            fprintf(stderr, "Skipping line %llu: %.*s\n", (unsigned long long)line_number, (int)(next - p), p);
+            skipped++;
+        } else {
+            TraceBinRecord record;
+            memset(&record, 0, sizeof(record));
+            record.operation_code = (uint8_t)operation_code;
+            // pc= and t= do not fit a record: replays predict reuse by region
+            // and issue accesses as soon as the timing model lets them
+            record.cpu = (uint8_t)extras.cpu;
+            dropped_pcs += (extras.pc != 0);
+            dropped_times += (extras.time != 0);
+            record.address = delta ? address - previous : address;
+            previous = address;
+            fwrite(&record, sizeof(record), 1, out);
+            written++;
+        }
+        p = next;
+    }
+
+    if (data) {
+        munmap((void *)data, (size_t)st.st_size);
+    }
+    if (fclose(out) != 0) {
+        fprintf(stderr, "Error: Could not write file: %s\n", binary_filename);
+        return -1;
+    }
+
+    printf("Converted %s -> %s: %llu records written, %llu lines skipped%s\n",
+           text_filename, binary_filename, (unsigned long long)written, (unsigned long long)skipped,
+           delta ? " (delta-encoded)" : "");
+    if (dropped_pcs || dropped_times) {
+        fprintf(stderr, "Warning: Binary records do not carry pc= or t=; dropped pc= from %llu records "
+                        "and t= from %llu. Replays predict reuse by region and issue accesses without "
+                        "waiting for their cycle.\n",
+                (unsigned long long)dropped_pcs, (unsigned long long)dropped_times);
+    }
+    return 0;
+}
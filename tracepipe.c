@@ -0,0 +1,258 @@
+#include "cache.h"
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+// A line a parser thread rejected, replayed by the simulation thread in order
+typedef struct {
+    int entry_index;        // Number of good entries in the chunk before this line
+    int line;               // Line number within the chunk (1-based)
+    int items_parsed;       // scan_trace_fields() result, selects the message
+    const char *text;       // Raw line in the mapped file
+    size_t length;
+} TraceLineError;
+
+// One newline-aligned piece of the trace and what a parser made of it
+typedef struct {
+    TraceEntry *entries;
+    int entry_count;
+    int entry_capacity;
+    TraceLineError *errors;
+    int error_count;
+    int error_capacity;
+    int line_count;
+    int ready;              // Parsed and waiting for the simulation thread
+} TraceChunk;
+
+typedef struct {
+    const char **bounds;    // bounds[c]..bounds[c + 1] is chunk c
+    int chunk_count;
+    TraceChunk *slots;      // Chunk c is parsed into slots[c % window]
+    int window;
+    int next_chunk;         // Next chunk a parser thread will claim
+    int consumed;           // Chunks fully dispatched by the simulation thread
+    int failed;             // A parser ran out of memory; everyone stops
+    pthread_mutex_t lock;
+    pthread_cond_t chunk_ready;
+    pthread_cond_t slot_free;
+} TracePipeline;
+
+static int reserve_entries(TraceChunk *chunk) {
+    if (chunk->entry_count == chunk->entry_capacity) {
+        int capacity = chunk->entry_capacity ? chunk->entry_capacity * 2 : 4096;
+        TraceEntry *entries = realloc(chunk->entries, (size_t)capacity * sizeof(TraceEntry));
+        if (!entries) {
+            return -1;
+        }
+        chunk->entries = entries;
+        chunk->entry_capacity = capacity;
+    }
+    return 0;
+}
+
+static int reserve_errors(TraceChunk *chunk) {
+    if (chunk->error_count == chunk->error_capacity) {
+        int capacity = chunk->error_capacity ? chunk->error_capacity * 2 : 16;
+        TraceLineError *errors = realloc(chunk->errors, (size_t)capacity * sizeof(TraceLineError));
+        if (!errors) {
+            return -1;
+        }
+        chunk->errors = errors;
+        chunk->error_capacity = capacity;
+    }
+    return 0;
+}
+
+// Decode one chunk into entries. Nothing is printed here: errors are recorded
+// and reported later by the simulation thread so output order is unchanged.
+static int parse_trace_chunk(const char *p, const char *end, TraceChunk *chunk) {
+    chunk->entry_count = 0;
+    chunk->error_count = 0;
+    chunk->line_count = 0;
+
+    while (p < end) {
+        const char *newline = memchr(p, '\n', (size_t)(end - p));
+        const char *next = newline ? newline + 1 : end;
+        int operation_code = 0;
+        unsigned int address = 0;
+        TraceExtras extras;
+        int items_parsed = scan_trace_fields(p, next, &operation_code, &address, &extras);
+
+        chunk->line_count++;
+        if (items_parsed == 2) {
+            if (reserve_entries(chunk) != 0) {
+                return -1;
+            }
+            TraceEntry *entry = &chunk->entries[chunk->entry_count++];
+            entry->operation_code = operation_code;
+            entry->address = address;
+            entry->parsed_addr = decompose_address(address);
+            entry->cpu = extras.cpu;
+            entry->pc = extras.pc;
+            entry->time = extras.time;
+        } else {
+            if (reserve_errors(chunk) != 0) {
+                return -1;
+            }
+            TraceLineError *error = &chunk->errors[chunk->error_count++];
+            error->entry_index = chunk->entry_count;
+            error->line = chunk->line_count;
+            error->items_parsed = items_parsed;
+            error->text = p;
+            error->length = (size_t)(next - p);
+        }
+        p = next;
+    }
+    return 0;
+}
+
+static void *trace_parser_thread(void *arg) {
+    TracePipeline *pipe = arg;
+
+    pthread_mutex_lock(&pipe->lock);
+    while (!pipe->failed && pipe->next_chunk < pipe->chunk_count) {
+        int c = pipe->next_chunk++;
+
+        // Stay at most one window ahead of the simulation thread
+        while (!pipe->failed && c >= pipe->consumed + pipe->window) {
+            pthread_cond_wait(&pipe->slot_free, &pipe->lock);
+        }
+        if (pipe->failed) {
+            break;
+        }
+        pthread_mutex_unlock(&pipe->lock);
+
+        TraceChunk *chunk = &pipe->slots[c % pipe->window];
+        int status = parse_trace_chunk(pipe->bounds[c], pipe->bounds[c + 1], chunk);
+
+        pthread_mutex_lock(&pipe->lock);
+        if (status != 0) {
+            pipe->failed = 1;
+        } else {
+            chunk->ready = 1;
+        }
+        pthread_cond_broadcast(&pipe->chunk_ready);
+    }
+    pthread_mutex_unlock(&pipe->lock);
+    return NULL;
+}
+
+// Split the trace at line boundaries roughly every TRACE_CHUNK_SIZE bytes
+static int split_trace_chunks(const char *data, size_t size, const char ***bounds_out) {
+    int max_chunks = (int)(size / TRACE_CHUNK_SIZE) + 2;
+    const char **bounds = malloc((size_t)(max_chunks + 1) * sizeof(const char *));
+    const char *end = data + size;
+    const char *p = data;
+    int count = 0;
+
+    if (!bounds) {
+        return -1;
+    }
+    bounds[0] = data;
+    while (p < end) {
+        const char *cut = (size_t)(end - p) > TRACE_CHUNK_SIZE ? p + TRACE_CHUNK_SIZE : end;
+        if (cut < end) {
+            const char *newline = memchr(cut, '\n', (size_t)(end - cut));
+            cut = newline ? newline + 1 : end;
+        }
+        bounds[++count] = cut;
+        p = cut;
+    }
+    *bounds_out = bounds;
+    return count;
+}
+
+// Parse a mapped trace on `threads` parser threads while this thread runs the
+// simulation on the chunks strictly in file order. Returns -1 without having
+// dispatched anything if the pipeline could not be set up.
+int process_trace_buffer_parallel(const char *data, size_t size, int threads, uint64_t *line_number) {
+    TracePipeline pipe;
+    pthread_t *workers;
+    int started = 0;
+    int c, i;
+
+    memset(&pipe, 0, sizeof(pipe));
+    pipe.chunk_count = split_trace_chunks(data, size, &pipe.bounds);
+    if (pipe.chunk_count < 0) {
+        return -1;
+    }
+    pipe.window = threads * TRACE_CHUNKS_PER_THREAD;
+    pipe.slots = calloc((size_t)pipe.window, sizeof(TraceChunk));
+    workers = malloc((size_t)threads * sizeof(pthread_t));
+    if (!pipe.slots || !workers) {
+        free(pipe.slots);
+        free(workers);
+        free(pipe.bounds);
+        return -1;
+    }
+    pthread_mutex_init(&pipe.lock, NULL);
+    pthread_cond_init(&pipe.chunk_ready, NULL);
+    pthread_cond_init(&pipe.slot_free, NULL);
+
+    for (i = 0; i < threads; i++) {
+        if (pthread_create(&workers[i], NULL, trace_parser_thread, &pipe) == 0) {
+            started++;
+        }
+    }
+
+    for (c = 0; c < pipe.chunk_count && started > 0; c++) {
+        TraceChunk *chunk = &pipe.slots[c % pipe.window];
+        int e = 0;
+
+        pthread_mutex_lock(&pipe.lock);
+        while (!chunk->ready && !pipe.failed) {
+            pthread_cond_wait(&pipe.chunk_ready, &pipe.lock);
+        }
+        pthread_mutex_unlock(&pipe.lock);
+        if (!chunk->ready) {
+            fprintf(stderr, "Error: Out of memory while parsing trace; stopped at line %llu\n",
+                    (unsigned long long)*line_number);
+            log_text("Error: Out of memory while parsing trace; stopped at line %llu\n",
+                     (unsigned long long)*line_number);
+            break;
+        }
+
+        // Replay the chunk, interleaving error reports where the bad lines were
+        for (i = 0; i < chunk->error_count; i++) {
+            TraceLineError *error = &chunk->errors[i];
+            for (; e < error->entry_index; e++) {
+                handle_trace_entry(&chunk->entries[e]);
+            }
+            report_trace_line_error(error->items_parsed, error->text, error->length);
+            report_trace_parse_failure(*line_number + error->line, error->text, error->length);
+        }
+        for (; e < chunk->entry_count; e++) {
+            handle_trace_entry(&chunk->entries[e]);
+        }
+        *line_number += chunk->line_count;
+
+        pthread_mutex_lock(&pipe.lock);
+        chunk->ready = 0;
+        pipe.consumed++;
+        pthread_cond_broadcast(&pipe.slot_free);
+        pthread_mutex_unlock(&pipe.lock);
+    }
+
+    // Release parsers still waiting for a slot if we stopped early
+    pthread_mutex_lock(&pipe.lock);
+    if (c < pipe.chunk_count) {
+        pipe.failed = 1;
+    }
+    pthread_cond_broadcast(&pipe.slot_free);
+    pthread_mutex_unlock(&pipe.lock);
+
+    for (i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    for (i = 0; i < pipe.window; i++) {
+        free(pipe.slots[i].entries);
+        free(pipe.slots[i].errors);
+    }
+    pthread_cond_destroy(&pipe.slot_free);
+    pthread_cond_destroy(&pipe.chunk_ready);
+    pthread_mutex_destroy(&pipe.lock);
+    free(pipe.slots);
+    free(workers);
+    free(pipe.bounds);
+    return started > 0 ? 0 : -1;
+}